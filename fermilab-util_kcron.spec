@@ -2,6 +2,11 @@
 
 %bcond_without libcap
 %bcond_without seccomp
+%bcond_without krb5
+%bcond_without pam
+%bcond_with profiling
+%bcond_with index
+%bcond_with mirror
 
 %if 0%{?rhel} < 9 && 0%{?fedora} < 31
 %bcond_with landlock
@@ -36,6 +41,12 @@ BuildRequires:	libseccomp-devel
 %if %{with landlock}
 BuildRequires:	kernel-devel
 %endif
+%if %{with krb5}
+BuildRequires:	krb5-devel
+%endif
+%if %{with pam}
+BuildRequires:	pam-devel
+%endif
 
 BuildRequires:	cmake >= 3.14
 BuildRequires:	asciidoc redhat-rpm-config coreutils bash gcc
@@ -53,6 +64,17 @@ The kcron utility has a long history at Fermilab.  It is useful
 for running daemons and automatic jobs with kerberos rights.
 
 
+%if %{with krb5}
+%package devel
+Summary:	Development files for the kcron credential renewal library
+Requires:	%{name}%{?_isa} = %{version}-%{release}
+
+%description devel
+Headers and pkg-config file for libkcron, which keeps tickets for many
+kcron principals fresh from their keytabs on a single thread.
+%endif
+
+
 %prep
 %setup -q -n kcron
 
@@ -82,6 +104,31 @@ source scl_source enable gcc-toolset-14
  -DUSE_LANDLOCK=ON \
 %else
  -DUSE_LANDLOCK=OFF \
+%endif
+%if %{with krb5}
+ -DUSE_KRB5=ON \
+%else
+ -DUSE_KRB5=OFF \
+%endif
+%if %{with pam}
+ -DUSE_PAM=ON \
+%else
+ -DUSE_PAM=OFF \
+%endif
+%if %{with profiling}
+ -DUSE_PROFILING=ON \
+%else
+ -DUSE_PROFILING=OFF \
+%endif
+%if %{with index}
+ -DUSE_INDEX=ON \
+%else
+ -DUSE_INDEX=OFF \
+%endif
+%if %{with mirror}
+ -DUSE_MIRROR=ON \
+%else
+ -DUSE_MIRROR=OFF \
 %endif
  -DCMAKE_VERBOSE_MAKEFILE:BOOL=ON \
  -DCMAKE_RULE_MESSAGES:BOOL=ON \
@@ -131,6 +178,9 @@ done
 %endif
 
 %post
+%if %{with krb5}
+/sbin/ldconfig
+%endif
 %{__mkdir_p} --mode=0755 %{_localstatedir}/kerberos/krb5/user
 %{__chmod} 0751 %{_localstatedir}/kerberos/krb5/user
 
@@ -140,6 +190,28 @@ done
 %config(noreplace) %{_sysconfdir}/sysconfig/kcron
 %attr(0755,root,root) %{_bindir}/*
 %attr(0755,root,root) /usr/libexec/kcron/client-keytab-name
+%attr(0755,root,root) %{_libexecdir}/kcron/kcron-keytab-reaper
+%attr(0755,root,root) %{_libexecdir}/kcron/kcron-ccache-reaper
+%attr(0755,root,root) %{_libexecdir}/kcron/kcron-kdc-proxy
+%attr(0755,root,root) %{_libexecdir}/kcron/kcron-container-keytab
+%attr(0755,root,root) %{_libexecdir}/kcron/kcron-forecast
+%attr(0755,root,root) %{_sbindir}/kcron-reaper
+%attr(0755,root,root) %{_sbindir}/kcron-gssproxy-sync
+%attr(0755,root,root) %{_sbindir}/kcron-reconcile
+%if %{with krb5}
+%attr(0755,root,root) %{_libexecdir}/kcron/kcron-run
+%attr(0755,root,root) %{_libexecdir}/kcron/kcron-verify
+%{_libdir}/libkcron.so.*
+%endif
+%if %{with pam}
+%attr(0755,root,root) %{_libdir}/security/pam_kcron.so
+%endif
+%if %{with index}
+%attr(0755,root,root) %{_libexecdir}/kcron/kcron-index
+%endif
+%if %{with mirror}
+%attr(0755,root,root) %{_libexecdir}/kcron/kcron-mirror
+%endif
 
 %if %{with libcap}
 # If you can edit the memory this allocates, you can redirect the caps
@@ -149,6 +221,15 @@ done
 %attr(4755,root,root) %{_libexecdir}/kcron/init-kcron-keytab
 %endif
 
+%if %{with krb5}
+%postun -p /sbin/ldconfig
+
+%files devel
+%{_includedir}/kcron/
+%{_libdir}/libkcron.so
+%{_libdir}/pkgconfig/kcron.pc
+%endif
+
 %changelog
 * Wed May 28 2025 Pat Riehecky <riehecky@fnal.gov> - 1.9
 - update to 1.9
@@ -46,10 +46,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "kcron_filename.h"
+#include "kcron_mirror.h"
+#include "kcron_profile.h"
 
-int main(void) {
+int main(int argc, char **argv) {
+
+  (void)kcron_profile_init();
+  (void)kcron_profile_phase(KCRON_PHASE_LOADER);
 
   const char *nullstring = NULL;
 
@@ -72,7 +78,18 @@ int main(void) {
     exit(EXIT_FAILURE);
   }
 
-  if (get_filenames(keytab_dirname, keytab_filename, keytab) != 0) {
+  /* -s for the keytab on shared storage, which is what kcroninit and kcrondestroy change */
+  int shared = 0;
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "s")) != -1) {
+    if (opt != 's') {
+      (void)fprintf(stderr, "Usage: %s [-s]\n", __PROGRAM_NAME);
+      exit(EXIT_FAILURE);
+    }
+    shared = 1;
+  }
+
+  if ((shared ? get_filenames(keytab_dirname, keytab_filename, keytab) : get_mirrored_filenames(keytab_dirname, keytab_filename, keytab)) != 0) {
     (void)free(keytab);
     (void)free(keytab_dirname);
     (void)free(keytab_filename);
@@ -80,7 +97,11 @@ int main(void) {
     exit(EXIT_FAILURE);
   }
 
+  (void)kcron_profile_phase(KCRON_PHASE_SETUP);
+
   (void)printf("%s\n", keytab);
+  (void)fflush(stdout);
+  (void)kcron_profile_phase(KCRON_PHASE_OUTPUT);
 
   (void)free(keytab);
   (void)free(keytab_dirname);
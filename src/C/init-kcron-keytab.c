@@ -50,6 +50,7 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/capability.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -58,8 +59,13 @@
 #include "kcron_caps.h"
 #include "kcron_empty_keytab_file.h"
 #include "kcron_filename.h"
+#include "kcron_profile.h"
 #include "kcron_setup.h"
 
+#if USE_INDEX == 1
+#include "kcron_index.h"
+#endif
+
 #ifndef _0600
 #define _0600 S_IRUSR | S_IWUSR
 #endif
@@ -206,7 +212,7 @@ static int chown_chmod_keytab(int filedescriptor, const char *keytab) {
 
   struct stat st = {0};
 
-  if (filedescriptor == 0) {
+  if (filedescriptor < 0) {
     (void)fprintf(stderr, "%s: Invalid file %s.\n", __PROGRAM_NAME, keytab);
     return 1;
   }
@@ -266,19 +272,151 @@ static int chown_chmod_keytab(int filedescriptor, const char *keytab) {
   return 0;
 }
 
-void constructor(void) __attribute__((constructor));
-void constructor(void) {
+#if USE_INDEX == 1
+static int update_index(const char *client_keytab_dirname, struct kcron_index_record *record) __attribute__((nonnull(1, 2))) __attribute__((access(read_only, 1))) __attribute__((warn_unused_result));
+static int update_index(const char *client_keytab_dirname, struct kcron_index_record *record) {
+
+#if USE_CAPABILITIES == 1
+  const cap_value_t index_caps[] = {CAP_DAC_OVERRIDE};
+#else
+  const cap_value_t index_caps[] = {-1};
+#endif
+  const int num_caps = sizeof(index_caps) / sizeof(cap_value_t);
+
+  const char *nullstring = NULL;
+  int index_fd = -1;
+  int rc = 0;
+
+  char *index = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+
+  if (index == nullstring) {
+    (void)fprintf(stderr, "%s: Unable to allocate memory.\n", __PROGRAM_NAME);
+    return 1;
+  }
+  (void)snprintf(index, FILE_PATH_MAX_LENGTH, "%s/%s", client_keytab_dirname, KCRON_INDEX_FILENAME);
+
+  if (geteuid() != getuid()) {
+    /* use of CAP_DAC_OVERRIDE, the first run creates it in CLIENT_KEYTAB_DIR */
+    if (enable_capabilities(index_caps, num_caps) != 0) {
+      (void)fprintf(stderr, "%s: Cannot enable capabilities.\n", __PROGRAM_NAME);
+      (void)free(index);
+      return 1;
+    }
+  }
+
+  index_fd = kcron_index_open(index, KCRON_INDEX_FD, 1);
+
+  if (disable_capabilities() != 0) {
+    (void)fprintf(stderr, "%s: Cannot drop capabilities.\n", __PROGRAM_NAME);
+    if (index_fd >= 0) {
+      (void)close(index_fd);
+    }
+    (void)free(index);
+    return 1;
+  }
+
+  if (index_fd < 0) {
+    (void)fprintf(stderr, "%s: Unable to open index %s.\n", __PROGRAM_NAME, index);
+    (void)free(index);
+    return 1;
+  }
+
+  if (kcron_index_store(index_fd, record) != 0) {
+    (void)fprintf(stderr, "%s: Unable to update index %s.\n", __PROGRAM_NAME, index);
+    rc = 1;
+  }
+
+  (void)close(index_fd);
+  (void)free(index);
+  return rc;
+}
+
+/*
+ * kcroninit and kcrondestroy call us after changing the keytab so the
+ * index follows.  The keytab is read through the same dir/file handles
+ * (fd 3 and 4) the creation path uses.
+ */
+static int index_keytab(const char *keytab_dirname, const char *keytab_filename, const char *client_keytab_dirname) __attribute__((nonnull(1, 2, 3))) __attribute__((access(read_only, 1)))
+__attribute__((access(read_only, 2))) __attribute__((access(read_only, 3))) __attribute__((warn_unused_result));
+static int index_keytab(const char *keytab_dirname, const char *keytab_filename, const char *client_keytab_dirname) {
+
+#if USE_CAPABILITIES == 1
+  const cap_value_t caps[] = {CAP_DAC_OVERRIDE};
+#else
+  const cap_value_t caps[] = {-1};
+#endif
+  const int num_caps = sizeof(caps) / sizeof(cap_value_t);
+
+  struct kcron_index_record record = {0};
+  DIR *keytab_dir = NULL;
+  const DIR *null_dir = NULL;
+  int filedescriptor = -1;
+
+  record.uid = getuid();
+  record.state = KCRON_INDEX_MISSING;
+
+  if (geteuid() != getuid()) {
+    /* use of CAP_DAC_OVERRIDE, the keytab is 0600 and its dir 0700 */
+    if (enable_capabilities(caps, num_caps) != 0) {
+      (void)fprintf(stderr, "%s: Cannot enable capabilities.\n", __PROGRAM_NAME);
+      return 1;
+    }
+  }
+
+  keytab_dir = opendir(keytab_dirname);
+  if (keytab_dir != null_dir) {
+    filedescriptor = openat(dirfd(keytab_dir), keytab_filename, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  }
+
+  if (disable_capabilities() != 0) {
+    (void)fprintf(stderr, "%s: Cannot drop capabilities.\n", __PROGRAM_NAME);
+    if (filedescriptor >= 0) {
+      (void)close(filedescriptor);
+    }
+    if (keytab_dir != null_dir) {
+      (void)closedir(keytab_dir);
+    }
+    return 1;
+  }
+
+  if (filedescriptor >= 0) {
+    if (kcron_index_summarize(filedescriptor, &record) != 0) {
+      (void)fprintf(stderr, "%s: Unable to read %s/%s.\n", __PROGRAM_NAME, keytab_dirname, keytab_filename);
+      (void)close(filedescriptor);
+      (void)closedir(keytab_dir);
+      return 1;
+    }
+    (void)close(filedescriptor);
+  }
+  if (keytab_dir != null_dir) {
+    (void)closedir(keytab_dir);
+  }
+
+  return update_index(client_keytab_dirname, &record);
+}
+#endif
+
+/* glibc hands constructors the same argc and argv as main() */
+void constructor(int argc, char **argv) __attribute__((constructor));
+void constructor(int argc, char **argv) {
+  /* Profiling needs to look around before we lock ourselves down */
+  (void)kcron_profile_init();
+  (void)kcron_profile_phase(KCRON_PHASE_LOADER);
+
   /* Setup runtime hardening /before/ main() is even called */
-  (void)harden_runtime();
+  /* only --index-only may grow the index, main() checks the arguments properly */
+  (void)harden_runtime((argc == 2) && (strcmp(argv[1], "--index-only") == 0));
+  (void)kcron_profile_phase(KCRON_PHASE_HARDEN);
 }
 
-int main(void) {
+int main(int argc, char **argv) {
 
   struct stat st = {0};
 
   const char *nullstring = NULL;
   int filedescriptor = 0;
   int stat_code = -1;
+  int index_only = 0;
 
   DIR *keytab_dir = NULL;
   const DIR *null_dir = NULL;
@@ -294,6 +432,14 @@ int main(void) {
   const uid_t uid = getuid();
   const gid_t gid = getgid();
 
+  /* --index-only is accepted either way so the scripts need not know how we were built */
+  if ((argc == 2) && (strcmp(argv[1], "--index-only") == 0)) {
+    index_only = 1;
+  } else if (argc > 1) {
+    (void)fprintf(stderr, "%s: usage: %s [--index-only]\n", __PROGRAM_NAME, __PROGRAM_NAME);
+    exit(EXIT_FAILURE);
+  }
+
   char *keytab = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
   char *keytab_dirname = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
   char *keytab_filename = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
@@ -350,6 +496,22 @@ int main(void) {
     exit(EXIT_FAILURE);
   }
 
+  (void)kcron_profile_phase(KCRON_PHASE_SETUP);
+
+  if (index_only == 1) {
+#if USE_INDEX == 1
+    stat_code = index_keytab(keytab_dirname, keytab_filename, client_keytab_dirname);
+#else
+    stat_code = 0;
+#endif
+    (void)kcron_profile_phase(KCRON_PHASE_KEYTAB);
+    (void)free(keytab);
+    (void)free(keytab_dirname);
+    (void)free(keytab_filename);
+    (void)free(client_keytab_dirname);
+    exit((stat_code == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+
   /* make sure our storage directory exists */
   if (mkdir_if_missing(keytab_dirname, uid, gid, _0700) != 0) {
     (void)fprintf(stderr, "%s: Cannot make dir %s.\n", __PROGRAM_NAME, keytab_dirname);
@@ -360,6 +522,8 @@ int main(void) {
     exit(EXIT_FAILURE);
   }
 
+  (void)kcron_profile_phase(KCRON_PHASE_MKDIR);
+
   if (euid != uid) {
     /* use of CAP_DAC_OVERRIDE as we may not be able to chdir otherwise   */
     if (enable_capabilities(caps, num_caps) != 0) {
@@ -426,15 +590,6 @@ int main(void) {
       exit(EXIT_FAILURE);
     }
 
-    if (disable_capabilities() != 0) {
-      (void)fprintf(stderr, "%s: Cannot drop capabilities.\n", __PROGRAM_NAME);
-      (void)free(keytab);
-      (void)free(keytab_dirname);
-      (void)free(keytab_filename);
-      (void)free(client_keytab_dirname);
-      exit(EXIT_FAILURE);
-    }
-
     if (!S_ISDIR(st.st_mode)) {
       (void)fprintf(stderr, "%s: %s is not a directory.\n", __PROGRAM_NAME, keytab_dirname);
       (void)closedir(keytab_dir);
@@ -445,10 +600,10 @@ int main(void) {
       exit(EXIT_FAILURE);
     }
 
+    /* still CAP_DAC_OVERRIDE, the dir is 0700 and belongs to uid not euid */
     filedescriptor = openat(dirfd(keytab_dir), keytab_filename, O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC, _0600);
 
     if (disable_capabilities() != 0) {
-      /* technically we might not have active caps now, but eh              */
       (void)fprintf(stderr, "%s: Cannot drop capabilities.\n", __PROGRAM_NAME);
       (void)free(keytab);
       (void)free(keytab_dirname);
@@ -458,7 +613,7 @@ int main(void) {
     }
 
     /* did the file really create at the target location */
-    if (filedescriptor == 0) {
+    if (filedescriptor < 0) {
       (void)fprintf(stderr, "%s: %s is missing, cannot create.\n", __PROGRAM_NAME, keytab);
       (void)closedir(keytab_dir);
       (void)free(keytab);
@@ -517,7 +672,11 @@ int main(void) {
     (void)close(filedescriptor);
   } /* no else required, this exists to make it */
 
+  (void)kcron_profile_phase(KCRON_PHASE_KEYTAB);
+
   (void)printf("%s\n", keytab);
+  (void)fflush(stdout);
+  (void)kcron_profile_phase(KCRON_PHASE_OUTPUT);
 
   (void)free(keytab);
   (void)free(keytab_dirname);
@@ -0,0 +1,603 @@
+/*
+ *
+ * Remove expired credential caches left behind by kcron principals
+ * Reads the ccache format directly, klist is never run
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef __PROGRAM_NAME
+#define __PROGRAM_NAME "kcron-ccache-reaper"
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kcron_ratelimit.h"
+
+#define REAPER_DEFAULT_DIR "/tmp"
+#define REAPER_DEFAULT_PREFIX "krb5cc_"
+#define REAPER_DEFAULT_THREADS 8
+#define REAPER_MAX_THREADS 256
+#define REAPER_DEFAULT_RATE 500
+#define REAPER_DEFAULT_GRACE 300
+/* a cron cache is a TGT and a few service tickets, anything bigger is not ours */
+#define REAPER_MAX_BYTES (64 * 1024)
+#define REAPER_PRINCIPAL_MAX_LENGTH 1024
+#define REAPER_CONFIG_REALM "X-CACHECONF:"
+/* where an expired cache waits while it is checked once more */
+#define REAPER_QUARANTINE ".kcron-reap."
+
+struct reaper_cache {
+  char *name;
+  char *principal;
+  const char *state;
+  const char *reason;
+  int error; /* errno instead of a reason, strerror() is not for the workers */
+  int64_t endtime;
+};
+
+struct reaper_job {
+  int top_fd;
+  int dry_run;
+  int64_t now;
+  int64_t grace;
+  struct reaper_cache *caches;
+  size_t ncaches;
+  atomic_size_t next;
+  struct kcron_bucket bucket;
+};
+
+/* Big endian reader over a ccache held in memory */
+struct reaper_cursor {
+  const unsigned char *buf;
+  size_t len;
+  size_t pos;
+};
+
+static int reaper_cache_cmp(const void *a, const void *b) __attribute__((nonnull(1, 2)));
+static int reaper_cache_cmp(const void *a, const void *b) { return strcmp(((const struct reaper_cache *)a)->name, ((const struct reaper_cache *)b)->name); }
+
+static int reaper_skip(struct reaper_cursor *c, size_t n) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+static int reaper_skip(struct reaper_cursor *c, size_t n) {
+  if (n > c->len - c->pos) {
+    return 1;
+  }
+  c->pos += n;
+  return 0;
+}
+
+static int reaper_u16(struct reaper_cursor *c, uint16_t *value) __attribute__((nonnull(1, 2))) __attribute__((warn_unused_result));
+static int reaper_u16(struct reaper_cursor *c, uint16_t *value) {
+  if (c->len - c->pos < 2) {
+    return 1;
+  }
+  *value = (uint16_t)(((unsigned)c->buf[c->pos] << 8) | (unsigned)c->buf[c->pos + 1]);
+  c->pos += 2;
+  return 0;
+}
+
+static int reaper_u32(struct reaper_cursor *c, uint32_t *value) __attribute__((nonnull(1, 2))) __attribute__((warn_unused_result));
+static int reaper_u32(struct reaper_cursor *c, uint32_t *value) {
+  if (c->len - c->pos < 4) {
+    return 1;
+  }
+  *value = ((uint32_t)c->buf[c->pos] << 24) | ((uint32_t)c->buf[c->pos + 1] << 16) | ((uint32_t)c->buf[c->pos + 2] << 8) | (uint32_t)c->buf[c->pos + 3];
+  c->pos += 4;
+  return 0;
+}
+
+/* A 32 bit length and that many bytes, left in place */
+static int reaper_data(struct reaper_cursor *c, const unsigned char **data, uint32_t *len) __attribute__((nonnull(1, 2, 3))) __attribute__((warn_unused_result));
+static int reaper_data(struct reaper_cursor *c, const unsigned char **data, uint32_t *len) {
+  if (reaper_u32(c, len) != 0) {
+    return 1;
+  }
+  *data = c->buf + c->pos;
+  return reaper_skip(c, *len);
+}
+
+/*
+ * Read a principal, rendering it as comp/comp@REALM into name when name is
+ * not NULL.  cron is set when it looks like one of ours: three components,
+ * the second of them "cron".
+ */
+static int reaper_principal(struct reaper_cursor *c, char *name, int *cron, int *config) __attribute__((warn_unused_result));
+static int reaper_principal(struct reaper_cursor *c, char *name, int *cron, int *config) {
+  const unsigned char *data = NULL;
+  const unsigned char *realm = NULL;
+  uint32_t name_type = 0;
+  uint32_t count = 0;
+  uint32_t len = 0;
+  uint32_t realm_len = 0;
+  size_t out = 0;
+
+  if ((reaper_u32(c, &name_type) != 0) || (reaper_u32(c, &count) != 0) || (reaper_data(c, &realm, &realm_len) != 0)) {
+    return 1;
+  }
+  if (config != NULL) {
+    *config = (realm_len == strlen(REAPER_CONFIG_REALM)) && (memcmp(realm, REAPER_CONFIG_REALM, realm_len) == 0);
+  }
+  if (cron != NULL) {
+    *cron = (count == 3);
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (reaper_data(c, &data, &len) != 0) {
+      return 1;
+    }
+    if ((cron != NULL) && (i == 1) && ((len != 4) || (memcmp(data, "cron", 4) != 0))) {
+      *cron = 0;
+    }
+    if (name != NULL) {
+      if (out + len + 2 >= REAPER_PRINCIPAL_MAX_LENGTH) {
+        return 1;
+      }
+      if (i > 0) {
+        name[out++] = '/';
+      }
+      (void)memcpy(name + out, data, len);
+      out += len;
+    }
+  }
+
+  if (name != NULL) {
+    if (out + realm_len + 2 >= REAPER_PRINCIPAL_MAX_LENGTH) {
+      return 1;
+    }
+    name[out++] = '@';
+    (void)memcpy(name + out, realm, realm_len);
+    out += realm_len;
+    name[out] = '\0';
+  }
+  return 0;
+}
+
+/*
+ * Walk a version 3 or 4 FILE ccache, taking the default principal and the
+ * latest end time of any real credential.  Configuration entries do not
+ * count, and a cache with no credentials at all has no end time.
+ * Returns 1 for anything that is not a ccache this understands.
+ */
+static int reaper_parse(const unsigned char *buf, size_t len, char *principal, int *cron, int64_t *endtime) __attribute__((nonnull(1, 3, 4, 5))) __attribute__((warn_unused_result));
+static int reaper_parse(const unsigned char *buf, size_t len, char *principal, int *cron, int64_t *endtime) {
+  struct reaper_cursor c = {.buf = buf, .len = len, .pos = 0};
+  const unsigned char *data = NULL;
+  uint32_t data_len = 0;
+  uint32_t count = 0;
+  uint32_t times[4] = {0};
+  uint16_t version = 0;
+  uint16_t header_len = 0;
+  uint16_t ignored = 0;
+
+  *endtime = -1;
+
+  /* 1 and 2 are in host byte order and have not been written since krb5 1.0 */
+  if ((reaper_u16(&c, &version) != 0) || ((version != 0x0503) && (version != 0x0504))) {
+    return 1;
+  }
+  if ((version == 0x0504) && ((reaper_u16(&c, &header_len) != 0) || (reaper_skip(&c, header_len) != 0))) {
+    return 1;
+  }
+  if (reaper_principal(&c, principal, cron, NULL) != 0) {
+    return 1;
+  }
+
+  while (c.pos < c.len) {
+    int config = 0;
+
+    if ((reaper_principal(&c, NULL, NULL, NULL) != 0) || (reaper_principal(&c, NULL, NULL, &config) != 0)) {
+      return 1;
+    }
+    /* keyblock, version 3 repeats the enctype */
+    if ((reaper_u16(&c, &ignored) != 0) || ((version == 0x0503) && (reaper_u16(&c, &ignored) != 0)) || (reaper_data(&c, &data, &data_len) != 0)) {
+      return 1;
+    }
+    /* authtime, starttime, endtime, renew_till */
+    for (size_t i = 0; i < 4; i++) {
+      if (reaper_u32(&c, &times[i]) != 0) {
+        return 1;
+      }
+    }
+    /* is_skey and ticket flags */
+    if (reaper_skip(&c, 1 + 4) != 0) {
+      return 1;
+    }
+    /* addresses then authdata, each a count of (16 bit type, data) */
+    for (size_t list = 0; list < 2; list++) {
+      if (reaper_u32(&c, &count) != 0) {
+        return 1;
+      }
+      for (uint32_t i = 0; i < count; i++) {
+        if ((reaper_u16(&c, &ignored) != 0) || (reaper_data(&c, &data, &data_len) != 0)) {
+          return 1;
+        }
+      }
+    }
+    /* ticket and second ticket */
+    if ((reaper_data(&c, &data, &data_len) != 0) || (reaper_data(&c, &data, &data_len) != 0)) {
+      return 1;
+    }
+
+    if ((!config) && ((int64_t)times[2] > *endtime)) {
+      *endtime = (int64_t)times[2];
+    }
+  }
+  return 0;
+}
+
+/*
+ * Open a cache and read it under a shared fcntl lock, waiting for the lock
+ * when wait is set.  Returns the state to report when it is not a kcron
+ * cache that could be read, NULL when principal, cron and endtime are set.
+ */
+static const char *reaper_load(int top_fd, const char *name, int wait, int *fd, struct stat *st, char *principal, int *cron, int64_t *endtime)
+    __attribute__((nonnull(2, 4, 5, 6, 7, 8))) __attribute__((warn_unused_result));
+static const char *reaper_load(int top_fd, const char *name, int wait, int *fd, struct stat *st, char *principal, int *cron, int64_t *endtime) {
+  struct flock lock = {.l_type = F_RDLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 0};
+  unsigned char buf[REAPER_MAX_BYTES];
+  ssize_t got = 0;
+
+  *fd = openat(top_fd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+  if (*fd < 0) {
+    /* someone else cleaned up first */
+    return (errno == ENOENT) ? "gone" : "unreadable";
+  }
+
+  if ((fstat(*fd, st) != 0) || (!S_ISREG(st->st_mode)) || (st->st_nlink != 1) || (st->st_size > REAPER_MAX_BYTES)) {
+    return "skipped";
+  }
+  if (fcntl(*fd, wait ? F_SETLKW : F_SETLK, &lock) != 0) {
+    return "busy";
+  }
+
+  got = pread(*fd, buf, sizeof(buf), 0);
+  if ((got < 0) || (reaper_parse(buf, (size_t)got, principal, cron, endtime) != 0) || (!*cron)) {
+    return "skipped";
+  }
+  if (*endtime < 0) {
+    /* initialised but never filled, judge it by when that happened */
+    *endtime = (int64_t)st->st_mtime;
+  }
+  return NULL;
+}
+
+/*
+ * libkrb5 opens a FILE cache by name and only then takes its fcntl lock,
+ * so our shared lock does not protect anything: a kinit that opened the
+ * cache while we read it gets the lock once we close and writes its new
+ * tickets into the inode we just unlinked.  An expired cache is instead
+ * renamed out of the way first, so later opens by name create a fresh
+ * cache, then read again once any writer that opened the old name has
+ * had the lock.  If one wrote valid tickets the cache goes back under its
+ * name, otherwise the quarantined file is removed.  Quarantined names
+ * left behind by an interrupted run are picked up by the next one.
+ */
+static void reaper_check(struct reaper_job *job, struct reaper_cache *cache) __attribute__((nonnull(1, 2)));
+static void reaper_check(struct reaper_job *job, struct reaper_cache *cache) {
+  char principal[REAPER_PRINCIPAL_MAX_LENGTH] = {0};
+  char quarantine[NAME_MAX + 1] = {0};
+  const char *state = NULL;
+  const char *name = cache->name;
+  struct stat st = {0};
+  struct stat again = {0};
+  int cron = 0;
+  int fd = -1;
+
+  cache->state = "kept";
+
+  if (strncmp(cache->name, REAPER_QUARANTINE, strlen(REAPER_QUARANTINE)) == 0) {
+    name = cache->name + strlen(REAPER_QUARANTINE);
+  }
+  if (snprintf(quarantine, sizeof(quarantine), "%s%s", REAPER_QUARANTINE, name) >= (int)sizeof(quarantine)) {
+    cache->state = "skipped";
+    return;
+  }
+
+  state = reaper_load(job->top_fd, cache->name, 0, &fd, &st, principal, &cron, &cache->endtime);
+  if (state != NULL) {
+    cache->state = state;
+    if (strcmp(state, "unreadable") == 0) {
+      cache->error = errno;
+    }
+    if (fd >= 0) {
+      (void)close(fd);
+    }
+    return;
+  }
+
+  cache->principal = strdup(principal);
+  cache->state = (cache->endtime + job->grace > job->now) ? "valid" : "expired";
+  /* a quarantined leftover goes back under its name or away, whatever it holds */
+  if ((job->dry_run) || ((name == cache->name) && (strcmp(cache->state, "valid") == 0))) {
+    (void)close(fd);
+    return;
+  }
+
+  kcron_bucket_take(&job->bucket);
+
+  if ((fstatat(job->top_fd, cache->name, &again, AT_SYMLINK_NOFOLLOW) != 0) || (again.st_dev != st.st_dev) || (again.st_ino != st.st_ino)) {
+    cache->reason = "replaced while being read";
+    (void)close(fd);
+    return;
+  }
+  if ((name == cache->name) && (renameat(job->top_fd, cache->name, job->top_fd, quarantine) != 0)) {
+    cache->error = errno;
+    (void)close(fd);
+    return;
+  }
+  (void)close(fd);
+
+  /* anyone who opened the old name is queued on the lock or already done */
+  state = reaper_load(job->top_fd, quarantine, 1, &fd, &again, principal, &cron, &cache->endtime);
+  if ((state != NULL) || (again.st_dev != st.st_dev) || (again.st_ino != st.st_ino)) {
+    cache->reason = "changed while quarantined";
+    if (fd >= 0) {
+      (void)close(fd);
+    }
+    return;
+  }
+
+  cache->state = "expired";
+  if (cache->endtime + job->grace > job->now) {
+    /* renewed under us, put it back unless a newer cache already took the name */
+    if (linkat(job->top_fd, quarantine, job->top_fd, name, 0) == 0) {
+      cache->state = "valid";
+    } else if (errno != EEXIST) {
+      cache->error = errno;
+      (void)close(fd);
+      return;
+    }
+  }
+
+  if (unlinkat(job->top_fd, quarantine, 0) != 0) {
+    cache->error = errno;
+    (void)close(fd);
+    return;
+  }
+  (void)close(fd);
+
+  if (strcmp(cache->state, "expired") == 0) {
+    cache->state = "removed";
+  }
+}
+
+static void *reaper_worker(void *arg) __attribute__((nonnull(1)));
+static void *reaper_worker(void *arg) {
+  struct reaper_job *job = arg;
+
+  for (;;) {
+    const size_t i = atomic_fetch_add(&job->next, 1);
+    if (i >= job->ncaches) {
+      break;
+    }
+    reaper_check(job, &job->caches[i]);
+  }
+
+  return NULL;
+}
+
+static int reaper_add_cache(struct reaper_cache **caches, size_t *ncaches, size_t *size, const char *name) __attribute__((nonnull(1, 2, 3, 4)))
+__attribute__((warn_unused_result));
+static int reaper_add_cache(struct reaper_cache **caches, size_t *ncaches, size_t *size, const char *name) {
+  if (*ncaches == *size) {
+    const size_t bigger_size = (*size == 0) ? 1024 : *size * 2;
+    struct reaper_cache *bigger = reallocarray(*caches, bigger_size, sizeof(struct reaper_cache));
+    if (bigger == NULL) {
+      return 1;
+    }
+    *caches = bigger;
+    *size = bigger_size;
+  }
+
+  struct reaper_cache *cache = &(*caches)[*ncaches];
+  (void)memset(cache, 0, sizeof(*cache));
+  cache->name = strdup(name);
+  if (cache->name == NULL) {
+    return 1;
+  }
+  (*ncaches)++;
+  return 0;
+}
+
+static void usage(void) {
+  (void)fprintf(stderr, "Usage: %s [-n] [-v] [-j threads] [-r rate] [-g grace] [-p prefix] [-d directory]\n", __PROGRAM_NAME);
+  (void)fprintf(stderr, "  Remove expired FILE credential caches of name/cron/host principals:\n");
+  (void)fprintf(stderr, "    state endtime cache principal\n");
+  (void)fprintf(stderr, "  -n  dry run, list what would be removed as 'expired'\n");
+  (void)fprintf(stderr, "  -v  also list kcron caches that are kept, and why\n");
+  (void)fprintf(stderr, "  -j  threads to use (default %d)\n", REAPER_DEFAULT_THREADS);
+  (void)fprintf(stderr, "  -r  at most this many removals a second, 0 for no limit (default %d)\n", REAPER_DEFAULT_RATE);
+  (void)fprintf(stderr, "  -g  seconds past expiry before a cache is removed (default %d)\n", REAPER_DEFAULT_GRACE);
+  (void)fprintf(stderr, "  -p  cache file name prefix (default %s)\n", REAPER_DEFAULT_PREFIX);
+  (void)fprintf(stderr, "  -d  directory holding the caches (default %s)\n", REAPER_DEFAULT_DIR);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+
+  const struct dirent *de = NULL;
+  const char *top = REAPER_DEFAULT_DIR;
+  const char *prefix = REAPER_DEFAULT_PREFIX;
+  struct reaper_job job = {.top_fd = -1, .dry_run = 0, .now = 0, .grace = REAPER_DEFAULT_GRACE, .caches = NULL, .ncaches = 0};
+  pthread_t threads[REAPER_MAX_THREADS];
+  struct timespec start = {0};
+  DIR *d = NULL;
+  double rate = REAPER_DEFAULT_RATE;
+  size_t size = 0;
+  size_t scanned = 0;
+  size_t nthreads = REAPER_DEFAULT_THREADS;
+  size_t cron = 0;
+  size_t expired = 0;
+  size_t removed = 0;
+  int verbose = 0;
+  int opt = 0;
+  int fd = -1;
+
+  while ((opt = getopt(argc, argv, "nvj:r:g:p:d:h")) != -1) {
+    switch (opt) {
+    case 'n':
+      job.dry_run = 1;
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case 'j':
+      nthreads = strtoul(optarg, NULL, 10);
+      if ((nthreads == 0) || (nthreads > REAPER_MAX_THREADS)) {
+        usage();
+      }
+      break;
+    case 'r':
+      rate = strtod(optarg, NULL);
+      if (!(rate >= 0)) {
+        usage();
+      }
+      break;
+    case 'g':
+      job.grace = strtoll(optarg, NULL, 10);
+      if (job.grace < 0) {
+        usage();
+      }
+      break;
+    case 'p':
+      prefix = optarg;
+      break;
+    case 'd':
+      top = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+
+  const size_t prefix_len = strlen(prefix);
+  if (prefix_len == 0) {
+    usage();
+  }
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &start);
+  job.now = (int64_t)time(NULL);
+
+  job.top_fd = open(top, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  fd = (job.top_fd < 0) ? -1 : dup(job.top_fd);
+  if ((fd < 0) || ((d = fdopendir(fd)) == NULL)) {
+    (void)fprintf(stderr, "%s: unable to read %s: %s\n", __PROGRAM_NAME, top, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  /* Only names here, every stat and open is left to the workers */
+  while ((de = readdir(d)) != NULL) {
+    const char *base = de->d_name;
+    if (strncmp(base, REAPER_QUARANTINE, strlen(REAPER_QUARANTINE)) == 0) {
+      base += strlen(REAPER_QUARANTINE);
+    }
+    if ((strncmp(base, prefix, prefix_len) != 0) || ((de->d_type != DT_REG) && (de->d_type != DT_UNKNOWN))) {
+      continue;
+    }
+    if (reaper_add_cache(&job.caches, &job.ncaches, &size, de->d_name) != 0) {
+      (void)fprintf(stderr, "%s: unable to allocate memory.\n", __PROGRAM_NAME);
+      exit(EXIT_FAILURE);
+    }
+  }
+  (void)closedir(d);
+  scanned = job.ncaches;
+
+  kcron_bucket_init(&job.bucket, rate);
+
+  if (nthreads > job.ncaches) {
+    nthreads = (job.ncaches == 0) ? 1 : job.ncaches;
+  }
+  atomic_init(&job.next, 0);
+  for (size_t i = 0; i < nthreads; i++) {
+    if (pthread_create(&threads[i], NULL, reaper_worker, &job) != 0) {
+      (void)fprintf(stderr, "%s: unable to start thread.\n", __PROGRAM_NAME);
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (size_t i = 0; i < nthreads; i++) {
+    (void)pthread_join(threads[i], NULL);
+  }
+
+  qsort(job.caches, job.ncaches, sizeof(struct reaper_cache), reaper_cache_cmp);
+
+  for (size_t i = 0; i < job.ncaches; i++) {
+    const struct reaper_cache *cache = &job.caches[i];
+
+    if (cache->reason != NULL) {
+      (void)fprintf(stderr, "%s: %s/%s: %s\n", __PROGRAM_NAME, top, cache->name, cache->reason);
+    } else if (cache->error != 0) {
+      (void)fprintf(stderr, "%s: %s/%s: %s\n", __PROGRAM_NAME, top, cache->name, strerror(cache->error));
+    }
+    if (cache->principal == NULL) {
+      continue;
+    }
+
+    cron++;
+    expired += (strcmp(cache->state, "valid") != 0);
+    removed += (strcmp(cache->state, "removed") == 0);
+    if ((!verbose) && (strcmp(cache->state, "removed") != 0) && (strcmp(cache->state, "expired") != 0)) {
+      continue;
+    }
+    (void)printf("%s %lld %s %s\n", cache->state, (long long)cache->endtime, cache->name, cache->principal);
+  }
+  (void)fflush(stdout);
+
+  const double elapsed = kcron_since(&start);
+  (void)fprintf(stderr, "%s: %zu of %zu caches are kcron's, %zu expired, %zu removed, in %.3f s, %.1f files/s\n", __PROGRAM_NAME, cron, scanned, expired, removed, elapsed,
+                (elapsed > 0) ? (double)scanned / elapsed : 0.0);
+
+  kcron_bucket_destroy(&job.bucket);
+  (void)close(job.top_fd);
+  for (size_t i = 0; i < job.ncaches; i++) {
+    (void)free(job.caches[i].name);
+    (void)free(job.caches[i].principal);
+  }
+  (void)free(job.caches);
+
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,240 @@
+/*
+ *
+ * Start a container with only the caller's keytab handed in
+ * Passes the open keytab as an fd, or bind mounts that one file
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef __PROGRAM_NAME
+#define __PROGRAM_NAME "kcron-container-keytab"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kcron_filename.h"
+#include "kcron_mirror.h"
+
+/* podman --preserve-fds hands over 3 and up, apptainer keeps whatever is open */
+#define KCRON_CONTAINER_FD 3
+#define KCRON_CONTAINER_PATH "/run/kcron/client.keytab"
+/* our own options, at most four of them, and the terminating NULL */
+#define KCRON_CONTAINER_EXTRA_ARGS 5
+
+enum kcron_runtime { RUNTIME_APPTAINER, RUNTIME_PODMAN };
+
+static void usage(void) __attribute__((noreturn));
+static void usage(void) {
+  (void)fprintf(stderr, "Usage: %s [-b] [-p path] [--] runtime subcommand [args...]\n", __PROGRAM_NAME);
+  (void)fprintf(stderr, "  Start a container with your kcron keytab and KRB5_CLIENT_KTNAME naming it.\n");
+  (void)fprintf(stderr, "  runtime is apptainer, singularity or podman, for example:\n");
+  (void)fprintf(stderr, "    %s apptainer exec image.sif kinit -k\n", __PROGRAM_NAME);
+  (void)fprintf(stderr, "  By default the open keytab is passed in as fd %d, read as /proc/self/fd/%d.\n", KCRON_CONTAINER_FD, KCRON_CONTAINER_FD);
+  (void)fprintf(stderr, "  -b  bind mount the keytab read only instead\n");
+  (void)fprintf(stderr, "  -p  where -b puts it in the container (default %s)\n", KCRON_CONTAINER_PATH);
+  exit(EXIT_FAILURE);
+}
+
+static int runtime_of(const char *command, enum kcron_runtime *runtime) __attribute__((nonnull(1, 2))) __attribute__((warn_unused_result));
+static int runtime_of(const char *command, enum kcron_runtime *runtime) {
+  const char *name = strrchr(command, '/');
+
+  name = (name == NULL) ? command : name + 1;
+  if ((strcmp(name, "apptainer") == 0) || (strcmp(name, "singularity") == 0)) {
+    *runtime = RUNTIME_APPTAINER;
+    return 0;
+  }
+  if (strcmp(name, "podman") == 0) {
+    *runtime = RUNTIME_PODMAN;
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ * Open the keytab the way init-kcron-keytab does, never through a
+ * symlink, and only if it is a plain file of ours nobody else can read.
+ */
+static int open_keytab(const char *keytab_dirname, const char *keytab_filename, uid_t uid, struct stat *st) __attribute__((nonnull(1, 2, 4)))
+__attribute__((warn_unused_result));
+static int open_keytab(const char *keytab_dirname, const char *keytab_filename, uid_t uid, struct stat *st) {
+  int dir_fd = -1;
+  int fd = -1;
+
+  dir_fd = open(keytab_dirname, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (dir_fd < 0) {
+    (void)fprintf(stderr, "%s: unable to open %s: %s\n", __PROGRAM_NAME, keytab_dirname, strerror(errno));
+    return -1;
+  }
+  fd = openat(dir_fd, keytab_filename, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+  (void)close(dir_fd);
+  if (fd < 0) {
+    (void)fprintf(stderr, "%s: unable to open %s/%s: %s\n", __PROGRAM_NAME, keytab_dirname, keytab_filename, strerror(errno));
+    return -1;
+  }
+
+  if ((fstat(fd, st) != 0) || (!S_ISREG(st->st_mode)) || (st->st_uid != uid) || ((st->st_mode & (S_IRWXG | S_IRWXO)) != 0)) {
+    (void)fprintf(stderr, "%s: %s/%s is not a keytab only you can read.\n", __PROGRAM_NAME, keytab_dirname, keytab_filename);
+    (void)close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int main(int argc, char **argv) {
+
+  const char *nullstring = NULL;
+  const char *container_path = KCRON_CONTAINER_PATH;
+  enum kcron_runtime runtime = RUNTIME_APPTAINER;
+  struct stat st = {0};
+  struct stat again = {0};
+  char ktname[FILE_PATH_MAX_LENGTH + 32] = {0};
+  char env_arg[FILE_PATH_MAX_LENGTH + 64] = {0};
+  char mount_arg[(FILE_PATH_MAX_LENGTH * 2) + 16] = {0};
+  char **args = NULL;
+  size_t nargs = 0;
+  int bind = 0;
+  int opt = 0;
+  int fd = -1;
+
+  const uid_t uid = getuid();
+
+  char *keytab = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+  char *keytab_dirname = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+  char *keytab_filename = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+
+  if ((keytab == nullstring) || (keytab_dirname == nullstring) || (keytab_filename == nullstring)) {
+    (void)fprintf(stderr, "%s: unable to allocate memory.\n", __PROGRAM_NAME);
+    exit(EXIT_FAILURE);
+  }
+
+  /* + so options after the runtime belong to the runtime */
+  while ((opt = getopt(argc, argv, "+bp:h")) != -1) {
+    switch (opt) {
+    case 'b':
+      bind = 1;
+      break;
+    case 'p':
+      container_path = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if ((argc - optind < 2) || (container_path[0] != '/') || (strchr(container_path, ':') != NULL)) {
+    usage();
+  }
+  if (runtime_of(argv[optind], &runtime) != 0) {
+    (void)fprintf(stderr, "%s: %s is not a container runtime I know.\n", __PROGRAM_NAME, argv[optind]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (get_mirrored_filenames(keytab_dirname, keytab_filename, keytab) != 0) {
+    (void)fprintf(stderr, "%s: Cannot determine keytab filename.\n", __PROGRAM_NAME);
+    exit(EXIT_FAILURE);
+  }
+
+  fd = open_keytab(keytab_dirname, keytab_filename, uid, &st);
+  if (fd < 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  args = calloc((size_t)argc + KCRON_CONTAINER_EXTRA_ARGS, sizeof(char *));
+  if (args == NULL) {
+    (void)fprintf(stderr, "%s: unable to allocate memory.\n", __PROGRAM_NAME);
+    exit(EXIT_FAILURE);
+  }
+  /* runtime and subcommand, then ours ahead of everything the caller gave */
+  args[nargs++] = argv[optind];
+  args[nargs++] = argv[optind + 1];
+
+  if (bind) {
+    /*
+     * The runtime walks the path again to mount it, make sure it still
+     * names the file that passed our checks.
+     */
+    if ((lstat(keytab, &again) != 0) || (again.st_dev != st.st_dev) || (again.st_ino != st.st_ino)) {
+      (void)fprintf(stderr, "%s: %s changed while being checked.\n", __PROGRAM_NAME, keytab);
+      exit(EXIT_FAILURE);
+    }
+    (void)close(fd);
+
+    (void)snprintf(ktname, sizeof(ktname), "FILE:%s", container_path);
+    (void)snprintf(mount_arg, sizeof(mount_arg), "%s:%s:ro", keytab, container_path);
+    args[nargs++] = (runtime == RUNTIME_PODMAN) ? "--volume" : "--bind";
+    args[nargs++] = mount_arg;
+  } else {
+    /* the fd is the keytab, the container never needs to see our directories */
+    if (fd != KCRON_CONTAINER_FD) {
+      if (dup2(fd, KCRON_CONTAINER_FD) != KCRON_CONTAINER_FD) {
+        (void)fprintf(stderr, "%s: unable to move the keytab to fd %d: %s\n", __PROGRAM_NAME, KCRON_CONTAINER_FD, strerror(errno));
+        exit(EXIT_FAILURE);
+      }
+      (void)close(fd);
+    } else if (fcntl(fd, F_SETFD, 0) != 0) {
+      (void)fprintf(stderr, "%s: unable to pass the keytab on: %s\n", __PROGRAM_NAME, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+
+    (void)snprintf(ktname, sizeof(ktname), "FILE:/proc/self/fd/%d", KCRON_CONTAINER_FD);
+    if (runtime == RUNTIME_PODMAN) {
+      args[nargs++] = "--preserve-fds=1";
+    }
+  }
+
+  /* podman does not pass our environment through, apptainer does but may be told not to */
+  (void)snprintf(env_arg, sizeof(env_arg), "KRB5_CLIENT_KTNAME=%s", ktname);
+  args[nargs++] = "--env";
+  args[nargs++] = env_arg;
+
+  for (int i = optind + 2; i < argc; i++) {
+    args[nargs++] = argv[i];
+  }
+  args[nargs] = NULL;
+
+  (void)free(keytab);
+  (void)free(keytab_dirname);
+  (void)free(keytab_filename);
+
+  (void)execvp(args[0], args);
+  (void)fprintf(stderr, "%s: unable to run %s: %s\n", __PROGRAM_NAME, args[0], strerror(errno));
+  exit(EXIT_FAILURE);
+}
@@ -0,0 +1,891 @@
+/*
+ *
+ * Forecast the AS requests a node makes for kcron keytabs over a week
+ * Reads crontabs and systemd user timers, no KDC is contacted
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef __PROGRAM_NAME
+#define __PROGRAM_NAME "kcron-forecast"
+#endif
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pwd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kcron_filename.h"
+
+#define FORECAST_WEEK_SECONDS (7 * 24 * 60 * 60)
+#define FORECAST_WEEK_MINUTES (7 * 24 * 60)
+#define FORECAST_DEFAULT_CRONTABS "/var/spool/cron"
+#define FORECAST_TIMER_DIR ".config/systemd/user/timers.target.wants"
+/* the MIT default ticket_lifetime */
+#define FORECAST_DEFAULT_LIFETIME 86400
+#define FORECAST_MAX_FILE_BYTES (64 * 1024)
+#define FORECAST_MAX_SCHEDULES 256
+/* an empty keytab is just its two byte version */
+#define FORECAST_EMPTY_KEYTAB_BYTES 2
+
+/* One crontab line or OnCalendar= setting, as bitmasks over each field */
+struct forecast_schedule {
+  uint64_t sec;
+  uint64_t min;
+  uint64_t hour;
+  uint64_t dom;
+  uint64_t mon;
+  uint64_t dow;
+  int cron;
+  int dom_star;
+  int dow_star;
+  uint32_t window;
+};
+
+/* What each minute of the simulated week looks like on the local clock */
+struct forecast_minute {
+  uint8_t min;
+  uint8_t hour;
+  uint8_t dom;
+  uint8_t mon;
+  uint8_t dow;
+};
+
+struct forecast_event {
+  uint32_t t;
+  uint32_t window;
+};
+
+struct forecast {
+  const struct forecast_minute *week;
+  int64_t lifetime;
+  uint32_t jitter;
+  int verbose;
+  struct forecast_event *events;
+  size_t nevents;
+  size_t size;
+  /* demand landing on one second, and spread demand as a difference array */
+  double *direct;
+  double *spread;
+  size_t users;
+  size_t scheduled_users;
+  size_t cron_entries;
+  size_t timer_entries;
+  size_t skipped;
+};
+
+static const char *const forecast_months[] = {"jan", "feb", "mar", "apr", "may", "jun", "jul", "aug", "sep", "oct", "nov", "dec"};
+static const char *const forecast_days[] = {"sun", "mon", "tue", "wed", "thu", "fri", "sat"};
+/* the simulated week starts on a Monday */
+static const char *const forecast_labels[] = {"Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"};
+
+static int forecast_event_cmp(const void *a, const void *b) __attribute__((nonnull(1, 2)));
+static int forecast_event_cmp(const void *a, const void *b) {
+  const uint32_t x = ((const struct forecast_event *)a)->t;
+  const uint32_t y = ((const struct forecast_event *)b)->t;
+  return (x > y) - (x < y);
+}
+
+static int forecast_value(const char *s, size_t len, int lo, const char *const *names, size_t nnames, int *value) __attribute__((nonnull(1, 6)))
+__attribute__((warn_unused_result));
+static int forecast_value(const char *s, size_t len, int lo, const char *const *names, size_t nnames, int *value) {
+  char *end = NULL;
+  long v = 0;
+
+  if (len == 0) {
+    return 1;
+  }
+  /* cron takes three letter names, systemd full ones as well */
+  if ((names != NULL) && (len >= 3) && isalpha((unsigned char)s[0])) {
+    for (size_t i = 0; i < nnames; i++) {
+      if (strncasecmp(s, names[i], 3) == 0) {
+        *value = lo + (int)i;
+        return 0;
+      }
+    }
+    return 1;
+  }
+  if (!isdigit((unsigned char)s[0])) {
+    return 1;
+  }
+  errno = 0;
+  v = strtol(s, &end, 10);
+  if ((errno != 0) || (end != s + len) || (v > 1000)) {
+    return 1;
+  }
+  *value = (int)v;
+  return 0;
+}
+
+/*
+ * A comma separated list of '*', single values and ranges, each with an
+ * optional /step.  Cron writes ranges as a-b, systemd as a..b.
+ */
+static int forecast_field(const char *spec, int lo, int hi, const char *range_sep, const char *const *names, size_t nnames, uint64_t *mask) __attribute__((nonnull(1, 4, 7)))
+__attribute__((warn_unused_result));
+static int forecast_field(const char *spec, int lo, int hi, const char *range_sep, const char *const *names, size_t nnames, uint64_t *mask) {
+  char buf[256] = {0};
+  char *save = NULL;
+  char *item = NULL;
+
+  if (strlen(spec) >= sizeof(buf)) {
+    return 1;
+  }
+  (void)memcpy(buf, spec, strlen(spec));
+
+  *mask = 0;
+  for (item = strtok_r(buf, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+    char *slash = strchr(item, '/');
+    const char *sep = NULL;
+    long step = 1;
+    int a = lo;
+    int b = hi;
+
+    if (slash != NULL) {
+      char *end = NULL;
+      *slash = '\0';
+      step = strtol(slash + 1, &end, 10);
+      if ((*end != '\0') || (step <= 0) || (step > hi)) {
+        return 1;
+      }
+    }
+
+    if (strcmp(item, "*") != 0) {
+      sep = strstr(item, range_sep);
+      if (sep != NULL) {
+        if ((forecast_value(item, (size_t)(sep - item), lo, names, nnames, &a) != 0) ||
+            (forecast_value(sep + strlen(range_sep), strlen(sep + strlen(range_sep)), lo, names, nnames, &b) != 0)) {
+          return 1;
+        }
+      } else {
+        if (forecast_value(item, strlen(item), lo, names, nnames, &a) != 0) {
+          return 1;
+        }
+        b = (slash != NULL) ? hi : a;
+      }
+    }
+    if ((a < lo) || (b > hi) || (a > b)) {
+      return 1;
+    }
+
+    for (long v = a; v <= b; v += step) {
+      *mask |= (uint64_t)1 << v;
+    }
+  }
+  return (*mask == 0) ? 1 : 0;
+}
+
+/* Cron counts Sunday as both 0 and 7 */
+static uint64_t forecast_fold_sunday(uint64_t dow) { return (dow | ((dow >> 7) & 1U)) & 0x7fU; }
+
+static int forecast_parse_cron(const char *line, struct forecast_schedule *sched) __attribute__((nonnull(1, 2))) __attribute__((warn_unused_result));
+static int forecast_parse_cron(const char *line, struct forecast_schedule *sched) {
+  static const char *const macros[][2] = {
+      {"@yearly", "0 0 1 1 *"}, {"@annually", "0 0 1 1 *"}, {"@monthly", "0 0 1 * *"}, {"@weekly", "0 0 * * 0"}, {"@daily", "0 0 * * *"}, {"@midnight", "0 0 * * *"}, {"@hourly", "0 * * * *"},
+  };
+  char buf[1024] = {0};
+  char *save = NULL;
+  char *fields[5] = {NULL};
+
+  (void)memset(sched, 0, sizeof(*sched));
+  sched->cron = 1;
+  sched->sec = 1;
+
+  if (line[0] == '@') {
+    const size_t len = strcspn(line, " \t");
+    for (size_t i = 0; i < sizeof(macros) / sizeof(macros[0]); i++) {
+      if ((strlen(macros[i][0]) == len) && (strncmp(line, macros[i][0], len) == 0)) {
+        line = macros[i][1];
+        break;
+      }
+    }
+    /* @reboot and anything unknown */
+    if (line[0] == '@') {
+      return 1;
+    }
+  }
+
+  (void)snprintf(buf, sizeof(buf), "%s", line);
+  for (size_t i = 0; i < 5; i++) {
+    fields[i] = strtok_r((i == 0) ? buf : NULL, " \t", &save);
+    if (fields[i] == NULL) {
+      return 1;
+    }
+  }
+
+  sched->dom_star = (fields[2][0] == '*');
+  sched->dow_star = (fields[4][0] == '*');
+  if ((forecast_field(fields[0], 0, 59, "-", NULL, 0, &sched->min) != 0) || (forecast_field(fields[1], 0, 23, "-", NULL, 0, &sched->hour) != 0) ||
+      (forecast_field(fields[2], 1, 31, "-", NULL, 0, &sched->dom) != 0) || (forecast_field(fields[3], 1, 12, "-", forecast_months, 12, &sched->mon) != 0) ||
+      (forecast_field(fields[4], 0, 7, "-", forecast_days, 7, &sched->dow) != 0)) {
+    return 1;
+  }
+  sched->dow = forecast_fold_sunday(sched->dow);
+  return 0;
+}
+
+/*
+ * The part of systemd.time(7) calendar events that timers really use:
+ * [weekdays] [[year-]month-day] [hour:minute[:second]] and the
+ * shorthands.  Time zones and the ~ last-day syntax are not handled.
+ */
+static int forecast_parse_calendar(const char *value, struct forecast_schedule *sched) __attribute__((nonnull(1, 2))) __attribute__((warn_unused_result));
+static int forecast_parse_calendar(const char *value, struct forecast_schedule *sched) {
+  static const char *const shorthands[][2] = {
+      {"minutely", "*-*-* *:*:00"},       {"hourly", "*-*-* *:00:00"},        {"daily", "*-*-* 00:00:00"},          {"weekly", "Mon *-*-* 00:00:00"},
+      {"monthly", "*-*-01 00:00:00"},     {"yearly", "*-01-01 00:00:00"},     {"annually", "*-01-01 00:00:00"},     {"quarterly", "*-01,04,07,10-01 00:00:00"},
+      {"semiannually", "*-01,07-01 00:00:00"},
+  };
+  const char *date = "*-*-*";
+  const char *clock = "00:00:00";
+  const char *days = "*";
+  char buf[512] = {0};
+  char *save = NULL;
+  char *token = NULL;
+  char *part[3] = {NULL};
+  size_t nparts = 0;
+  size_t ntokens = 0;
+
+  (void)memset(sched, 0, sizeof(*sched));
+
+  for (size_t i = 0; i < sizeof(shorthands) / sizeof(shorthands[0]); i++) {
+    if (strcasecmp(value, shorthands[i][0]) == 0) {
+      value = shorthands[i][1];
+      break;
+    }
+  }
+  if ((strlen(value) >= sizeof(buf)) || (strchr(value, '~') != NULL)) {
+    return 1;
+  }
+  (void)memcpy(buf, value, strlen(value));
+
+  for (token = strtok_r(buf, " \t", &save); token != NULL; token = strtok_r(NULL, " \t", &save), ntokens++) {
+    if (strchr(token, ':') != NULL) {
+      clock = token;
+    } else if (isalpha((unsigned char)token[0]) && (ntokens == 0)) {
+      days = token;
+    } else if (strchr(token, '-') != NULL) {
+      date = token;
+    } else {
+      return 1;
+    }
+  }
+
+  /* weekdays may be written Mon-Fri as well as Mon..Fri */
+  if (forecast_field(days, 0, 6, (strstr(days, "..") != NULL) ? ".." : "-", forecast_days, 7, &sched->dow) != 0) {
+    return 1;
+  }
+
+  char datebuf[128] = {0};
+  (void)snprintf(datebuf, sizeof(datebuf), "%s", date);
+  for (token = strtok_r(datebuf, "-", &save); (token != NULL) && (nparts < 3); token = strtok_r(NULL, "-", &save)) {
+    part[nparts++] = token;
+  }
+  if ((token != NULL) || (nparts < 2)) {
+    return 1;
+  }
+  /* the year does not matter for a week */
+  if ((forecast_field(part[nparts - 2], 1, 12, "..", NULL, 0, &sched->mon) != 0) || (forecast_field(part[nparts - 1], 1, 31, "..", NULL, 0, &sched->dom) != 0)) {
+    return 1;
+  }
+
+  char clockbuf[128] = {0};
+  (void)snprintf(clockbuf, sizeof(clockbuf), "%s", clock);
+  nparts = 0;
+  for (token = strtok_r(clockbuf, ":", &save); (token != NULL) && (nparts < 3); token = strtok_r(NULL, ":", &save)) {
+    part[nparts++] = token;
+  }
+  if ((token != NULL) || (nparts < 2)) {
+    return 1;
+  }
+  if (nparts == 3) {
+    /* fractions of a second are below our resolution */
+    part[2][strcspn(part[2], ".")] = '\0';
+  }
+  if ((forecast_field(part[0], 0, 23, "..", NULL, 0, &sched->hour) != 0) || (forecast_field(part[1], 0, 59, "..", NULL, 0, &sched->min) != 0) ||
+      (forecast_field((nparts == 3) ? part[2] : "0", 0, 59, "..", NULL, 0, &sched->sec) != 0)) {
+    return 1;
+  }
+  return 0;
+}
+
+/* systemd.time(7) time spans, a bare number is seconds */
+static int forecast_parse_timespan(const char *value, uint32_t *seconds) __attribute__((nonnull(1, 2))) __attribute__((warn_unused_result));
+static int forecast_parse_timespan(const char *value, uint32_t *seconds) {
+  static const struct {
+    const char *unit;
+    double scale;
+  } units[] = {
+      {"usec", 1e-6}, {"us", 1e-6},    {"msec", 1e-3},   {"ms", 1e-3}, {"seconds", 1},   {"second", 1}, {"sec", 1}, {"s", 1},         {"minutes", 60},     {"minute", 60},
+      {"min", 60},    {"m", 60},       {"hours", 3600},  {"hour", 3600}, {"hr", 3600},   {"h", 3600},   {"days", 86400}, {"day", 86400}, {"d", 86400}, {"weeks", 604800},
+      {"week", 604800}, {"w", 604800},
+  };
+  const char *p = value;
+  double total = 0;
+
+  while (*p != '\0') {
+    char *end = NULL;
+    double scale = 1;
+
+    while (isspace((unsigned char)*p)) {
+      p++;
+    }
+    if (*p == '\0') {
+      break;
+    }
+    if ((!isdigit((unsigned char)*p)) && (*p != '.')) {
+      return 1;
+    }
+    const double n = strtod(p, &end);
+    if (end == p) {
+      return 1;
+    }
+    p = end;
+    while (isspace((unsigned char)*p)) {
+      p++;
+    }
+    const size_t len = strspn(p, "abcdefghijklmnopqrstuvwxyz");
+    if (len > 0) {
+      size_t i = 0;
+      for (i = 0; i < sizeof(units) / sizeof(units[0]); i++) {
+        if ((strlen(units[i].unit) == len) && (strncmp(p, units[i].unit, len) == 0)) {
+          scale = units[i].scale;
+          break;
+        }
+      }
+      if (i == sizeof(units) / sizeof(units[0])) {
+        return 1;
+      }
+      p += len;
+    }
+    total += n * scale;
+  }
+
+  if (total > FORECAST_WEEK_SECONDS) {
+    total = FORECAST_WEEK_SECONDS;
+  }
+  *seconds = (uint32_t)total;
+  return 0;
+}
+
+/* Open something the user owns, never a link of theirs pointing elsewhere */
+static FILE *forecast_open(int dir_fd, const char *name, uid_t uid, int follow) __attribute__((nonnull(2))) __attribute__((warn_unused_result));
+static FILE *forecast_open(int dir_fd, const char *name, uid_t uid, int follow) {
+  struct stat st = {0};
+  FILE *f = NULL;
+  const int fd = openat(dir_fd, name, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC | (follow ? 0 : O_NOFOLLOW));
+
+  if (fd < 0) {
+    return NULL;
+  }
+  if ((fstat(fd, &st) != 0) || (!S_ISREG(st.st_mode)) || (st.st_uid != uid) || (st.st_size > FORECAST_MAX_FILE_BYTES) || ((f = fdopen(fd, "r")) == NULL)) {
+    (void)close(fd);
+    return NULL;
+  }
+  return f;
+}
+
+/* Drop the rest of a line too long for the buffer, so it is not read as a line of its own */
+static void forecast_skip_rest(FILE *f, const char *line) __attribute__((nonnull(1, 2)));
+static void forecast_skip_rest(FILE *f, const char *line) {
+  int c = 0;
+
+  if (strchr(line, '\n') != NULL) {
+    return;
+  }
+  do {
+    c = getc(f);
+  } while ((c != '\n') && (c != EOF));
+}
+
+static size_t forecast_read_crontab(struct forecast *fc, int crontab_fd, const struct passwd *pw, struct forecast_schedule *scheds, size_t nscheds)
+    __attribute__((nonnull(1, 3, 4))) __attribute__((warn_unused_result));
+static size_t forecast_read_crontab(struct forecast *fc, int crontab_fd, const struct passwd *pw, struct forecast_schedule *scheds, size_t nscheds) {
+  char line[1024] = {0};
+  size_t count = 0;
+  FILE *f = forecast_open(crontab_fd, pw->pw_name, pw->pw_uid, 0);
+
+  if (f == NULL) {
+    return 0;
+  }
+  while ((fgets(line, sizeof(line), f) != NULL) && (nscheds + count < FORECAST_MAX_SCHEDULES)) {
+    const char *p = line + strspn(line, " \t");
+    const size_t name_len = strspn(p, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_");
+
+    /* the schedule is at the front, only the command can be cut short */
+    forecast_skip_rest(f, line);
+    if ((*p == '#') || (*p == '\n') || (*p == '\0')) {
+      continue;
+    }
+    /* environment settings */
+    if ((name_len > 0) && (p[name_len + strspn(p + name_len, " \t")] == '=')) {
+      continue;
+    }
+    if (forecast_parse_cron(p, &scheds[nscheds + count]) != 0) {
+      fc->skipped++;
+      if (fc->verbose) {
+        (void)fprintf(stderr, "%s: %s: skipping a crontab entry that is not understood\n", __PROGRAM_NAME, pw->pw_name);
+      }
+      continue;
+    }
+    count++;
+  }
+  (void)fclose(f);
+  return count;
+}
+
+/* Only enabled timers count, those linked from timers.target.wants */
+static size_t forecast_read_timers(struct forecast *fc, const struct passwd *pw, struct forecast_schedule *scheds, size_t nscheds) __attribute__((nonnull(1, 2, 3)))
+__attribute__((warn_unused_result));
+static size_t forecast_read_timers(struct forecast *fc, const struct passwd *pw, struct forecast_schedule *scheds, size_t nscheds) {
+  char path[FILE_PATH_MAX_LENGTH + 1] = {0};
+  const struct dirent *de = NULL;
+  DIR *d = NULL;
+  size_t count = 0;
+
+  if (snprintf(path, sizeof(path), "%s/%s", pw->pw_dir, FORECAST_TIMER_DIR) >= (int)sizeof(path)) {
+    return 0;
+  }
+  d = opendir(path);
+  if (d == NULL) {
+    return 0;
+  }
+
+  while ((de = readdir(d)) != NULL) {
+    const size_t len = strlen(de->d_name);
+    char line[1024] = {0};
+    uint32_t window = 0;
+    size_t first = nscheds + count;
+    int in_timer = 0;
+
+    if ((len < 7) || (strcmp(de->d_name + len - 6, ".timer") != 0)) {
+      continue;
+    }
+    FILE *f = forecast_open(dirfd(d), de->d_name, pw->pw_uid, 1);
+    if (f == NULL) {
+      continue;
+    }
+
+    while ((fgets(line, sizeof(line), f) != NULL) && (nscheds + count < FORECAST_MAX_SCHEDULES)) {
+      char *p = line + strspn(line, " \t");
+      char *eq = NULL;
+      char *end = NULL;
+
+      forecast_skip_rest(f, line);
+      p[strcspn(p, "\r\n")] = '\0';
+      if (p[0] == '[') {
+        in_timer = (strcmp(p, "[Timer]") == 0);
+        continue;
+      }
+      eq = strchr(p, '=');
+      if ((!in_timer) || (eq == NULL)) {
+        continue;
+      }
+      for (end = eq; (end > p) && isspace((unsigned char)end[-1]); end--) {
+      }
+      *end = '\0';
+      eq++;
+      eq += strspn(eq, " \t");
+
+      if (strcmp(p, "OnCalendar") == 0) {
+        if (forecast_parse_calendar(eq, &scheds[nscheds + count]) == 0) {
+          count++;
+        } else {
+          fc->skipped++;
+          if (fc->verbose) {
+            (void)fprintf(stderr, "%s: %s: skipping an OnCalendar= in %s that is not understood\n", __PROGRAM_NAME, pw->pw_name, de->d_name);
+          }
+        }
+      } else if (strcmp(p, "RandomizedDelaySec") == 0) {
+        if (forecast_parse_timespan(eq, &window) != 0) {
+          window = 0;
+        }
+      }
+    }
+    (void)fclose(f);
+
+    for (size_t i = first; i < nscheds + count; i++) {
+      scheds[i].window = window;
+    }
+  }
+  (void)closedir(d);
+  return count;
+}
+
+static int forecast_match(const struct forecast_schedule *sched, const struct forecast_minute *m) __attribute__((nonnull(1, 2)));
+static int forecast_match(const struct forecast_schedule *sched, const struct forecast_minute *m) {
+  const int dom = (int)((sched->dom >> m->dom) & 1U);
+  const int dow = (int)((sched->dow >> m->dow) & 1U);
+
+  if ((((sched->min >> m->min) & 1U) == 0) || (((sched->hour >> m->hour) & 1U) == 0) || (((sched->mon >> m->mon) & 1U) == 0)) {
+    return 0;
+  }
+  /* with both day fields restricted cron runs on either */
+  if (sched->cron && (!sched->dom_star) && (!sched->dow_star)) {
+    return dom || dow;
+  }
+  return dom && dow;
+}
+
+static int forecast_push(struct forecast *fc, uint32_t t, uint32_t window) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+static int forecast_push(struct forecast *fc, uint32_t t, uint32_t window) {
+  if (fc->nevents == fc->size) {
+    const size_t bigger_size = (fc->size == 0) ? 4096 : fc->size * 2;
+    struct forecast_event *bigger = reallocarray(fc->events, bigger_size, sizeof(struct forecast_event));
+    if (bigger == NULL) {
+      return 1;
+    }
+    fc->events = bigger;
+    fc->size = bigger_size;
+  }
+  fc->events[fc->nevents].t = t;
+  fc->events[fc->nevents].window = window;
+  fc->nevents++;
+  return 0;
+}
+
+/* One AS-REQ, spread evenly over its start window and wrapped round the week */
+static void forecast_add(struct forecast *fc, uint32_t t, uint32_t window) __attribute__((nonnull(1)));
+static void forecast_add(struct forecast *fc, uint32_t t, uint32_t window) {
+  if (window < fc->jitter) {
+    window = fc->jitter;
+  }
+  if (window <= 1) {
+    fc->direct[t] += 1.0;
+    return;
+  }
+
+  const double rate = 1.0 / (double)window;
+  const uint32_t end = t + window;
+  fc->spread[t] += rate;
+  if (end <= FORECAST_WEEK_SECONDS) {
+    fc->spread[end] -= rate;
+  } else {
+    fc->spread[FORECAST_WEEK_SECONDS] -= rate;
+    fc->spread[0] += rate;
+    fc->spread[end - FORECAST_WEEK_SECONDS] -= rate;
+  }
+}
+
+/*
+ * Every run of the user's jobs shares their default ccache, and the
+ * client keytab code in libkrb5 only goes back to the KDC once the
+ * ticket there is half way through its life.  The week is walked twice
+ * so the first pass leaves the cache as the end of the previous week
+ * would have, and only the second is counted.
+ */
+static int forecast_user(struct forecast *fc, const struct forecast_schedule *scheds, size_t nscheds) __attribute__((nonnull(1, 2))) __attribute__((warn_unused_result));
+static int forecast_user(struct forecast *fc, const struct forecast_schedule *scheds, size_t nscheds) {
+  int64_t refresh = INT64_MIN;
+
+  fc->nevents = 0;
+  for (uint32_t m = 0; m < FORECAST_WEEK_MINUTES; m++) {
+    for (size_t i = 0; i < nscheds; i++) {
+      if (!forecast_match(&scheds[i], &fc->week[m])) {
+        continue;
+      }
+      for (uint32_t s = 0; s < 60; s++) {
+        if (((scheds[i].sec >> s) & 1U) && (forecast_push(fc, (m * 60) + s, scheds[i].window) != 0)) {
+          return 1;
+        }
+      }
+    }
+  }
+  qsort(fc->events, fc->nevents, sizeof(struct forecast_event), forecast_event_cmp);
+
+  for (int64_t pass = 0; pass < 2; pass++) {
+    for (size_t i = 0; i < fc->nevents; i++) {
+      const int64_t t = (pass * FORECAST_WEEK_SECONDS) + (int64_t)fc->events[i].t;
+      if ((fc->lifetime > 0) && (t < refresh)) {
+        continue;
+      }
+      refresh = t + (fc->lifetime / 2);
+      if (pass == 1) {
+        forecast_add(fc, fc->events[i].t, fc->events[i].window);
+      }
+    }
+  }
+  return 0;
+}
+
+/* Local clock fields for every minute of the week starting at start */
+static int forecast_week(time_t start, struct forecast_minute *week) __attribute__((nonnull(2))) __attribute__((warn_unused_result));
+static int forecast_week(time_t start, struct forecast_minute *week) {
+  for (uint32_t m = 0; m < FORECAST_WEEK_MINUTES; m++) {
+    const time_t t = start + ((time_t)m * 60);
+    struct tm tm = {0};
+
+    if (localtime_r(&t, &tm) == NULL) {
+      return 1;
+    }
+    week[m].min = (uint8_t)tm.tm_min;
+    week[m].hour = (uint8_t)tm.tm_hour;
+    week[m].dom = (uint8_t)tm.tm_mday;
+    week[m].mon = (uint8_t)(tm.tm_mon + 1);
+    week[m].dow = (uint8_t)tm.tm_wday;
+  }
+  return 0;
+}
+
+/* Midnight of the Monday given as YYYY-MM-DD, or of the next one */
+static int forecast_start(const char *date, time_t *start) __attribute__((nonnull(2))) __attribute__((warn_unused_result));
+static int forecast_start(const char *date, time_t *start) {
+  struct tm tm = {0};
+  const time_t now = time(NULL);
+  int year = 0;
+  int month = 0;
+  int day = 0;
+  char extra = '\0';
+
+  if (date != NULL) {
+    if (sscanf(date, "%d-%d-%d%c", &year, &month, &day, &extra) != 3) {
+      return 1;
+    }
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+  } else {
+    if (localtime_r(&now, &tm) == NULL) {
+      return 1;
+    }
+    tm.tm_mday += ((8 - tm.tm_wday) % 7 == 0) ? 7 : (8 - tm.tm_wday) % 7;
+    tm.tm_hour = 0;
+    tm.tm_min = 0;
+    tm.tm_sec = 0;
+  }
+  tm.tm_isdst = -1;
+
+  *start = mktime(&tm);
+  if ((*start == (time_t)-1) || (tm.tm_wday != 1)) {
+    return 1;
+  }
+  return 0;
+}
+
+static void usage(void) __attribute__((noreturn));
+static void usage(void) {
+  (void)fprintf(stderr, "Usage: %s [-a] [-v] [-l lifetime] [-j jitter] [-w YYYY-MM-DD] [-c crontabs] [-d directory]\n", __PROGRAM_NAME);
+  (void)fprintf(stderr, "  Forecast the AS requests this node makes over a week for the users with\n");
+  (void)fprintf(stderr, "  populated keytabs, from their crontabs and enabled systemd user timers:\n");
+  (void)fprintf(stderr, "    second,day,time,requests\n");
+  (void)fprintf(stderr, "  second counts from Monday 00:00 local time, requests may be fractional.\n");
+  (void)fprintf(stderr, "  -a  list every second, not only those with requests\n");
+  (void)fprintf(stderr, "  -v  report entries that are not understood\n");
+  (void)fprintf(stderr, "  -l  ticket lifetime in seconds, 0 for a ticket every run (default %d)\n", FORECAST_DEFAULT_LIFETIME);
+  (void)fprintf(stderr, "  -j  spread each start over at least this many seconds (default 0)\n");
+  (void)fprintf(stderr, "  -w  the Monday to simulate (default the next one)\n");
+  (void)fprintf(stderr, "  -c  crontab directory (default %s)\n", FORECAST_DEFAULT_CRONTABS);
+  (void)fprintf(stderr, "  -d  keytab directory (default %s)\n", __CLIENT_KEYTAB_DIR);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+
+  const char *top = __CLIENT_KEYTAB_DIR;
+  const char *crontabs = FORECAST_DEFAULT_CRONTABS;
+  const char *week_of = NULL;
+  const struct dirent *de = NULL;
+  struct forecast fc = {.week = NULL, .lifetime = FORECAST_DEFAULT_LIFETIME, .jitter = 0, .verbose = 0};
+  struct forecast_schedule scheds[FORECAST_MAX_SCHEDULES];
+  struct timespec started = {0};
+  struct timespec finished = {0};
+  struct stat st = {0};
+  char name[NAME_MAX + sizeof("/client.keytab")] = {0};
+  time_t start = 0;
+  DIR *d = NULL;
+  double total = 0;
+  double level = 0;
+  double peak = 0;
+  double minute = 0;
+  double busiest = 0;
+  uint32_t peak_at = 0;
+  uint32_t busiest_at = 0;
+  int all = 0;
+  int opt = 0;
+  int crontab_fd = -1;
+  uid_t uid = 0;
+
+  while ((opt = getopt(argc, argv, "avl:j:w:c:d:h")) != -1) {
+    switch (opt) {
+    case 'a':
+      all = 1;
+      break;
+    case 'v':
+      fc.verbose = 1;
+      break;
+    case 'l':
+      fc.lifetime = strtoll(optarg, NULL, 10);
+      if ((fc.lifetime < 0) || (fc.lifetime > FORECAST_WEEK_SECONDS)) {
+        usage();
+      }
+      break;
+    case 'j':
+      fc.jitter = (uint32_t)strtoul(optarg, NULL, 10);
+      if (fc.jitter > FORECAST_WEEK_SECONDS) {
+        usage();
+      }
+      break;
+    case 'w':
+      week_of = optarg;
+      break;
+    case 'c':
+      crontabs = optarg;
+      break;
+    case 'd':
+      top = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &started);
+
+  if (forecast_start(week_of, &start) != 0) {
+    (void)fprintf(stderr, "%s: %s is not a Monday.\n", __PROGRAM_NAME, (week_of != NULL) ? week_of : "the week");
+    exit(EXIT_FAILURE);
+  }
+
+  struct forecast_minute *week = calloc(FORECAST_WEEK_MINUTES, sizeof(struct forecast_minute));
+  fc.direct = calloc(FORECAST_WEEK_SECONDS + 1, sizeof(double));
+  fc.spread = calloc(FORECAST_WEEK_SECONDS + 1, sizeof(double));
+  if ((week == NULL) || (fc.direct == NULL) || (fc.spread == NULL)) {
+    (void)fprintf(stderr, "%s: unable to allocate memory.\n", __PROGRAM_NAME);
+    exit(EXIT_FAILURE);
+  }
+  if (forecast_week(start, week) != 0) {
+    (void)fprintf(stderr, "%s: unable to work out the local time.\n", __PROGRAM_NAME);
+    exit(EXIT_FAILURE);
+  }
+  fc.week = week;
+
+  /* a missing crontab directory just means no cron entries */
+  crontab_fd = open(crontabs, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  d = opendir(top);
+  if (d == NULL) {
+    (void)fprintf(stderr, "%s: unable to read %s: %s\n", __PROGRAM_NAME, top, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  while ((de = readdir(d)) != NULL) {
+    struct passwd pw;
+    struct passwd *result = NULL;
+    char buf[4096];
+    size_t nscheds = 0;
+    size_t ncron = 0;
+
+    if (kcron_parse_uid(de->d_name, &uid) != 0) {
+      continue;
+    }
+    (void)snprintf(name, sizeof(name), "%s/client.keytab", de->d_name);
+    if ((fstatat(dirfd(d), name, &st, AT_SYMLINK_NOFOLLOW) != 0) || (!S_ISREG(st.st_mode)) || (st.st_size <= FORECAST_EMPTY_KEYTAB_BYTES)) {
+      continue;
+    }
+    fc.users++;
+
+    if ((getpwuid_r(uid, &pw, buf, sizeof(buf), &result) != 0) || (result == NULL)) {
+      continue;
+    }
+
+    if (crontab_fd >= 0) {
+      ncron = forecast_read_crontab(&fc, crontab_fd, &pw, scheds, 0);
+    }
+    nscheds = ncron + forecast_read_timers(&fc, &pw, scheds, ncron);
+    if (nscheds == 0) {
+      continue;
+    }
+    fc.scheduled_users++;
+    fc.cron_entries += ncron;
+    fc.timer_entries += nscheds - ncron;
+
+    if (forecast_user(&fc, scheds, nscheds) != 0) {
+      (void)fprintf(stderr, "%s: unable to allocate memory.\n", __PROGRAM_NAME);
+      exit(EXIT_FAILURE);
+    }
+  }
+  (void)closedir(d);
+  if (crontab_fd >= 0) {
+    (void)close(crontab_fd);
+  }
+
+  (void)printf("second,day,time,requests\n");
+  for (uint32_t s = 0; s < FORECAST_WEEK_SECONDS; s++) {
+    level += fc.spread[s];
+    /* the running sum drifts a little below zero where windows close */
+    const double requests = (level > 1e-9) ? fc.direct[s] + level : fc.direct[s];
+
+    total += requests;
+    if (requests > peak) {
+      peak = requests;
+      peak_at = s;
+    }
+    minute = ((s % 60) == 0) ? requests : minute + requests;
+    if (((s % 60) == 59) && (minute > busiest)) {
+      busiest = minute;
+      busiest_at = s - 59;
+    }
+
+    if (all || (requests > 1e-9)) {
+      (void)printf("%u,%s,%02u:%02u:%02u,%.3f\n", s, forecast_labels[s / 86400], (s / 3600) % 24, (s / 60) % 60, s % 60, requests);
+    }
+  }
+  (void)fflush(stdout);
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &finished);
+  const double elapsed = (double)(finished.tv_sec - started.tv_sec) + (double)(finished.tv_nsec - started.tv_nsec) / 1e9;
+  (void)fprintf(stderr, "%s: %zu users with keys, %zu with schedules, %zu crontab entries, %zu timers, %zu skipped\n", __PROGRAM_NAME, fc.users, fc.scheduled_users, fc.cron_entries,
+                fc.timer_entries, fc.skipped);
+  (void)fprintf(stderr, "%s: %.0f requests a week, peak %.3f/s at %s %02u:%02u:%02u, busiest minute %.3f at %s %02u:%02u, in %.3f s\n", __PROGRAM_NAME, total, peak,
+                forecast_labels[peak_at / 86400], (peak_at / 3600) % 24, (peak_at / 60) % 60, peak_at % 60, busiest, forecast_labels[busiest_at / 86400],
+                (busiest_at / 3600) % 24, (busiest_at / 60) % 60, elapsed);
+
+  (void)free(week);
+  (void)free(fc.direct);
+  (void)free(fc.spread);
+  (void)free(fc.events);
+
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,306 @@
+/*
+ *
+ * List or rebuild the keytab index
+ * A single sequential scan instead of a walk of every keytab directory
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef __PROGRAM_NAME
+#define __PROGRAM_NAME "kcron-index"
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kcron_filename.h"
+#include "kcron_index.h"
+
+static void usage(void) __attribute__((noreturn));
+static void usage(void) {
+  (void)fprintf(stderr, "Usage: %s [-p] [-u uid] [-f index]\n", __PROGRAM_NAME);
+  (void)fprintf(stderr, "       %s -r [-d directory] [-f index]\n", __PROGRAM_NAME);
+  (void)fprintf(stderr, "  List the keytab index in slot order:\n");
+  (void)fprintf(stderr, "    uid state kvno mtime principal_hash entries\n");
+  (void)fprintf(stderr, "  -p  populated keytabs only\n");
+  (void)fprintf(stderr, "  -u  just this uid, exits 1 if it is not indexed\n");
+  (void)fprintf(stderr, "  -r  rebuild the index from the keytab directories (root)\n");
+  (void)fprintf(stderr, "  -d  keytab directory (default %s)\n", __CLIENT_KEYTAB_DIR);
+  (void)fprintf(stderr, "  -f  index file (default <directory>/%s)\n", KCRON_INDEX_FILENAME);
+  exit(EXIT_FAILURE);
+}
+
+static void print_record(const struct kcron_index_record *record) __attribute__((nonnull(1)));
+static void print_record(const struct kcron_index_record *record) {
+  (void)printf("%u %s %u %lld %08x %u\n", record->uid, kcron_index_state_name(record->state), record->kvno, (long long)record->mtime, record->principal_hash, record->entries);
+}
+
+static int list_index(const char *index, int populated_only, long only_uid) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+static int list_index(const char *index, int populated_only, long only_uid) {
+
+  struct kcron_index_map map = {0};
+  struct kcron_index_record record = {0};
+  unsigned long torn = 0;
+  uint32_t slot = 0;
+  int rc = 0;
+
+  if (kcron_index_map_open(index, &map) != 0) {
+    (void)fprintf(stderr, "%s: Unable to map %s: %s\n", __PROGRAM_NAME, index, strerror(errno));
+    return 2;
+  }
+
+  if (only_uid >= 0) {
+    rc = kcron_index_lookup(&map, (uint32_t)only_uid, &record);
+    if (rc == 0) {
+      print_record(&record);
+    }
+    kcron_index_map_close(&map);
+    return (rc == 0) ? 0 : 1;
+  }
+
+  /* one sequential pass over the table */
+  for (slot = 0; slot < map.slots; slot++) {
+    rc = kcron_index_map_record(&map, slot, &record);
+    if (rc < 0) {
+      torn++;
+      continue;
+    }
+    if ((rc == 1) || (populated_only && (record.state != KCRON_INDEX_POPULATED))) {
+      continue;
+    }
+    print_record(&record);
+  }
+
+  if (torn > 0) {
+    (void)fprintf(stderr, "%s: %lu records were being rewritten and were skipped\n", __PROGRAM_NAME, torn);
+  }
+  kcron_index_map_close(&map);
+  return 0;
+}
+
+/* Summarize <top>/<name>/<keytab_filename> into record */
+static int index_dir(int top_fd, const char *name, const char *keytab_filename, struct kcron_index_record *record) __attribute__((nonnull(2, 3, 4)));
+static int index_dir(int top_fd, const char *name, const char *keytab_filename, struct kcron_index_record *record) {
+
+  int dir_fd = -1;
+  int keytab_fd = -1;
+  int rc = 0;
+
+  record->state = KCRON_INDEX_MISSING;
+
+  dir_fd = openat(top_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (dir_fd < 0) {
+    return 1;
+  }
+  keytab_fd = openat(dir_fd, keytab_filename, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+  if (keytab_fd >= 0) {
+    rc = kcron_index_summarize(keytab_fd, record);
+    (void)close(keytab_fd);
+  }
+  (void)close(dir_fd);
+  return rc;
+}
+
+/*
+ * Build a complete new index beside the old one and rename it into place
+ * while holding the old one's lock.  init-kcron-keytab waiting on that lock
+ * notices the file changed under it and writes to the new one.
+ */
+static int rebuild_index(const char *directory, const char *index) __attribute__((nonnull(1, 2))) __attribute__((warn_unused_result));
+static int rebuild_index(const char *directory, const char *index) {
+
+  struct kcron_index_record record = {0};
+  struct timespec start = {0};
+  struct timespec end = {0};
+  const struct dirent *entry = NULL;
+  const char *nullstring = NULL;
+  unsigned long records = 0;
+  unsigned long populated = 0;
+  unsigned long skipped = 0;
+  int lock_fd = -1;
+  int new_fd = -1;
+  int rc = 0;
+  DIR *top = NULL;
+
+  char *tmpname = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+  if (tmpname == nullstring) {
+    (void)fprintf(stderr, "%s: Unable to allocate memory.\n", __PROGRAM_NAME);
+    return 2;
+  }
+  (void)snprintf(tmpname, FILE_PATH_MAX_LENGTH, "%s.XXXXXX", index);
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &start);
+
+  top = opendir(directory);
+  if (top == NULL) {
+    (void)fprintf(stderr, "%s: Unable to open %s: %s\n", __PROGRAM_NAME, directory, strerror(errno));
+    (void)free(tmpname);
+    return 2;
+  }
+
+  lock_fd = kcron_index_open(index, -1, 1);
+  if (lock_fd < 0) {
+    (void)fprintf(stderr, "%s: Unable to lock %s: %s\n", __PROGRAM_NAME, index, strerror(errno));
+    (void)closedir(top);
+    (void)free(tmpname);
+    return 2;
+  }
+
+  new_fd = mkstemp(tmpname);
+  if (new_fd < 0) {
+    (void)fprintf(stderr, "%s: Unable to create %s: %s\n", __PROGRAM_NAME, tmpname, strerror(errno));
+    (void)close(lock_fd);
+    (void)closedir(top);
+    (void)free(tmpname);
+    return 2;
+  }
+
+  while ((entry = readdir(top)) != NULL) {
+    uid_t uid = 0;
+
+    if (kcron_parse_uid(entry->d_name, &uid) != 0) {
+      continue;
+    }
+
+    (void)memset(&record, 0, sizeof(record));
+    record.uid = (uint32_t)uid;
+    if (index_dir(dirfd(top), entry->d_name, "client.keytab", &record) != 0) {
+      skipped++;
+      continue;
+    }
+    if (kcron_index_store(new_fd, &record) != 0) {
+      (void)fprintf(stderr, "%s: Unable to write %s: %s\n", __PROGRAM_NAME, tmpname, strerror(errno));
+      rc = 2;
+      break;
+    }
+    records++;
+    if (record.state == KCRON_INDEX_POPULATED) {
+      populated++;
+    }
+  }
+  (void)closedir(top);
+
+  /* an empty tree still gets a valid, empty index */
+  if ((rc == 0) && (records == 0) && (kcron_index_prepare(new_fd) != 0)) {
+    rc = 2;
+  }
+
+  if ((rc == 0) && ((fchmod(new_fd, _0644) != 0) || (fsync(new_fd) != 0) || (rename(tmpname, index) != 0))) {
+    (void)fprintf(stderr, "%s: Unable to replace %s: %s\n", __PROGRAM_NAME, index, strerror(errno));
+    rc = 2;
+  }
+  if (rc != 0) {
+    (void)unlink(tmpname);
+  }
+
+  (void)close(new_fd);
+  (void)close(lock_fd);
+  (void)free(tmpname);
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &end);
+  if (rc == 0) {
+    (void)fprintf(stderr, "%s: indexed %lu keytab directories (%lu populated, %lu unreadable) in %.3f s\n", __PROGRAM_NAME, records, populated, skipped,
+                  (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9);
+  }
+  return rc;
+}
+
+int main(int argc, char **argv) {
+
+  const char *nullstring = NULL;
+  const char *directory = __CLIENT_KEYTAB_DIR;
+  const char *index_arg = NULL;
+  int rebuild = 0;
+  int populated_only = 0;
+  long only_uid = -1;
+  int opt = 0;
+  int rc = 0;
+
+  char *index = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+  if (index == nullstring) {
+    (void)fprintf(stderr, "%s: Unable to allocate memory.\n", __PROGRAM_NAME);
+    exit(EXIT_FAILURE);
+  }
+
+  while ((opt = getopt(argc, argv, "pu:rd:f:h")) != -1) {
+    switch (opt) {
+    case 'p':
+      populated_only = 1;
+      break;
+    case 'u':
+      only_uid = strtol(optarg, NULL, 10);
+      if ((only_uid < 0) || (only_uid > (long)UINT32_MAX)) {
+        usage();
+      }
+      break;
+    case 'r':
+      rebuild = 1;
+      break;
+    case 'd':
+      directory = optarg;
+      break;
+    case 'f':
+      index_arg = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+
+  if (index_arg != nullstring) {
+    (void)snprintf(index, FILE_PATH_MAX_LENGTH, "%s", index_arg);
+  } else {
+    (void)snprintf(index, FILE_PATH_MAX_LENGTH, "%s/%s", directory, KCRON_INDEX_FILENAME);
+  }
+
+  if (rebuild) {
+    rc = rebuild_index(directory, index);
+  } else {
+    rc = list_index(index, populated_only, only_uid);
+  }
+
+  (void)fflush(stdout);
+  (void)free(index);
+  exit(rc);
+}
@@ -0,0 +1,1364 @@
+/*
+ *
+ * Pass Kerberos requests to the fastest answering KDC
+ * A localhost KDC entry for cron bursts
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef __PROGRAM_NAME
+#define __PROGRAM_NAME "kcron-kdc-proxy"
+#endif
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * A localhost KDC entry for cron bursts.
+ *
+ * Clients talk to us over UDP or TCP, we talk to the real KDCs over TCP
+ * only, on connections opened ahead of time.  Requests and replies are
+ * passed through byte for byte; nothing is cached or parsed beyond the
+ * RFC 4120 length prefix.
+ *
+ * Each KDC has a latency estimate (EWMA of reply times).  A request goes
+ * to the live KDC with the lowest score, where the score is the larger of
+ * the estimate and the age of the oldest request still waiting on that
+ * KDC, so one that stops answering loses traffic within a round trip
+ * rather than after a timeout.  If no reply has come after the hedge
+ * delay the request is also sent to the next best KDC, and the first
+ * reply wins.  A KDC that refuses, resets or times out is rested for a
+ * backoff that doubles up to PROXY_MAX_BACKOFF_US, then gets another go.
+ * An estimate that has gone PROXY_DECAY_US without a sample is halved, so
+ * a KDC that was slow for a while is tried again once it may have
+ * recovered.
+ *
+ * The framing has no request ids, so a connection carries one request at
+ * a time.  MIT and Heimdal KDCs usually close after the reply; one the
+ * KDC leaves open goes back to the pool.
+ */
+#define PROXY_DEFAULT_LISTEN "127.0.0.1:1088"
+#define PROXY_DEFAULT_POOL 4
+#define PROXY_DEFAULT_HEDGE_MS 100
+#define PROXY_DEFAULT_TIMEOUT_MS 3000
+
+#define PROXY_MAX_KDCS 16
+#define PROXY_MAX_POOL 32
+#define PROXY_MAX_ATTEMPTS 3
+#define PROXY_MAX_EXCHANGES 1024
+#define PROXY_MAX_FDS 4096
+#define PROXY_MAX_MESSAGE (1024 * 1024)
+#define PROXY_MAX_DATAGRAM 65507
+#define PROXY_POOL_MAX_AGE_US (30ULL * 1000000ULL)
+#define PROXY_CLIENT_IDLE_US (30ULL * 1000000ULL)
+#define PROXY_MAX_BACKOFF_US (32ULL * 1000000ULL)
+#define PROXY_DECAY_US (5ULL * 1000000ULL)
+#define PROXY_TICK_MS 1000
+
+enum proxy_fd_kind {
+  PROXY_FD_FREE = 0,
+  PROXY_FD_UDP = 1,
+  PROXY_FD_LISTEN = 2,
+  PROXY_FD_SIGNAL = 3,
+  PROXY_FD_CLIENT = 4,
+  PROXY_FD_CONNECTING = 5,
+  PROXY_FD_IDLE = 6,
+  PROXY_FD_UPSTREAM = 7,
+};
+
+struct proxy_fd {
+  enum proxy_fd_kind kind;
+  uint32_t generation; /* so events for a closed fd are not taken for its reuse */
+  int kdc;             /* CONNECTING, IDLE, UPSTREAM */
+  int exchange;        /* CLIENT, UPSTREAM */
+  uint64_t born_us;    /* CONNECTING, IDLE */
+};
+
+struct proxy_kdc {
+  char name[NI_MAXHOST + NI_MAXSERV + 4];
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+  uint64_t ewma_us;
+  uint64_t sampled_us;
+  uint64_t down_until_us;
+  unsigned int fails;
+  int pool[PROXY_MAX_POOL];
+  unsigned int npool;
+  unsigned int nconnecting;
+  uint64_t sent;
+  uint64_t hedges;
+  uint64_t wins;
+  uint64_t timeouts;
+  uint64_t errors;
+};
+
+struct proxy_attempt {
+  int fd; /* -1 once this attempt is over */
+  int kdc;
+  int reused;
+  int connected;
+  uint64_t sent_us;
+  size_t written;
+  unsigned char head[4];
+  unsigned char *reply; /* length prefix then message */
+  size_t reply_len;
+  size_t reply_want;
+};
+
+enum proxy_exchange_state {
+  PROXY_EX_FREE = 0,
+  PROXY_EX_READING = 1,
+  PROXY_EX_WAITING = 2,
+  PROXY_EX_WRITING = 3,
+};
+
+struct proxy_exchange {
+  enum proxy_exchange_state state;
+  int client_fd; /* -1 for a UDP client */
+  struct sockaddr_storage peer;
+  socklen_t peer_len;
+  unsigned char head[4];
+  unsigned char *request; /* length prefix then message, as sent upstream */
+  size_t request_len;
+  size_t request_got;
+  unsigned char *reply;
+  size_t reply_len;
+  size_t reply_written;
+  uint64_t started_us;
+  uint64_t hedge_at_us;
+  uint32_t tried;
+  unsigned int nattempts;
+  struct proxy_attempt attempts[PROXY_MAX_ATTEMPTS];
+};
+
+struct proxy_state {
+  struct proxy_kdc kdcs[PROXY_MAX_KDCS];
+  unsigned int nkdcs;
+  struct proxy_fd *fds;
+  int nfds;
+  struct proxy_exchange *exchanges;
+  int epoll_fd;
+  int udp_fd;
+  int listen_fd;
+  int signal_fd;
+  struct sockaddr_storage listen_addr;
+  socklen_t listen_len;
+  unsigned int pool_size;
+  uint64_t hedge_us;
+  uint64_t timeout_us;
+  uint64_t dropped;
+  int verbose;
+  int running;
+};
+
+static uint64_t proxy_now_us(void) {
+  struct timespec now = {0};
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000ULL + (uint64_t)now.tv_nsec / 1000ULL;
+}
+
+/* host:port, [v6]:port or a bare host */
+static int proxy_split_hostport(const char *spec, const char *default_port, char *host, char *port) __attribute__((nonnull(1, 2, 3, 4))) __attribute__((warn_unused_result));
+static int proxy_split_hostport(const char *spec, const char *default_port, char *host, char *port) {
+  const char *colon = NULL;
+  const char *start = spec;
+  size_t len = 0;
+
+  if (spec[0] == '[') {
+    const char *close_bracket = strchr(spec, ']');
+    if ((close_bracket == NULL) || ((close_bracket[1] != '\0') && (close_bracket[1] != ':'))) {
+      return 1;
+    }
+    start = spec + 1;
+    len = (size_t)(close_bracket - start);
+    colon = (close_bracket[1] == ':') ? close_bracket + 1 : NULL;
+  } else {
+    colon = strrchr(spec, ':');
+    if ((colon != NULL) && (strchr(spec, ':') != colon)) {
+      /* a bare IPv6 address */
+      colon = NULL;
+    }
+    len = (colon != NULL) ? (size_t)(colon - spec) : strlen(spec);
+  }
+
+  if ((len == 0) || (len >= NI_MAXHOST)) {
+    return 1;
+  }
+  (void)memcpy(host, start, len);
+  host[len] = '\0';
+
+  const char *service = (colon != NULL) ? colon + 1 : default_port;
+  const size_t service_len = strlen(service);
+  if ((service_len == 0) || (service_len >= NI_MAXSERV)) {
+    return 1;
+  }
+  (void)memcpy(port, service, service_len + 1);
+  return 0;
+}
+
+static int proxy_resolve(const char *spec, int passive, struct sockaddr_storage *addr, socklen_t *addr_len) __attribute__((nonnull(1, 3, 4))) __attribute__((warn_unused_result));
+static int proxy_resolve(const char *spec, int passive, struct sockaddr_storage *addr, socklen_t *addr_len) {
+  char host[NI_MAXHOST] = {0};
+  char port[NI_MAXSERV] = {0};
+  struct addrinfo hints = {0};
+  struct addrinfo *result = NULL;
+
+  if (proxy_split_hostport(spec, "88", host, port) != 0) {
+    (void)fprintf(stderr, "%s: cannot parse '%s'\n", __PROGRAM_NAME, spec);
+    return 1;
+  }
+
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = passive ? AI_PASSIVE : 0;
+  const int rc = getaddrinfo(host, port, &hints, &result);
+  if ((rc != 0) || (result == NULL)) {
+    (void)fprintf(stderr, "%s: cannot resolve '%s': %s\n", __PROGRAM_NAME, spec, gai_strerror(rc));
+    return 1;
+  }
+  (void)memcpy(addr, result->ai_addr, result->ai_addrlen);
+  *addr_len = result->ai_addrlen;
+  freeaddrinfo(result);
+  return 0;
+}
+
+static int proxy_same_address(const struct sockaddr_storage *a, const struct sockaddr_storage *b) __attribute__((nonnull(1, 2)));
+static int proxy_same_address(const struct sockaddr_storage *a, const struct sockaddr_storage *b) {
+  if (a->ss_family != b->ss_family) {
+    return 0;
+  }
+  if (a->ss_family == AF_INET) {
+    const struct sockaddr_in *a4 = (const struct sockaddr_in *)a;
+    const struct sockaddr_in *b4 = (const struct sockaddr_in *)b;
+    return (a4->sin_port == b4->sin_port) && (a4->sin_addr.s_addr == b4->sin_addr.s_addr);
+  }
+  if (a->ss_family == AF_INET6) {
+    const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)a;
+    const struct sockaddr_in6 *b6 = (const struct sockaddr_in6 *)b;
+    return (a6->sin6_port == b6->sin6_port) && (memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr)) == 0);
+  }
+  return 0;
+}
+
+static int proxy_add_kdc(struct proxy_state *state, const char *spec) __attribute__((nonnull(1, 2))) __attribute__((warn_unused_result));
+static int proxy_add_kdc(struct proxy_state *state, const char *spec) {
+  if (state->nkdcs >= PROXY_MAX_KDCS) {
+    (void)fprintf(stderr, "%s: at most %d KDCs.\n", __PROGRAM_NAME, PROXY_MAX_KDCS);
+    return 1;
+  }
+
+  struct proxy_kdc *kdc = &state->kdcs[state->nkdcs];
+  (void)memset(kdc, 0, sizeof(*kdc));
+  if (proxy_resolve(spec, 0, &kdc->addr, &kdc->addr_len) != 0) {
+    return 1;
+  }
+  (void)snprintf(kdc->name, sizeof(kdc->name), "%s", spec);
+  state->nkdcs++;
+  return 0;
+}
+
+static uint64_t proxy_event_key(const struct proxy_state *state, int fd) __attribute__((nonnull(1)));
+static uint64_t proxy_event_key(const struct proxy_state *state, int fd) {
+  return ((uint64_t)state->fds[fd].generation << 32) | (uint64_t)(uint32_t)fd;
+}
+
+static int proxy_watch(struct proxy_state *state, int fd, enum proxy_fd_kind kind, uint32_t events, int kdc, int exchange) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+static int proxy_watch(struct proxy_state *state, int fd, enum proxy_fd_kind kind, uint32_t events, int kdc, int exchange) {
+  if ((fd < 0) || (fd >= state->nfds)) {
+    return 1;
+  }
+
+  struct epoll_event ev = {.events = events, .data.u64 = proxy_event_key(state, fd)};
+  if (epoll_ctl(state->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    return 1;
+  }
+  state->fds[fd].kind = kind;
+  state->fds[fd].kdc = kdc;
+  state->fds[fd].exchange = exchange;
+  state->fds[fd].born_us = proxy_now_us();
+  return 0;
+}
+
+static void proxy_rewatch(const struct proxy_state *state, int fd, uint32_t events) __attribute__((nonnull(1)));
+static void proxy_rewatch(const struct proxy_state *state, int fd, uint32_t events) {
+  struct epoll_event ev = {.events = events, .data.u64 = proxy_event_key(state, fd)};
+  (void)epoll_ctl(state->epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+/* closing the fd takes it out of the epoll set as well */
+static void proxy_forget(struct proxy_state *state, int fd) __attribute__((nonnull(1)));
+static void proxy_forget(struct proxy_state *state, int fd) {
+  if ((fd < 0) || (fd >= state->nfds)) {
+    return;
+  }
+  (void)close(fd);
+  state->fds[fd].kind = PROXY_FD_FREE;
+  state->fds[fd].generation++;
+  state->fds[fd].kdc = -1;
+  state->fds[fd].exchange = -1;
+}
+
+static int proxy_connect(const struct proxy_state *state, int k) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+static int proxy_connect(const struct proxy_state *state, int k) {
+  const struct proxy_kdc *kdc = &state->kdcs[k];
+  const int one = 1;
+
+  const int fd = socket(kdc->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if ((connect(fd, (const struct sockaddr *)&kdc->addr, kdc->addr_len) != 0) && (errno != EINPROGRESS)) {
+    (void)close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void proxy_pool_drain(struct proxy_state *state, int k) __attribute__((nonnull(1)));
+static void proxy_pool_drain(struct proxy_state *state, int k) {
+  struct proxy_kdc *kdc = &state->kdcs[k];
+
+  for (unsigned int i = 0; i < kdc->npool; i++) {
+    proxy_forget(state, kdc->pool[i]);
+  }
+  kdc->npool = 0;
+}
+
+static void proxy_pool_remove(struct proxy_state *state, int k, int fd) __attribute__((nonnull(1)));
+static void proxy_pool_remove(struct proxy_state *state, int k, int fd) {
+  struct proxy_kdc *kdc = &state->kdcs[k];
+
+  for (unsigned int i = 0; i < kdc->npool; i++) {
+    if (kdc->pool[i] == fd) {
+      kdc->pool[i] = kdc->pool[kdc->npool - 1];
+      kdc->npool--;
+      break;
+    }
+  }
+}
+
+static int proxy_kdc_live(const struct proxy_kdc *kdc, uint64_t now) __attribute__((nonnull(1)));
+static int proxy_kdc_live(const struct proxy_kdc *kdc, uint64_t now) {
+  return (kdc->down_until_us == 0) || (now >= kdc->down_until_us);
+}
+
+static void proxy_kdc_failed(struct proxy_state *state, int k, const char *why) __attribute__((nonnull(1, 3)));
+static void proxy_kdc_failed(struct proxy_state *state, int k, const char *why) {
+  struct proxy_kdc *kdc = &state->kdcs[k];
+  const uint64_t now = proxy_now_us();
+
+  if (!proxy_kdc_live(kdc, now)) {
+    /* one stall fails every request in flight, that is still one failure */
+    return;
+  }
+
+  const unsigned int shift = (kdc->fails < 5) ? kdc->fails : 5;
+  uint64_t backoff = 1000000ULL << shift;
+  if (backoff > PROXY_MAX_BACKOFF_US) {
+    backoff = PROXY_MAX_BACKOFF_US;
+  }
+  kdc->fails++;
+  kdc->down_until_us = now + backoff;
+  if (kdc->ewma_us < state->timeout_us) {
+    kdc->ewma_us = state->timeout_us;
+  }
+  proxy_pool_drain(state, k);
+
+  if (state->verbose) {
+    (void)fprintf(stderr, "%s: kdc %s %s, resting %llu ms\n", __PROGRAM_NAME, kdc->name, why, (unsigned long long)(backoff / 1000));
+  }
+}
+
+static void proxy_kdc_sample(struct proxy_kdc *kdc, uint64_t usec, uint64_t now) __attribute__((nonnull(1)));
+static void proxy_kdc_sample(struct proxy_kdc *kdc, uint64_t usec, uint64_t now) {
+  kdc->sampled_us = now;
+  if (kdc->ewma_us == 0) {
+    kdc->ewma_us = usec;
+  } else {
+    kdc->ewma_us = kdc->ewma_us - kdc->ewma_us / 8 + usec / 8;
+  }
+}
+
+/* Keep pool_size connections open or opening to every KDC in rotation */
+static void proxy_pool_fill(struct proxy_state *state) __attribute__((nonnull(1)));
+static void proxy_pool_fill(struct proxy_state *state) {
+  const uint64_t now = proxy_now_us();
+
+  for (unsigned int k = 0; k < state->nkdcs; k++) {
+    struct proxy_kdc *kdc = &state->kdcs[k];
+
+    if (!proxy_kdc_live(kdc, now)) {
+      continue;
+    }
+    if (kdc->down_until_us != 0) {
+      /* back from a rest, forget what we measured before it */
+      kdc->down_until_us = 0;
+      kdc->ewma_us = 0;
+      if (state->verbose) {
+        (void)fprintf(stderr, "%s: kdc %s back in rotation\n", __PROGRAM_NAME, kdc->name);
+      }
+    }
+
+    if (now - kdc->sampled_us > PROXY_DECAY_US) {
+      kdc->ewma_us /= 2;
+      kdc->sampled_us = now;
+    }
+
+    /* recycle connections the KDC may be about to time out */
+    for (unsigned int i = 0; i < kdc->npool;) {
+      const int fd = kdc->pool[i];
+      if (now - state->fds[fd].born_us > PROXY_POOL_MAX_AGE_US) {
+        proxy_pool_remove(state, (int)k, fd);
+        proxy_forget(state, fd);
+        continue;
+      }
+      i++;
+    }
+
+    while (kdc->npool + kdc->nconnecting < state->pool_size) {
+      const int fd = proxy_connect(state, (int)k);
+      if (fd < 0) {
+        kdc->errors++;
+        proxy_kdc_failed(state, (int)k, "refused a connection");
+        break;
+      }
+      if (proxy_watch(state, fd, PROXY_FD_CONNECTING, EPOLLOUT, (int)k, -1) != 0) {
+        (void)close(fd);
+        break;
+      }
+      kdc->nconnecting++;
+    }
+  }
+}
+
+/* The age of the oldest unanswered request on each KDC */
+static void proxy_outstanding(const struct proxy_state *state, uint64_t now, uint64_t *oldest) __attribute__((nonnull(1, 3)));
+static void proxy_outstanding(const struct proxy_state *state, uint64_t now, uint64_t *oldest) {
+  (void)memset(oldest, 0, sizeof(uint64_t) * PROXY_MAX_KDCS);
+
+  for (int e = 0; e < PROXY_MAX_EXCHANGES; e++) {
+    const struct proxy_exchange *ex = &state->exchanges[e];
+    if (ex->state != PROXY_EX_WAITING) {
+      continue;
+    }
+    for (unsigned int a = 0; a < ex->nattempts; a++) {
+      const struct proxy_attempt *attempt = &ex->attempts[a];
+      if ((attempt->fd >= 0) && (now - attempt->sent_us > oldest[attempt->kdc])) {
+        oldest[attempt->kdc] = now - attempt->sent_us;
+      }
+    }
+  }
+}
+
+static int proxy_pick(const struct proxy_state *state, const struct proxy_exchange *ex) __attribute__((nonnull(1, 2)));
+static int proxy_pick(const struct proxy_state *state, const struct proxy_exchange *ex) {
+  uint64_t oldest[PROXY_MAX_KDCS];
+  const uint64_t now = proxy_now_us();
+  uint64_t best_score = UINT64_MAX;
+  int best = -1;
+
+  proxy_outstanding(state, now, oldest);
+  for (unsigned int k = 0; k < state->nkdcs; k++) {
+    if (((ex->tried & (1U << k)) != 0) || !proxy_kdc_live(&state->kdcs[k], now)) {
+      continue;
+    }
+    const uint64_t score = (oldest[k] > state->kdcs[k].ewma_us) ? oldest[k] : state->kdcs[k].ewma_us;
+    if (score < best_score) {
+      best_score = score;
+      best = (int)k;
+    }
+  }
+  if ((best >= 0) || (ex->nattempts > 0)) {
+    return best;
+  }
+
+  /* everything is resting, the one due back first is our best hope */
+  for (unsigned int k = 0; k < state->nkdcs; k++) {
+    if (((ex->tried & (1U << k)) == 0) && (state->kdcs[k].down_until_us < best_score)) {
+      best_score = state->kdcs[k].down_until_us;
+      best = (int)k;
+    }
+  }
+  return best;
+}
+
+static void proxy_attempt_close(struct proxy_state *state, struct proxy_attempt *attempt) __attribute__((nonnull(1, 2)));
+static void proxy_attempt_close(struct proxy_state *state, struct proxy_attempt *attempt) {
+  if (attempt->fd >= 0) {
+    proxy_forget(state, attempt->fd);
+    attempt->fd = -1;
+  }
+  (void)free(attempt->reply);
+  attempt->reply = NULL;
+}
+
+static int proxy_live_attempts(const struct proxy_exchange *ex) __attribute__((nonnull(1)));
+static int proxy_live_attempts(const struct proxy_exchange *ex) {
+  int live = 0;
+  for (unsigned int a = 0; a < ex->nattempts; a++) {
+    if (ex->attempts[a].fd >= 0) {
+      live++;
+    }
+  }
+  return live;
+}
+
+static void proxy_exchange_reset(struct proxy_state *state, struct proxy_exchange *ex) __attribute__((nonnull(1, 2)));
+static void proxy_exchange_reset(struct proxy_state *state, struct proxy_exchange *ex) {
+  for (unsigned int a = 0; a < ex->nattempts; a++) {
+    proxy_attempt_close(state, &ex->attempts[a]);
+  }
+  (void)free(ex->request);
+  (void)free(ex->reply);
+  ex->request = NULL;
+  ex->reply = NULL;
+  ex->request_len = 0;
+  ex->request_got = 0;
+  ex->reply_len = 0;
+  ex->reply_written = 0;
+  ex->tried = 0;
+  ex->nattempts = 0;
+}
+
+static void proxy_exchange_free(struct proxy_state *state, struct proxy_exchange *ex) __attribute__((nonnull(1, 2)));
+static void proxy_exchange_free(struct proxy_state *state, struct proxy_exchange *ex) {
+  proxy_exchange_reset(state, ex);
+  if (ex->client_fd >= 0) {
+    proxy_forget(state, ex->client_fd);
+  }
+  (void)memset(ex, 0, sizeof(*ex));
+  ex->client_fd = -1;
+  ex->state = PROXY_EX_FREE;
+}
+
+static int proxy_exchange_new(struct proxy_state *state) __attribute__((nonnull(1)));
+static int proxy_exchange_new(struct proxy_state *state) {
+  for (int e = 0; e < PROXY_MAX_EXCHANGES; e++) {
+    if (state->exchanges[e].state == PROXY_EX_FREE) {
+      (void)memset(&state->exchanges[e], 0, sizeof(state->exchanges[e]));
+      state->exchanges[e].client_fd = -1;
+      state->exchanges[e].started_us = proxy_now_us();
+      return e;
+    }
+  }
+  state->dropped++;
+  return -1;
+}
+
+/* Nobody could answer: UDP clients retry on their own, TCP clients see a close */
+static void proxy_exchange_fail(struct proxy_state *state, struct proxy_exchange *ex) __attribute__((nonnull(1, 2)));
+static void proxy_exchange_fail(struct proxy_state *state, struct proxy_exchange *ex) {
+  state->dropped++;
+  if (state->verbose) {
+    (void)fprintf(stderr, "%s: no KDC answered after %llu ms\n", __PROGRAM_NAME, (unsigned long long)((proxy_now_us() - ex->started_us) / 1000));
+  }
+  proxy_exchange_free(state, ex);
+}
+
+static void proxy_upstream_write(struct proxy_state *state, int e, struct proxy_attempt *attempt) __attribute__((nonnull(1, 3)));
+
+static int proxy_attempt_start(struct proxy_state *state, int e, struct proxy_attempt *attempt, int k, int from_pool) __attribute__((nonnull(1, 3)))
+__attribute__((warn_unused_result));
+static int proxy_attempt_start(struct proxy_state *state, int e, struct proxy_attempt *attempt, int k, int from_pool) {
+  struct proxy_kdc *kdc = &state->kdcs[k];
+
+  (void)memset(attempt, 0, sizeof(*attempt));
+  attempt->kdc = k;
+  attempt->fd = -1;
+
+  if (from_pool && (kdc->npool > 0)) {
+    /* the newest is the least likely to have been closed under us */
+    kdc->npool--;
+    attempt->fd = kdc->pool[kdc->npool];
+    attempt->reused = 1;
+    attempt->connected = 1;
+    state->fds[attempt->fd].kind = PROXY_FD_UPSTREAM;
+    state->fds[attempt->fd].exchange = e;
+    proxy_rewatch(state, attempt->fd, EPOLLIN | EPOLLRDHUP);
+  } else {
+    attempt->fd = proxy_connect(state, k);
+    if (attempt->fd < 0) {
+      return 1;
+    }
+    if (proxy_watch(state, attempt->fd, PROXY_FD_UPSTREAM, EPOLLOUT | EPOLLRDHUP, k, e) != 0) {
+      (void)close(attempt->fd);
+      attempt->fd = -1;
+      return 1;
+    }
+  }
+
+  attempt->sent_us = proxy_now_us();
+  if (attempt->connected) {
+    proxy_upstream_write(state, e, attempt);
+  }
+  return 0;
+}
+
+/* Send the request to the best KDC it has not been to yet */
+static int proxy_send(struct proxy_state *state, int e, int hedge) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+static int proxy_send(struct proxy_state *state, int e, int hedge) {
+  struct proxy_exchange *ex = &state->exchanges[e];
+
+  while (ex->nattempts < PROXY_MAX_ATTEMPTS) {
+    const int k = proxy_pick(state, ex);
+    if (k < 0) {
+      return 1;
+    }
+    ex->tried |= 1U << k;
+
+    struct proxy_attempt *attempt = &ex->attempts[ex->nattempts++];
+    if (proxy_attempt_start(state, e, attempt, k, 1) != 0) {
+      state->kdcs[k].errors++;
+      proxy_kdc_failed(state, k, "refused a connection");
+      continue;
+    }
+    if (ex->state != PROXY_EX_WAITING) {
+      /* the write failed and took the exchange with it */
+      return 0;
+    }
+
+    uint64_t delay = state->kdcs[k].ewma_us * 3;
+    if (delay < state->hedge_us) {
+      delay = state->hedge_us;
+    }
+    if (delay > state->timeout_us) {
+      delay = state->timeout_us;
+    }
+    ex->hedge_at_us = attempt->sent_us + delay;
+    state->kdcs[k].sent++;
+    if (hedge) {
+      state->kdcs[k].hedges++;
+    }
+    return 0;
+  }
+  return 1;
+}
+
+/* This attempt is dead, fall over to another KDC if nothing else is in flight */
+static void proxy_attempt_error(struct proxy_state *state, int e, struct proxy_attempt *attempt, const char *why) __attribute__((nonnull(1, 3, 4)));
+static void proxy_attempt_error(struct proxy_state *state, int e, struct proxy_attempt *attempt, const char *why) {
+  struct proxy_exchange *ex = &state->exchanges[e];
+  const int k = attempt->kdc;
+
+  if (attempt->reused && (attempt->reply_len == 0)) {
+    /* a pooled connection the KDC had already closed, not the KDC's fault */
+    proxy_attempt_close(state, attempt);
+    if (proxy_attempt_start(state, e, attempt, k, 0) == 0) {
+      return;
+    }
+    state->kdcs[k].errors++;
+    proxy_kdc_failed(state, k, "refused a connection");
+  } else {
+    proxy_attempt_close(state, attempt);
+    state->kdcs[k].errors++;
+    proxy_kdc_failed(state, k, why);
+  }
+
+  if ((proxy_live_attempts(ex) == 0) && (proxy_send(state, e, 0) != 0)) {
+    proxy_exchange_fail(state, ex);
+  }
+}
+
+static void proxy_client_write(struct proxy_state *state, int e) __attribute__((nonnull(1)));
+static void proxy_client_write(struct proxy_state *state, int e) {
+  struct proxy_exchange *ex = &state->exchanges[e];
+
+  while (ex->reply_written < ex->reply_len) {
+    const ssize_t put = send(ex->client_fd, ex->reply + ex->reply_written, ex->reply_len - ex->reply_written, MSG_NOSIGNAL);
+    if (put < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        proxy_rewatch(state, ex->client_fd, EPOLLOUT | EPOLLRDHUP);
+        return;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      proxy_exchange_free(state, ex);
+      return;
+    }
+    ex->reply_written += (size_t)put;
+  }
+
+  /* ready for the next request on this connection */
+  proxy_exchange_reset(state, ex);
+  ex->state = PROXY_EX_READING;
+  ex->started_us = proxy_now_us();
+  proxy_rewatch(state, ex->client_fd, EPOLLIN | EPOLLRDHUP);
+}
+
+/* First reply wins: pass it on untouched and stop the others */
+static void proxy_deliver(struct proxy_state *state, int e, struct proxy_attempt *winner) __attribute__((nonnull(1, 3)));
+static void proxy_deliver(struct proxy_state *state, int e, struct proxy_attempt *winner) {
+  struct proxy_exchange *ex = &state->exchanges[e];
+  struct proxy_kdc *kdc = &state->kdcs[winner->kdc];
+  const uint64_t now = proxy_now_us();
+
+  proxy_kdc_sample(kdc, now - winner->sent_us, now);
+  kdc->fails = 0;
+  kdc->wins++;
+
+  ex->reply = winner->reply;
+  ex->reply_len = winner->reply_len;
+  ex->reply_written = 0;
+  winner->reply = NULL;
+
+  /* a KDC that leaves the connection open gets it back from the pool */
+  const int fd = winner->fd;
+  winner->fd = -1;
+  if ((kdc->npool < state->pool_size) && proxy_kdc_live(kdc, now)) {
+    kdc->pool[kdc->npool++] = fd;
+    state->fds[fd].kind = PROXY_FD_IDLE;
+    state->fds[fd].exchange = -1;
+    proxy_rewatch(state, fd, EPOLLIN | EPOLLRDHUP);
+  } else {
+    proxy_forget(state, fd);
+  }
+
+  for (unsigned int a = 0; a < ex->nattempts; a++) {
+    struct proxy_attempt *loser = &ex->attempts[a];
+    if (loser->fd < 0) {
+      continue;
+    }
+    /* it took at least this long, and maybe much longer */
+    const uint64_t waited = now - loser->sent_us;
+    if (waited > state->kdcs[loser->kdc].ewma_us) {
+      proxy_kdc_sample(&state->kdcs[loser->kdc], waited, now);
+    }
+    proxy_attempt_close(state, loser);
+  }
+
+  if (state->verbose) {
+    (void)fprintf(stderr, "%s: %s answered in %llu us after %u attempt(s)\n", __PROGRAM_NAME, kdc->name, (unsigned long long)(now - ex->started_us), ex->nattempts);
+  }
+
+  if (ex->client_fd < 0) {
+    if (ex->reply_len - 4 <= PROXY_MAX_DATAGRAM) {
+      (void)sendto(state->udp_fd, ex->reply + 4, ex->reply_len - 4, MSG_NOSIGNAL, (const struct sockaddr *)&ex->peer, ex->peer_len);
+    }
+    /*
+     * too big for a datagram, so it is dropped and the client waits out its
+     * UDP timeout, nothing tells it to use TCP; clients should list us as tcp/
+     */
+    proxy_exchange_free(state, ex);
+    return;
+  }
+
+  ex->state = PROXY_EX_WRITING;
+  proxy_client_write(state, e);
+}
+
+static void proxy_upstream_write(struct proxy_state *state, int e, struct proxy_attempt *attempt) {
+  const struct proxy_exchange *ex = &state->exchanges[e];
+
+  while (attempt->written < ex->request_len) {
+    const ssize_t put = send(attempt->fd, ex->request + attempt->written, ex->request_len - attempt->written, MSG_NOSIGNAL);
+    if (put < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        proxy_rewatch(state, attempt->fd, EPOLLOUT | EPOLLIN | EPOLLRDHUP);
+        return;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      proxy_attempt_error(state, e, attempt, "reset the connection");
+      return;
+    }
+    attempt->written += (size_t)put;
+  }
+  proxy_rewatch(state, attempt->fd, EPOLLIN | EPOLLRDHUP);
+}
+
+static void proxy_upstream_read(struct proxy_state *state, int e, struct proxy_attempt *attempt) __attribute__((nonnull(1, 3)));
+static void proxy_upstream_read(struct proxy_state *state, int e, struct proxy_attempt *attempt) {
+  for (;;) {
+    ssize_t got = 0;
+
+    if (attempt->reply_len < 4) {
+      got = recv(attempt->fd, attempt->head + attempt->reply_len, 4 - attempt->reply_len, 0);
+    } else {
+      got = recv(attempt->fd, attempt->reply + attempt->reply_len, attempt->reply_want - attempt->reply_len, 0);
+    }
+    if (got < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        return;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      proxy_attempt_error(state, e, attempt, "reset the connection");
+      return;
+    }
+    if (got == 0) {
+      proxy_attempt_error(state, e, attempt, "closed before replying");
+      return;
+    }
+
+    attempt->reply_len += (size_t)got;
+    if ((attempt->reply_len == 4) && (attempt->reply == NULL)) {
+      uint32_t length = 0;
+      (void)memcpy(&length, attempt->head, sizeof(length));
+      length = ntohl(length);
+      if ((length == 0) || (length > PROXY_MAX_MESSAGE)) {
+        proxy_attempt_error(state, e, attempt, "sent a bad length");
+        return;
+      }
+      attempt->reply_want = 4 + (size_t)length;
+      attempt->reply = malloc(attempt->reply_want);
+      if (attempt->reply == NULL) {
+        proxy_attempt_error(state, e, attempt, "could not be buffered");
+        return;
+      }
+      (void)memcpy(attempt->reply, attempt->head, 4);
+    }
+    if ((attempt->reply != NULL) && (attempt->reply_len == attempt->reply_want)) {
+      proxy_deliver(state, e, attempt);
+      return;
+    }
+  }
+}
+
+static void proxy_start(struct proxy_state *state, int e) __attribute__((nonnull(1)));
+static void proxy_start(struct proxy_state *state, int e) {
+  struct proxy_exchange *ex = &state->exchanges[e];
+
+  ex->state = PROXY_EX_WAITING;
+  ex->started_us = proxy_now_us();
+  if (ex->client_fd >= 0) {
+    /* only a hangup matters until the reply is ready */
+    proxy_rewatch(state, ex->client_fd, EPOLLRDHUP);
+  }
+  if (proxy_send(state, e, 0) != 0) {
+    proxy_exchange_fail(state, ex);
+  }
+}
+
+static void proxy_udp_read(struct proxy_state *state) __attribute__((nonnull(1)));
+static void proxy_udp_read(struct proxy_state *state) {
+  static unsigned char datagram[PROXY_MAX_DATAGRAM + 1];
+
+  for (;;) {
+    struct sockaddr_storage peer = {0};
+    socklen_t peer_len = sizeof(peer);
+
+    const ssize_t got = recvfrom(state->udp_fd, datagram, sizeof(datagram), 0, (struct sockaddr *)&peer, &peer_len);
+    if (got < 0) {
+      return;
+    }
+    if ((got == 0) || (got > PROXY_MAX_DATAGRAM)) {
+      continue;
+    }
+
+    const int e = proxy_exchange_new(state);
+    if (e < 0) {
+      continue;
+    }
+    struct proxy_exchange *ex = &state->exchanges[e];
+    ex->request_len = 4 + (size_t)got;
+    ex->request = malloc(ex->request_len);
+    if (ex->request == NULL) {
+      proxy_exchange_free(state, ex);
+      continue;
+    }
+    const uint32_t length = htonl((uint32_t)got);
+    (void)memcpy(ex->request, &length, 4);
+    (void)memcpy(ex->request + 4, datagram, (size_t)got);
+    (void)memcpy(&ex->peer, &peer, peer_len);
+    ex->peer_len = peer_len;
+    proxy_start(state, e);
+  }
+}
+
+static void proxy_accept(struct proxy_state *state) __attribute__((nonnull(1)));
+static void proxy_accept(struct proxy_state *state) {
+  for (;;) {
+    const int fd = accept(state->listen_fd, NULL, NULL);
+    if (fd < 0) {
+      return;
+    }
+    if ((fcntl(fd, F_SETFD, FD_CLOEXEC) != 0) || (fcntl(fd, F_SETFL, O_NONBLOCK) != 0)) {
+      (void)close(fd);
+      continue;
+    }
+    const int e = proxy_exchange_new(state);
+    if ((e < 0) || (proxy_watch(state, fd, PROXY_FD_CLIENT, EPOLLIN | EPOLLRDHUP, -1, e) != 0)) {
+      (void)close(fd);
+      continue;
+    }
+    state->exchanges[e].client_fd = fd;
+    state->exchanges[e].state = PROXY_EX_READING;
+  }
+}
+
+static void proxy_client_read(struct proxy_state *state, int e) __attribute__((nonnull(1)));
+static void proxy_client_read(struct proxy_state *state, int e) {
+  struct proxy_exchange *ex = &state->exchanges[e];
+
+  for (;;) {
+    ssize_t got = 0;
+
+    if (ex->request_got < 4) {
+      got = recv(ex->client_fd, ex->head + ex->request_got, 4 - ex->request_got, 0);
+    } else {
+      got = recv(ex->client_fd, ex->request + ex->request_got, ex->request_len - ex->request_got, 0);
+    }
+    if (got < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        return;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      proxy_exchange_free(state, ex);
+      return;
+    }
+    if (got == 0) {
+      proxy_exchange_free(state, ex);
+      return;
+    }
+
+    ex->request_got += (size_t)got;
+    if ((ex->request_got == 4) && (ex->request == NULL)) {
+      uint32_t length = 0;
+      (void)memcpy(&length, ex->head, sizeof(length));
+      length = ntohl(length);
+      if ((length == 0) || (length > PROXY_MAX_MESSAGE)) {
+        /* also turns away the reserved high bit */
+        proxy_exchange_free(state, ex);
+        return;
+      }
+      ex->request_len = 4 + (size_t)length;
+      ex->request = malloc(ex->request_len);
+      if (ex->request == NULL) {
+        proxy_exchange_free(state, ex);
+        return;
+      }
+      (void)memcpy(ex->request, ex->head, 4);
+    }
+    if ((ex->request != NULL) && (ex->request_got == ex->request_len)) {
+      proxy_start(state, e);
+      return;
+    }
+  }
+}
+
+static void proxy_connected(struct proxy_state *state, int fd, uint32_t events) __attribute__((nonnull(1)));
+static void proxy_connected(struct proxy_state *state, int fd, uint32_t events) {
+  const int k = state->fds[fd].kdc;
+  struct proxy_kdc *kdc = &state->kdcs[k];
+  int error = 0;
+  socklen_t len = sizeof(error);
+
+  kdc->nconnecting--;
+  if (((events & EPOLLERR) != 0) || (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0) || (error != 0)) {
+    proxy_forget(state, fd);
+    kdc->errors++;
+    proxy_kdc_failed(state, k, "refused a connection");
+    return;
+  }
+  if ((kdc->npool >= PROXY_MAX_POOL) || !proxy_kdc_live(kdc, proxy_now_us())) {
+    proxy_forget(state, fd);
+    return;
+  }
+  kdc->pool[kdc->npool++] = fd;
+  state->fds[fd].kind = PROXY_FD_IDLE;
+  proxy_rewatch(state, fd, EPOLLIN | EPOLLRDHUP);
+}
+
+static void proxy_upstream_event(struct proxy_state *state, int fd, uint32_t events) __attribute__((nonnull(1)));
+static void proxy_upstream_event(struct proxy_state *state, int fd, uint32_t events) {
+  const int e = state->fds[fd].exchange;
+  const struct proxy_exchange *ex = &state->exchanges[e];
+  struct proxy_attempt *attempt = NULL;
+
+  for (unsigned int a = 0; a < ex->nattempts; a++) {
+    if (ex->attempts[a].fd == fd) {
+      attempt = &state->exchanges[e].attempts[a];
+    }
+  }
+  if (attempt == NULL) {
+    proxy_forget(state, fd);
+    return;
+  }
+
+  if (!attempt->connected) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (((events & EPOLLERR) != 0) || (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0) || (error != 0)) {
+      proxy_attempt_error(state, e, attempt, "refused a connection");
+      return;
+    }
+    attempt->connected = 1;
+  }
+  if ((attempt->written < ex->request_len) && ((events & EPOLLOUT) != 0)) {
+    proxy_upstream_write(state, e, attempt);
+    return;
+  }
+  proxy_upstream_read(state, e, attempt);
+}
+
+/* Hedge slow requests, give up on silent KDCs and tidy idle clients */
+static void proxy_timers(struct proxy_state *state) __attribute__((nonnull(1)));
+static void proxy_timers(struct proxy_state *state) {
+  const uint64_t now = proxy_now_us();
+
+  for (int e = 0; e < PROXY_MAX_EXCHANGES; e++) {
+    struct proxy_exchange *ex = &state->exchanges[e];
+
+    if ((ex->state == PROXY_EX_READING) && (now - ex->started_us > PROXY_CLIENT_IDLE_US)) {
+      proxy_exchange_free(state, ex);
+      continue;
+    }
+    if (ex->state != PROXY_EX_WAITING) {
+      continue;
+    }
+
+    for (unsigned int a = 0; a < ex->nattempts; a++) {
+      struct proxy_attempt *attempt = &ex->attempts[a];
+      if ((attempt->fd >= 0) && (now - attempt->sent_us >= state->timeout_us)) {
+        state->kdcs[attempt->kdc].timeouts++;
+        proxy_attempt_close(state, attempt);
+        proxy_kdc_failed(state, attempt->kdc, "timed out");
+      }
+    }
+
+    if (proxy_live_attempts(ex) == 0) {
+      if (proxy_send(state, e, 0) != 0) {
+        proxy_exchange_fail(state, ex);
+      }
+      continue;
+    }
+    if ((now >= ex->hedge_at_us) && (proxy_send(state, e, 1) != 0)) {
+      /* nowhere left to hedge to, wait for what is in flight */
+      ex->hedge_at_us = UINT64_MAX;
+    }
+  }
+}
+
+static int proxy_next_wakeup(const struct proxy_state *state) __attribute__((nonnull(1)));
+static int proxy_next_wakeup(const struct proxy_state *state) {
+  const uint64_t now = proxy_now_us();
+  uint64_t next = now + (uint64_t)PROXY_TICK_MS * 1000ULL;
+
+  for (int e = 0; e < PROXY_MAX_EXCHANGES; e++) {
+    const struct proxy_exchange *ex = &state->exchanges[e];
+    if (ex->state != PROXY_EX_WAITING) {
+      continue;
+    }
+    if (ex->hedge_at_us < next) {
+      next = ex->hedge_at_us;
+    }
+    for (unsigned int a = 0; a < ex->nattempts; a++) {
+      if ((ex->attempts[a].fd >= 0) && (ex->attempts[a].sent_us + state->timeout_us < next)) {
+        next = ex->attempts[a].sent_us + state->timeout_us;
+      }
+    }
+  }
+  return (next <= now) ? 0 : (int)((next - now + 999) / 1000);
+}
+
+static void proxy_report(const struct proxy_state *state) __attribute__((nonnull(1)));
+static void proxy_report(const struct proxy_state *state) {
+  const uint64_t now = proxy_now_us();
+
+  (void)fprintf(stderr, "%-24s %5s %9s %8s %8s %8s %8s %8s %5s\n", "kdc", "state", "ewma_ms", "sent", "hedges", "wins", "timeouts", "errors", "pool");
+  for (unsigned int k = 0; k < state->nkdcs; k++) {
+    const struct proxy_kdc *kdc = &state->kdcs[k];
+    (void)fprintf(stderr, "%-24s %5s %9.1f %8llu %8llu %8llu %8llu %8llu %5u\n", kdc->name, proxy_kdc_live(kdc, now) ? "up" : "rest", (double)kdc->ewma_us / 1000.0,
+                  (unsigned long long)kdc->sent, (unsigned long long)kdc->hedges, (unsigned long long)kdc->wins, (unsigned long long)kdc->timeouts,
+                  (unsigned long long)kdc->errors, kdc->npool);
+  }
+  (void)fprintf(stderr, "%s: %llu request(s) dropped\n", __PROGRAM_NAME, (unsigned long long)state->dropped);
+}
+
+static void proxy_signal(struct proxy_state *state) __attribute__((nonnull(1)));
+static void proxy_signal(struct proxy_state *state) {
+  struct signalfd_siginfo info = {0};
+
+  while (read(state->signal_fd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+    if (info.ssi_signo == SIGUSR1) {
+      proxy_report(state);
+    } else {
+      state->running = 0;
+    }
+  }
+}
+
+static int proxy_listen(struct proxy_state *state, const char *spec) __attribute__((nonnull(1, 2))) __attribute__((warn_unused_result));
+static int proxy_listen(struct proxy_state *state, const char *spec) {
+  const int one = 1;
+
+  if (proxy_resolve(spec, 1, &state->listen_addr, &state->listen_len) != 0) {
+    return 1;
+  }
+
+  state->listen_fd = socket(state->listen_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  state->udp_fd = socket(state->listen_addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if ((state->listen_fd < 0) || (state->udp_fd < 0)) {
+    (void)fprintf(stderr, "%s: cannot create sockets: %s\n", __PROGRAM_NAME, strerror(errno));
+    return 1;
+  }
+  (void)setsockopt(state->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  if ((bind(state->listen_fd, (const struct sockaddr *)&state->listen_addr, state->listen_len) != 0) || (listen(state->listen_fd, SOMAXCONN) != 0) ||
+      (bind(state->udp_fd, (const struct sockaddr *)&state->listen_addr, state->listen_len) != 0)) {
+    (void)fprintf(stderr, "%s: cannot listen on %s: %s\n", __PROGRAM_NAME, spec, strerror(errno));
+    return 1;
+  }
+
+  if ((proxy_watch(state, state->listen_fd, PROXY_FD_LISTEN, EPOLLIN, -1, -1) != 0) || (proxy_watch(state, state->udp_fd, PROXY_FD_UDP, EPOLLIN, -1, -1) != 0)) {
+    (void)fprintf(stderr, "%s: cannot watch the listening sockets.\n", __PROGRAM_NAME);
+    return 1;
+  }
+  return 0;
+}
+
+static void proxy_dispatch(struct proxy_state *state, const struct epoll_event *event) __attribute__((nonnull(1, 2)));
+static void proxy_dispatch(struct proxy_state *state, const struct epoll_event *event) {
+  const int fd = (int)(uint32_t)(event->data.u64 & 0xffffffffU);
+  const uint32_t what = event->events;
+
+  if ((fd < 0) || (fd >= state->nfds) || (event->data.u64 != proxy_event_key(state, fd))) {
+    /* closed earlier in this batch, perhaps already reused */
+    return;
+  }
+
+  switch (state->fds[fd].kind) {
+  case PROXY_FD_UDP:
+    proxy_udp_read(state);
+    break;
+  case PROXY_FD_LISTEN:
+    proxy_accept(state);
+    break;
+  case PROXY_FD_SIGNAL:
+    proxy_signal(state);
+    break;
+  case PROXY_FD_CLIENT: {
+    const int e = state->fds[fd].exchange;
+    if ((what & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0) {
+      proxy_exchange_free(state, &state->exchanges[e]);
+    } else if (state->exchanges[e].state == PROXY_EX_READING) {
+      proxy_client_read(state, e);
+    } else if (state->exchanges[e].state == PROXY_EX_WRITING) {
+      proxy_client_write(state, e);
+    }
+    break;
+  }
+  case PROXY_FD_CONNECTING:
+    proxy_connected(state, fd, what);
+    break;
+  case PROXY_FD_IDLE:
+    /* closed by the KDC, or talking out of turn */
+    proxy_pool_remove(state, state->fds[fd].kdc, fd);
+    proxy_forget(state, fd);
+    break;
+  case PROXY_FD_UPSTREAM:
+    proxy_upstream_event(state, fd, what);
+    break;
+  case PROXY_FD_FREE:
+  default:
+    break;
+  }
+}
+
+static void usage(void) __attribute__((noreturn));
+static void usage(void) {
+  (void)fprintf(stderr, "Usage: %s [-v] [-l host:port] [-p pool] [-H ms] [-t ms] -k kdc[:port]...\n", __PROGRAM_NAME);
+  (void)fprintf(stderr, "  Answer Kerberos requests on UDP and TCP by passing each one, unchanged, to\n");
+  (void)fprintf(stderr, "  the fastest KDC that is answering, over TCP connections opened in advance.\n");
+  (void)fprintf(stderr, "  List it in krb5.conf as kdc = tcp/host:port, replies too big for UDP are dropped.\n");
+  (void)fprintf(stderr, "  SIGUSR1 prints per KDC statistics, SIGTERM prints them and exits.\n");
+  (void)fprintf(stderr, "  -v  log every reply and every KDC leaving or rejoining the rotation\n");
+  (void)fprintf(stderr, "  -l  address to listen on (default %s)\n", PROXY_DEFAULT_LISTEN);
+  (void)fprintf(stderr, "  -k  a KDC, port 88 unless given, may be repeated up to %d times\n", PROXY_MAX_KDCS);
+  (void)fprintf(stderr, "  -p  idle connections kept open to each KDC (default %d)\n", PROXY_DEFAULT_POOL);
+  (void)fprintf(stderr, "  -H  least ms before also asking the next KDC (default %d)\n", PROXY_DEFAULT_HEDGE_MS);
+  (void)fprintf(stderr, "  -t  ms before giving up on a KDC (default %d)\n", PROXY_DEFAULT_TIMEOUT_MS);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+
+  struct proxy_state state = {0};
+  struct epoll_event events[64];
+  const char *listen_spec = PROXY_DEFAULT_LISTEN;
+  long value = 0;
+  int opt = 0;
+  sigset_t signals;
+
+  state.pool_size = PROXY_DEFAULT_POOL;
+  state.hedge_us = (uint64_t)PROXY_DEFAULT_HEDGE_MS * 1000ULL;
+  state.timeout_us = (uint64_t)PROXY_DEFAULT_TIMEOUT_MS * 1000ULL;
+
+  while ((opt = getopt(argc, argv, "vl:k:p:H:t:h")) != -1) {
+    switch (opt) {
+    case 'v':
+      state.verbose = 1;
+      break;
+    case 'l':
+      listen_spec = optarg;
+      break;
+    case 'k':
+      if (proxy_add_kdc(&state, optarg) != 0) {
+        usage();
+      }
+      break;
+    case 'p':
+      value = strtol(optarg, NULL, 10);
+      if ((value < 0) || (value > PROXY_MAX_POOL)) {
+        usage();
+      }
+      state.pool_size = (unsigned int)value;
+      break;
+    case 'H':
+      value = strtol(optarg, NULL, 10);
+      if (value <= 0) {
+        usage();
+      }
+      state.hedge_us = (uint64_t)value * 1000ULL;
+      break;
+    case 't':
+      value = strtol(optarg, NULL, 10);
+      if (value <= 0) {
+        usage();
+      }
+      state.timeout_us = (uint64_t)value * 1000ULL;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (state.nkdcs == 0) {
+    usage();
+  }
+
+  /* one fd per client and per upstream connection */
+  struct rlimit files = {0};
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0) {
+    files.rlim_cur = (files.rlim_max < PROXY_MAX_FDS) ? files.rlim_max : PROXY_MAX_FDS;
+    (void)setrlimit(RLIMIT_NOFILE, &files);
+    state.nfds = (int)files.rlim_cur;
+  } else {
+    state.nfds = 1024;
+  }
+
+  state.fds = calloc((size_t)state.nfds, sizeof(struct proxy_fd));
+  state.exchanges = calloc(PROXY_MAX_EXCHANGES, sizeof(struct proxy_exchange));
+  if ((state.fds == NULL) || (state.exchanges == NULL)) {
+    (void)fprintf(stderr, "%s: unable to allocate memory.\n", __PROGRAM_NAME);
+    exit(EXIT_FAILURE);
+  }
+  for (int e = 0; e < PROXY_MAX_EXCHANGES; e++) {
+    state.exchanges[e].client_fd = -1;
+  }
+
+  state.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (state.epoll_fd < 0) {
+    (void)fprintf(stderr, "%s: cannot create epoll instance: %s\n", __PROGRAM_NAME, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  if (proxy_listen(&state, listen_spec) != 0) {
+    exit(EXIT_FAILURE);
+  }
+  for (unsigned int k = 0; k < state.nkdcs; k++) {
+    if (proxy_same_address(&state.kdcs[k].addr, &state.listen_addr)) {
+      (void)fprintf(stderr, "%s: kdc %s is this proxy.\n", __PROGRAM_NAME, state.kdcs[k].name);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  (void)sigemptyset(&signals);
+  (void)sigaddset(&signals, SIGINT);
+  (void)sigaddset(&signals, SIGTERM);
+  (void)sigaddset(&signals, SIGUSR1);
+  (void)sigprocmask(SIG_BLOCK, &signals, NULL);
+  state.signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  if ((state.signal_fd < 0) || (proxy_watch(&state, state.signal_fd, PROXY_FD_SIGNAL, EPOLLIN, -1, -1) != 0)) {
+    (void)fprintf(stderr, "%s: cannot watch for signals.\n", __PROGRAM_NAME);
+    exit(EXIT_FAILURE);
+  }
+
+  state.running = 1;
+  proxy_pool_fill(&state);
+
+  while (state.running) {
+    const int ready = epoll_wait(state.epoll_fd, events, (int)(sizeof(events) / sizeof(events[0])), proxy_next_wakeup(&state));
+    if ((ready < 0) && (errno != EINTR)) {
+      (void)fprintf(stderr, "%s: epoll_wait failed: %s\n", __PROGRAM_NAME, strerror(errno));
+      break;
+    }
+    for (int i = 0; i < ready; i++) {
+      proxy_dispatch(&state, &events[i]);
+    }
+    proxy_timers(&state);
+    proxy_pool_fill(&state);
+  }
+
+  proxy_report(&state);
+
+  for (int e = 0; e < PROXY_MAX_EXCHANGES; e++) {
+    if (state.exchanges[e].state != PROXY_EX_FREE) {
+      proxy_exchange_free(&state, &state.exchanges[e]);
+    }
+  }
+  for (unsigned int k = 0; k < state.nkdcs; k++) {
+    proxy_pool_drain(&state, (int)k);
+  }
+  (void)close(state.signal_fd);
+  (void)close(state.listen_fd);
+  (void)close(state.udp_fd);
+  (void)close(state.epoll_fd);
+  (void)free(state.fds);
+  (void)free(state.exchanges);
+
+  return EXIT_SUCCESS;
+}
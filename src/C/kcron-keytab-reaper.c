@@ -0,0 +1,572 @@
+/*
+ *
+ * Find and remove keytab directories left behind by deleted accounts
+ * Run by kcron-reaper, which deletes the matching principals
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef __PROGRAM_NAME
+#define __PROGRAM_NAME "kcron-keytab-reaper"
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kcron_filename.h"
+#include "kcron_keytab_parse.h"
+#include "kcron_ratelimit.h"
+
+#define REAPER_DEFAULT_THREADS 8
+#define REAPER_MAX_THREADS 256
+#define REAPER_MAX_PRINCIPALS 32
+
+struct reaper_principal {
+  char name[KCRON_PRINCIPAL_MAX_LENGTH];
+  uint32_t kvno;
+  int deletable;
+};
+
+struct reaper_dir {
+  uid_t uid;
+  char name[32];
+  const char *state;
+  const char *reason;
+  int error; /* errno instead of a reason, strerror() is not for the workers */
+  time_t mtime;
+  size_t nprincipals;
+  struct reaper_principal *principals;
+};
+
+struct reaper_job {
+  int top_fd;
+  int remove;
+  int all;
+  const char *keytab_filename;
+  struct reaper_dir *dirs;
+  size_t ndirs;
+  atomic_size_t next;
+};
+
+static int reaper_uid_cmp(const void *a, const void *b) __attribute__((nonnull(1, 2)));
+static int reaper_uid_cmp(const void *a, const void *b) {
+  const uid_t x = *(const uid_t *)a;
+  const uid_t y = *(const uid_t *)b;
+  return (x > y) - (x < y);
+}
+
+static int reaper_dir_cmp(const void *a, const void *b) __attribute__((nonnull(1, 2)));
+static int reaper_dir_cmp(const void *a, const void *b) { return reaper_uid_cmp(&((const struct reaper_dir *)a)->uid, &((const struct reaper_dir *)b)->uid); }
+
+/*
+ * One pass over the password database, so the common case of a uid that
+ * still exists never costs a lookup.  This is only a pre-filter: with sssd
+ * enumeration off getpwent() sees local users only, so every candidate is
+ * confirmed with getpwuid_r() before anything is reported.
+ */
+static uid_t *reaper_load_uids(size_t *count) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+static uid_t *reaper_load_uids(size_t *count) {
+  const uid_t *nullstring = NULL;
+  const struct passwd *pw = NULL;
+  size_t size = 1024;
+  uid_t *uids = calloc(size, sizeof(uid_t));
+
+  *count = 0;
+  if (uids == nullstring) {
+    return NULL;
+  }
+
+  setpwent();
+  while ((pw = getpwent()) != NULL) {
+    if (*count == size) {
+      uid_t *bigger = reallocarray(uids, size * 2, sizeof(uid_t));
+      if (bigger == nullstring) {
+        endpwent();
+        (void)free(uids);
+        return NULL;
+      }
+      uids = bigger;
+      size *= 2;
+    }
+    uids[(*count)++] = pw->pw_uid;
+  }
+  endpwent();
+
+  qsort(uids, *count, sizeof(uid_t), reaper_uid_cmp);
+  return uids;
+}
+
+static int reaper_uid_exists(uid_t uid) __attribute__((warn_unused_result));
+static int reaper_uid_exists(uid_t uid) {
+  struct passwd pw;
+  struct passwd *result = NULL;
+  char buf[4096];
+
+  /* an NSS error is not proof the user is gone */
+  if (getpwuid_r(uid, &pw, buf, sizeof(buf), &result) != 0) {
+    return 1;
+  }
+  return result != NULL;
+}
+
+static int reaper_name_exists(const char *name, size_t len) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+static int reaper_name_exists(const char *name, size_t len) {
+  struct passwd pw;
+  struct passwd *result = NULL;
+  char buf[4096];
+  char user[256];
+
+  if (len >= sizeof(user)) {
+    return 1;
+  }
+  (void)memcpy(user, name, len);
+  user[len] = '\0';
+
+  if (getpwnam_r(user, &pw, buf, sizeof(buf), &result) != 0) {
+    return 1;
+  }
+  return result != NULL;
+}
+
+/*
+ * Only name/cron/host@REALM is ours to delete, and only while name no
+ * longer resolves.  The keytab belonged to the departed user, so it could
+ * list anyone's principal.
+ */
+static int reaper_collect(const struct kcron_keytab_entry *entry, void *data) __attribute__((nonnull(1, 2)));
+static int reaper_collect(const struct kcron_keytab_entry *entry, void *data) {
+  struct reaper_dir *dir = data;
+  const char *slash = strchr(entry->principal, '/');
+
+  for (size_t i = 0; i < dir->nprincipals; i++) {
+    if (strcmp(dir->principals[i].name, entry->principal) == 0) {
+      if (entry->kvno > dir->principals[i].kvno) {
+        dir->principals[i].kvno = entry->kvno;
+      }
+      return 0;
+    }
+  }
+  if (dir->nprincipals == REAPER_MAX_PRINCIPALS) {
+    return 0;
+  }
+  /* most directories are empty or hold one principal */
+  struct reaper_principal *bigger = reallocarray(dir->principals, dir->nprincipals + 1, sizeof(struct reaper_principal));
+  if (bigger == NULL) {
+    return 1;
+  }
+  dir->principals = bigger;
+
+  struct reaper_principal *p = &dir->principals[dir->nprincipals++];
+  (void)snprintf(p->name, sizeof(p->name), "%s", entry->principal);
+  p->kvno = entry->kvno;
+  /* with -a most uids are live, skip the NSS lookups for their principals */
+  p->deletable = (strcmp(dir->state, "orphan") == 0) && (slash != NULL) && (strncmp(slash, "/cron/", 6) == 0) && (!reaper_name_exists(entry->principal, (size_t)(slash - entry->principal)));
+
+  return 0;
+}
+
+static void reaper_scan(const struct reaper_job *job, struct reaper_dir *dir) __attribute__((nonnull(1, 2)));
+static void reaper_scan(const struct reaper_job *job, struct reaper_dir *dir) {
+  struct stat st = {0};
+  unsigned char *buf = NULL;
+  size_t len = 0;
+  int dir_fd = -1;
+  int keytab_fd = -1;
+
+  dir->state = reaper_uid_exists(dir->uid) ? "active" : "orphan";
+  if ((!job->all) && (strcmp(dir->state, "active") == 0)) {
+    return;
+  }
+
+  dir_fd = openat(job->top_fd, dir->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if ((dir_fd < 0) || (fstat(dir_fd, &st) != 0)) {
+    dir->state = "unreadable";
+    dir->error = errno;
+    if (dir_fd >= 0) {
+      (void)close(dir_fd);
+    }
+    return;
+  }
+  dir->mtime = st.st_mtime;
+
+  if (st.st_uid != dir->uid) {
+    dir->state = "foreign";
+    dir->reason = "directory owner does not match its name";
+    (void)close(dir_fd);
+    return;
+  }
+
+  keytab_fd = openat(dir_fd, job->keytab_filename, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+  (void)close(dir_fd);
+  if (keytab_fd < 0) {
+    if (errno != ENOENT) {
+      dir->state = "unreadable";
+      dir->error = errno;
+    }
+    return;
+  }
+
+  /* when the keys were last written, ktadd appends without touching the directory */
+  if (fstat(keytab_fd, &st) == 0) {
+    dir->mtime = st.st_mtime;
+  }
+
+  if (kcron_keytab_read(keytab_fd, &buf, &len) != 0) {
+    dir->state = "unreadable";
+    dir->reason = "keytab is not a regular file of sane size";
+    (void)close(keytab_fd);
+    return;
+  }
+  (void)close(keytab_fd);
+
+  if (kcron_keytab_parse(buf, len, reaper_collect, dir) != 0) {
+    dir->reason = "keytab is damaged, listing what could be read";
+  }
+  (void)free(buf);
+}
+
+static void reaper_remove(const struct reaper_job *job, struct reaper_dir *dir) __attribute__((nonnull(1, 2)));
+static void reaper_remove(const struct reaper_job *job, struct reaper_dir *dir) {
+  struct stat st = {0};
+  const struct dirent *de = NULL;
+  DIR *d = NULL;
+  int dir_fd = -1;
+
+  dir->state = "kept";
+
+  if (reaper_uid_exists(dir->uid)) {
+    dir->reason = "uid exists";
+    return;
+  }
+
+  dir_fd = openat(job->top_fd, dir->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if ((dir_fd < 0) || (fstat(dir_fd, &st) != 0)) {
+    dir->error = errno;
+    if (dir_fd >= 0) {
+      (void)close(dir_fd);
+    }
+    return;
+  }
+  if (st.st_uid != dir->uid) {
+    dir->reason = "directory owner does not match its name";
+    (void)close(dir_fd);
+    return;
+  }
+
+  d = fdopendir(dir_fd);
+  if (d == NULL) {
+    dir->error = errno;
+    (void)close(dir_fd);
+    return;
+  }
+
+  /* Look before touching anything, a subdirectory means someone else's layout */
+  while ((de = readdir(d)) != NULL) {
+    if ((strcmp(de->d_name, ".") == 0) || (strcmp(de->d_name, "..") == 0)) {
+      continue;
+    }
+    if ((fstatat(dir_fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) || S_ISDIR(st.st_mode)) {
+      dir->reason = "contains a directory";
+      (void)closedir(d);
+      return;
+    }
+  }
+
+  rewinddir(d);
+  while ((de = readdir(d)) != NULL) {
+    if ((strcmp(de->d_name, ".") == 0) || (strcmp(de->d_name, "..") == 0)) {
+      continue;
+    }
+    if (unlinkat(dir_fd, de->d_name, 0) != 0) {
+      dir->error = errno;
+      (void)closedir(d);
+      return;
+    }
+  }
+  (void)closedir(d);
+
+  if (unlinkat(job->top_fd, dir->name, AT_REMOVEDIR) != 0) {
+    dir->error = errno;
+    return;
+  }
+
+  dir->state = "removed";
+}
+
+static void *reaper_worker(void *arg) __attribute__((nonnull(1)));
+static void *reaper_worker(void *arg) {
+  struct reaper_job *job = arg;
+
+  for (;;) {
+    const size_t i = atomic_fetch_add(&job->next, 1);
+    if (i >= job->ndirs) {
+      break;
+    }
+    if (job->remove) {
+      reaper_remove(job, &job->dirs[i]);
+    } else {
+      reaper_scan(job, &job->dirs[i]);
+    }
+  }
+
+  return NULL;
+}
+
+static int reaper_add_dir(struct reaper_dir **dirs, size_t *ndirs, size_t *size, uid_t uid) __attribute__((nonnull(1, 2, 3))) __attribute__((warn_unused_result));
+static int reaper_add_dir(struct reaper_dir **dirs, size_t *ndirs, size_t *size, uid_t uid) {
+  if (*ndirs == *size) {
+    const size_t bigger_size = (*size == 0) ? 64 : *size * 2;
+    struct reaper_dir *bigger = reallocarray(*dirs, bigger_size, sizeof(struct reaper_dir));
+    if (bigger == NULL) {
+      return 1;
+    }
+    *dirs = bigger;
+    *size = bigger_size;
+  }
+
+  struct reaper_dir *dir = &(*dirs)[(*ndirs)++];
+  (void)memset(dir, 0, sizeof(*dir));
+  dir->uid = uid;
+  (void)snprintf(dir->name, sizeof(dir->name), "%u", uid);
+  return 0;
+}
+
+static void usage(void) {
+  (void)fprintf(stderr, "Usage: %s [-a|-r] [-j threads] [-d directory]\n", __PROGRAM_NAME);
+  (void)fprintf(stderr, "  List keytab directories whose uid no longer resolves:\n");
+  (void)fprintf(stderr, "    uid state kvno mtime principal\n");
+  (void)fprintf(stderr, "  state is 'orphan' for principals safe to delete, 'foreign' for\n");
+  (void)fprintf(stderr, "  principals in the keytab that are not, '-' for a keytab with none.\n");
+  (void)fprintf(stderr, "  mtime is that of the keytab, or of the directory if there is none.\n");
+  (void)fprintf(stderr, "  -a  list every directory, 'active' for uids that still resolve\n");
+  (void)fprintf(stderr, "  -r  remove the directories of the uids read from stdin, one per line\n");
+  (void)fprintf(stderr, "  -j  threads to use (default %d)\n", REAPER_DEFAULT_THREADS);
+  (void)fprintf(stderr, "  -d  keytab directory (default %s)\n", __CLIENT_KEYTAB_DIR);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+
+  const char *nullstring = NULL;
+  const char *top = __CLIENT_KEYTAB_DIR;
+  struct reaper_job job = {.top_fd = -1, .remove = 0, .all = 0, .keytab_filename = NULL, .dirs = NULL, .ndirs = 0};
+  pthread_t threads[REAPER_MAX_THREADS];
+  struct timespec start = {0};
+  size_t size = 0;
+  size_t nuids = 0;
+  size_t scanned = 0;
+  size_t nthreads = REAPER_DEFAULT_THREADS;
+  size_t orphans = 0;
+  size_t removed = 0;
+  uid_t *uids = NULL;
+  int opt = 0;
+
+  char *keytab = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+  char *keytab_dirname = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+  char *keytab_filename = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+
+  if ((keytab == nullstring) || (keytab_dirname == nullstring) || (keytab_filename == nullstring)) {
+    (void)fprintf(stderr, "%s: unable to allocate memory.\n", __PROGRAM_NAME);
+    exit(EXIT_FAILURE);
+  }
+
+  while ((opt = getopt(argc, argv, "arj:d:h")) != -1) {
+    switch (opt) {
+    case 'a':
+      job.all = 1;
+      break;
+    case 'r':
+      job.remove = 1;
+      break;
+    case 'j':
+      nthreads = strtoul(optarg, NULL, 10);
+      if ((nthreads == 0) || (nthreads > REAPER_MAX_THREADS)) {
+        usage();
+      }
+      break;
+    case 'd':
+      top = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+
+  /* only the file name part is wanted, uid 0 is as good as any */
+  if (get_filenames_for_uid(0, keytab_dirname, keytab_filename, keytab) != 0) {
+    exit(EXIT_FAILURE);
+  }
+  job.keytab_filename = keytab_filename;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &start);
+
+  job.top_fd = open(top, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (job.top_fd < 0) {
+    (void)fprintf(stderr, "%s: unable to open %s: %s\n", __PROGRAM_NAME, top, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  if (job.remove) {
+    char line[64];
+    uid_t uid = 0;
+
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+      line[strcspn(line, "\n")] = '\0';
+      if (kcron_parse_uid(line, &uid) != 0) {
+        (void)fprintf(stderr, "%s: ignoring '%s', not a uid\n", __PROGRAM_NAME, line);
+        continue;
+      }
+      if (reaper_add_dir(&job.dirs, &job.ndirs, &size, uid) != 0) {
+        (void)fprintf(stderr, "%s: unable to allocate memory.\n", __PROGRAM_NAME);
+        exit(EXIT_FAILURE);
+      }
+    }
+    scanned = job.ndirs;
+  } else {
+    const struct dirent *de = NULL;
+    DIR *d = NULL;
+    int fd = dup(job.top_fd);
+    uid_t uid = 0;
+
+    uids = reaper_load_uids(&nuids);
+    if (uids == NULL) {
+      (void)fprintf(stderr, "%s: unable to read the password database.\n", __PROGRAM_NAME);
+      exit(EXIT_FAILURE);
+    }
+
+    if ((fd < 0) || ((d = fdopendir(fd)) == NULL)) {
+      (void)fprintf(stderr, "%s: unable to read %s: %s\n", __PROGRAM_NAME, top, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    while ((de = readdir(d)) != NULL) {
+      if (kcron_parse_uid(de->d_name, &uid) != 0) {
+        continue;
+      }
+      scanned++;
+      if ((!job.all) && (bsearch(&uid, uids, nuids, sizeof(uid_t), reaper_uid_cmp) != NULL)) {
+        continue;
+      }
+      if (reaper_add_dir(&job.dirs, &job.ndirs, &size, uid) != 0) {
+        (void)fprintf(stderr, "%s: unable to allocate memory.\n", __PROGRAM_NAME);
+        exit(EXIT_FAILURE);
+      }
+    }
+    (void)closedir(d);
+  }
+
+  qsort(job.dirs, job.ndirs, sizeof(struct reaper_dir), reaper_dir_cmp);
+
+  if (nthreads > job.ndirs) {
+    nthreads = (job.ndirs == 0) ? 1 : job.ndirs;
+  }
+  atomic_init(&job.next, 0);
+  for (size_t i = 0; i < nthreads; i++) {
+    if (pthread_create(&threads[i], NULL, reaper_worker, &job) != 0) {
+      (void)fprintf(stderr, "%s: unable to start thread.\n", __PROGRAM_NAME);
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (size_t i = 0; i < nthreads; i++) {
+    (void)pthread_join(threads[i], NULL);
+  }
+
+  for (size_t i = 0; i < job.ndirs; i++) {
+    const struct reaper_dir *dir = &job.dirs[i];
+
+    if (dir->reason != NULL) {
+      (void)fprintf(stderr, "%s: %s/%s: %s\n", __PROGRAM_NAME, top, dir->name, dir->reason);
+    } else if (dir->error != 0) {
+      (void)fprintf(stderr, "%s: %s/%s: %s\n", __PROGRAM_NAME, top, dir->name, strerror(dir->error));
+    }
+
+    if (job.remove) {
+      removed += (strcmp(dir->state, "removed") == 0);
+      (void)printf("%s %s\n", dir->name, dir->state);
+      continue;
+    }
+
+    if (strcmp(dir->state, "orphan") == 0) {
+      orphans++;
+    } else if (job.all && (strcmp(dir->state, "active") != 0)) {
+      (void)printf("%s %s - - -\n", dir->name, dir->state);
+      continue;
+    } else if (!job.all) {
+      continue;
+    }
+    if (dir->nprincipals == 0) {
+      (void)printf("%s %s - %lld -\n", dir->name, job.all ? dir->state : "-", (long long)dir->mtime);
+    }
+    for (size_t p = 0; p < dir->nprincipals; p++) {
+      const char *state = dir->principals[p].deletable ? "orphan" : "foreign";
+      if (strcmp(dir->state, "active") == 0) {
+        state = "active";
+      }
+      (void)printf("%s %s %u %lld %s\n", dir->name, state, dir->principals[p].kvno, (long long)dir->mtime, dir->principals[p].name);
+    }
+  }
+  (void)fflush(stdout);
+
+  const double elapsed = kcron_since(&start);
+  if (job.remove) {
+    (void)fprintf(stderr, "%s: removed %zu of %zu directories in %.3f s, %.1f directories/s\n", __PROGRAM_NAME, removed, scanned, elapsed, (elapsed > 0) ? (double)removed / elapsed : 0.0);
+  } else {
+    (void)fprintf(stderr, "%s: %zu of %zu directories orphaned, %zu known uids, scanned in %.3f s, %.1f directories/s\n", __PROGRAM_NAME, orphans, scanned, nuids, elapsed,
+                  (elapsed > 0) ? (double)scanned / elapsed : 0.0);
+  }
+
+  (void)close(job.top_fd);
+  for (size_t i = 0; i < job.ndirs; i++) {
+    (void)free(job.dirs[i].principals);
+  }
+  (void)free(job.dirs);
+  (void)free(uids);
+  (void)free(keytab);
+  (void)free(keytab_dirname);
+  (void)free(keytab_filename);
+
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,620 @@
+/*
+ *
+ * Keep a local copy of each in-use keytab
+ * For hosts whose CLIENT_KEYTAB_DIR is on shared storage
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef __PROGRAM_NAME
+#define __PROGRAM_NAME "kcron-mirror"
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pwd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fsuid.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kcron_filename.h"
+#include "kcron_keytab_parse.h"
+#include "kcron_mirror.h"
+
+#define MIRROR_DEFAULT_INTERVAL 30
+#define MIRROR_DEFAULT_SPOOL "/var/spool/cron"
+
+#ifndef _0755
+#define _0755 S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH
+#endif
+#ifndef _0644
+#define _0644 S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH
+#endif
+
+enum mirror_result {
+  MIRROR_CURRENT = 0,
+  MIRROR_REFRESHED = 1,
+  MIRROR_DROPPED = 2,
+  MIRROR_ABSENT = 3,
+  MIRROR_FAILED = 4,
+};
+
+static const char *const mirror_result_names[] = {"current", "refreshed", "dropped", "absent", "failed"};
+
+struct mirror_uids {
+  uid_t *uids;
+  size_t count;
+  size_t size;
+};
+
+struct mirror_watch {
+  int wd;
+  uid_t uid;
+};
+
+struct mirror_state {
+  const char *keytab_filename;
+  const char *spool;
+  int top_fd;
+  int verbose;
+  struct mirror_uids only;
+  struct mirror_watch *watches;
+  size_t nwatches;
+  int inotify_fd;
+  size_t counts[MIRROR_FAILED + 1];
+};
+
+static int mirror_uid_cmp(const void *a, const void *b) __attribute__((nonnull(1, 2)));
+static int mirror_uid_cmp(const void *a, const void *b) {
+  const uid_t x = *(const uid_t *)a;
+  const uid_t y = *(const uid_t *)b;
+  return (x > y) - (x < y);
+}
+
+static int mirror_uids_add(struct mirror_uids *set, uid_t uid) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+static int mirror_uids_add(struct mirror_uids *set, uid_t uid) {
+  if (set->count == set->size) {
+    const size_t bigger_size = (set->size == 0) ? 64 : set->size * 2;
+    uid_t *bigger = reallocarray(set->uids, bigger_size, sizeof(uid_t));
+    if (bigger == NULL) {
+      return 1;
+    }
+    set->uids = bigger;
+    set->size = bigger_size;
+  }
+  set->uids[set->count++] = uid;
+  return 0;
+}
+
+static void mirror_uids_unique(struct mirror_uids *set) __attribute__((nonnull(1)));
+static void mirror_uids_unique(struct mirror_uids *set) {
+  size_t kept = 0;
+
+  qsort(set->uids, set->count, sizeof(uid_t), mirror_uid_cmp);
+  for (size_t i = 0; i < set->count; i++) {
+    if ((kept == 0) || (set->uids[kept - 1] != set->uids[i])) {
+      set->uids[kept++] = set->uids[i];
+    }
+  }
+  set->count = kept;
+}
+
+/*
+ * A uid is in use while it has a crontab or a running process.  The
+ * crontab keeps the copy around between jobs, the processes cover
+ * at, systemd timers and long running jobs that renew from the keytab.
+ */
+static int mirror_in_use(const char *spool, struct mirror_uids *set) __attribute__((nonnull(1, 2))) __attribute__((warn_unused_result));
+static int mirror_in_use(const char *spool, struct mirror_uids *set) {
+  const struct dirent *de = NULL;
+  struct stat st = {0};
+  DIR *d = NULL;
+  uid_t uid = 0;
+
+  d = opendir("/proc");
+  if (d == NULL) {
+    return 1;
+  }
+  while ((de = readdir(d)) != NULL) {
+    if ((kcron_parse_uid(de->d_name, &uid) != 0) || (fstatat(dirfd(d), de->d_name, &st, 0) != 0) || (st.st_uid == 0)) {
+      continue;
+    }
+    if (mirror_uids_add(set, st.st_uid) != 0) {
+      (void)closedir(d);
+      return 1;
+    }
+  }
+  (void)closedir(d);
+
+  /* cronie names the files after the user */
+  d = opendir(spool);
+  if (d != NULL) {
+    while ((de = readdir(d)) != NULL) {
+      const struct passwd *pw = NULL;
+      if ((de->d_name[0] == '.') || ((pw = getpwnam(de->d_name)) == NULL) || (pw->pw_uid == 0)) {
+        continue;
+      }
+      if (mirror_uids_add(set, pw->pw_uid) != 0) {
+        (void)closedir(d);
+        return 1;
+      }
+    }
+    (void)closedir(d);
+  }
+
+  mirror_uids_unique(set);
+  return 0;
+}
+
+static int mirror_write_file(int dir_fd, const char *name, const void *data, size_t len, uid_t uid, gid_t gid, mode_t mode) __attribute__((nonnull(2)))
+__attribute__((warn_unused_result));
+static int mirror_write_file(int dir_fd, const char *name, const void *data, size_t len, uid_t uid, gid_t gid, mode_t mode) {
+  char tmp[256] = {0};
+  size_t done = 0;
+  int fd = -1;
+
+  (void)snprintf(tmp, sizeof(tmp), ".%s.%ld", name, (long)getpid());
+  (void)unlinkat(dir_fd, tmp, 0);
+
+  fd = openat(dir_fd, tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, _0600);
+  if (fd < 0) {
+    return 1;
+  }
+  /* owner and mode before the contents, so nobody else ever sees the keys */
+  if ((fchown(fd, uid, gid) != 0) || (fchmod(fd, mode) != 0)) {
+    (void)close(fd);
+    (void)unlinkat(dir_fd, tmp, 0);
+    return 1;
+  }
+  while (done < len) {
+    const ssize_t w = write(fd, (const unsigned char *)data + done, len - done);
+    if (w < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      (void)close(fd);
+      (void)unlinkat(dir_fd, tmp, 0);
+      return 1;
+    }
+    done += (size_t)w;
+  }
+  if ((close(fd) != 0) || (renameat(dir_fd, tmp, dir_fd, name) != 0)) {
+    (void)unlinkat(dir_fd, tmp, 0);
+    return 1;
+  }
+  return 0;
+}
+
+static enum mirror_result mirror_drop(const struct mirror_state *state, uid_t uid) __attribute__((nonnull(1)));
+static enum mirror_result mirror_drop(const struct mirror_state *state, uid_t uid) {
+  char name[32] = {0};
+  char sidecar[256] = {0};
+  int dir_fd = -1;
+
+  (void)snprintf(name, sizeof(name), "%u", uid);
+  (void)snprintf(sidecar, sizeof(sidecar), "%s%s", state->keytab_filename, KCRON_MIRROR_SOURCE_SUFFIX);
+
+  dir_fd = openat(state->top_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (dir_fd < 0) {
+    return (errno == ENOENT) ? MIRROR_ABSENT : MIRROR_FAILED;
+  }
+  /* the sidecar first, so readers stop trusting the copy before it goes */
+  (void)unlinkat(dir_fd, sidecar, 0);
+  (void)unlinkat(dir_fd, state->keytab_filename, 0);
+  (void)close(dir_fd);
+  if (unlinkat(state->top_fd, name, AT_REMOVEDIR) != 0) {
+    return MIRROR_FAILED;
+  }
+  return MIRROR_DROPPED;
+}
+
+/*
+ * Bring the copy for uid up to date with its shared keytab.  The shared
+ * keytab is opened without following links and must belong to uid.  It
+ * is only read when its stat differs from the sidecar, and the copy only
+ * replaced if the stat did not change while it was read.  Reads go
+ * through the descriptor, so they keep the credentials of the open.
+ */
+static enum mirror_result mirror_refresh(const struct mirror_state *state, uid_t uid) __attribute__((nonnull(1)));
+static enum mirror_result mirror_refresh(const struct mirror_state *state, uid_t uid) {
+  struct kcron_mirror_source source;
+  struct kcron_mirror_source current;
+  struct stat before = {0};
+  struct stat after = {0};
+  struct stat sidecar = {0};
+  struct stat st = {0};
+  char shared_dir[FILE_PATH_MAX_LENGTH + 3] = {0};
+  char shared_name[FILE_PATH_MAX_LENGTH + 3] = {0};
+  char shared[FILE_PATH_MAX_LENGTH + 3] = {0};
+  char name[32] = {0};
+  char sidecar_name[256] = {0};
+  unsigned char *buf = NULL;
+  size_t len = 0;
+  int keytab_fd = -1;
+  int dir_fd = -1;
+
+  if (get_filenames_for_uid(uid, shared_dir, shared_name, shared) != 0) {
+    return MIRROR_FAILED;
+  }
+
+  /* as the owner, root is usually squashed on shared storage */
+  (void)setfsuid(uid);
+  keytab_fd = open(shared, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+  const int saved_errno = errno;
+  (void)setfsuid(0);
+
+  if (keytab_fd < 0) {
+    /* keep the copy through an outage of the shared storage */
+    return ((saved_errno == ENOENT) || (saved_errno == ELOOP)) ? mirror_drop(state, uid) : MIRROR_FAILED;
+  }
+  if (fstat(keytab_fd, &before) != 0) {
+    (void)close(keytab_fd);
+    return MIRROR_FAILED;
+  }
+  if ((!S_ISREG(before.st_mode)) || (before.st_uid != uid)) {
+    (void)close(keytab_fd);
+    return mirror_drop(state, uid);
+  }
+
+  (void)snprintf(name, sizeof(name), "%u", uid);
+  (void)snprintf(sidecar_name, sizeof(sidecar_name), "%s%s", state->keytab_filename, KCRON_MIRROR_SOURCE_SUFFIX);
+  if ((mkdirat(state->top_fd, name, _0755) != 0) && (errno != EEXIST)) {
+    (void)close(keytab_fd);
+    return MIRROR_FAILED;
+  }
+  dir_fd = openat(state->top_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if ((dir_fd < 0) || (fstat(dir_fd, &st) != 0) || (st.st_uid != 0) || ((st.st_mode & (S_IWGRP | S_IWOTH)) != 0)) {
+    (void)fprintf(stderr, "%s: %s/%s is not a directory only root can change, leaving it alone.\n", __PROGRAM_NAME, __MIRROR_KEYTAB_DIR, name);
+    if (dir_fd >= 0) {
+      (void)close(dir_fd);
+    }
+    (void)close(keytab_fd);
+    return MIRROR_FAILED;
+  }
+
+  /* unchanged, nothing to do */
+  if ((kcron_mirror_read_source(dir_fd, state->keytab_filename, uid, &source, &sidecar) == 0) && kcron_mirror_matches(&before, &source) &&
+      (fstatat(dir_fd, state->keytab_filename, &st, AT_SYMLINK_NOFOLLOW) == 0) && S_ISREG(st.st_mode) && (st.st_uid == uid) &&
+      ((int64_t)st.st_size == source.size)) {
+    (void)close(keytab_fd);
+    (void)close(dir_fd);
+    return MIRROR_CURRENT;
+  }
+
+  if (kcron_keytab_read(keytab_fd, &buf, &len) != 0) {
+    (void)close(keytab_fd);
+    (void)close(dir_fd);
+    return MIRROR_FAILED;
+  }
+  if ((fstat(keytab_fd, &after) != 0) || (len != (size_t)before.st_size)) {
+    (void)free(buf);
+    (void)close(keytab_fd);
+    (void)close(dir_fd);
+    return MIRROR_FAILED;
+  }
+  (void)close(keytab_fd);
+
+  kcron_mirror_describe(&before, &source);
+  kcron_mirror_describe(&after, &current);
+  if (memcmp(&source, &current, sizeof(source)) != 0) {
+    /* caught mid-write, the next pass will get it */
+    (void)free(buf);
+    (void)close(dir_fd);
+    return MIRROR_FAILED;
+  }
+
+  /* keytab before sidecar, an old sidecar only sends readers to shared storage */
+  if ((mirror_write_file(dir_fd, state->keytab_filename, buf, len, before.st_uid, before.st_gid, _0600) != 0) ||
+      (mirror_write_file(dir_fd, sidecar_name, &source, sizeof(source), 0, 0, _0644) != 0)) {
+    (void)free(buf);
+    (void)close(dir_fd);
+    return MIRROR_FAILED;
+  }
+
+  (void)free(buf);
+  (void)close(dir_fd);
+  return MIRROR_REFRESHED;
+}
+
+static void mirror_watch(struct mirror_state *state, uid_t uid) __attribute__((nonnull(1)));
+static void mirror_watch(struct mirror_state *state, uid_t uid) {
+  char shared_dir[FILE_PATH_MAX_LENGTH + 3] = {0};
+  char shared_name[FILE_PATH_MAX_LENGTH + 3] = {0};
+  char shared[FILE_PATH_MAX_LENGTH + 3] = {0};
+
+  if ((state->inotify_fd < 0) || (get_filenames_for_uid(uid, shared_dir, shared_name, shared) != 0)) {
+    return;
+  }
+
+  /* only changes made from this host show up, the sweep catches the rest */
+  const int wd = inotify_add_watch(state->inotify_fd, shared_dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ATTRIB | IN_DONT_FOLLOW | IN_ONLYDIR);
+  if (wd < 0) {
+    return;
+  }
+  for (size_t i = 0; i < state->nwatches; i++) {
+    if (state->watches[i].wd == wd) {
+      state->watches[i].uid = uid;
+      return;
+    }
+  }
+  struct mirror_watch *bigger = reallocarray(state->watches, state->nwatches + 1, sizeof(struct mirror_watch));
+  if (bigger == NULL) {
+    (void)inotify_rm_watch(state->inotify_fd, wd);
+    return;
+  }
+  state->watches = bigger;
+  state->watches[state->nwatches].wd = wd;
+  state->watches[state->nwatches].uid = uid;
+  state->nwatches++;
+}
+
+static void mirror_unwatch_all(struct mirror_state *state) __attribute__((nonnull(1)));
+static void mirror_unwatch_all(struct mirror_state *state) {
+  for (size_t i = 0; i < state->nwatches; i++) {
+    (void)inotify_rm_watch(state->inotify_fd, state->watches[i].wd);
+  }
+  state->nwatches = 0;
+}
+
+static void mirror_record(struct mirror_state *state, uid_t uid, enum mirror_result result) __attribute__((nonnull(1)));
+static void mirror_record(struct mirror_state *state, uid_t uid, enum mirror_result result) {
+  state->counts[result]++;
+  if (state->verbose && (result != MIRROR_ABSENT)) {
+    (void)printf("%u %s\n", uid, mirror_result_names[result]);
+    (void)fflush(stdout);
+  }
+}
+
+/*
+ * Every uid in use gets its copy refreshed, every copy whose uid is no
+ * longer in use is dropped.
+ */
+static int mirror_sweep(struct mirror_state *state) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+static int mirror_sweep(struct mirror_state *state) {
+  struct mirror_uids in_use = {0};
+  struct mirror_uids mirrored = {0};
+  const struct dirent *de = NULL;
+  struct timespec start = {0};
+  struct timespec end = {0};
+  DIR *d = NULL;
+  uid_t uid = 0;
+  int fd = -1;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &start);
+  (void)memset(state->counts, 0, sizeof(state->counts));
+
+  if (state->only.count > 0) {
+    for (size_t i = 0; i < state->only.count; i++) {
+      if (mirror_uids_add(&in_use, state->only.uids[i]) != 0) {
+        return 1;
+      }
+    }
+    mirror_uids_unique(&in_use);
+  } else if (mirror_in_use(state->spool, &in_use) != 0) {
+    (void)fprintf(stderr, "%s: unable to list the uids in use.\n", __PROGRAM_NAME);
+    (void)free(in_use.uids);
+    return 1;
+  }
+
+  fd = dup(state->top_fd);
+  if ((fd >= 0) && ((d = fdopendir(fd)) != NULL)) {
+    while ((de = readdir(d)) != NULL) {
+      if ((kcron_parse_uid(de->d_name, &uid) == 0) && (mirror_uids_add(&mirrored, uid) != 0)) {
+        break;
+      }
+    }
+    (void)closedir(d);
+  } else if (fd >= 0) {
+    (void)close(fd);
+  }
+
+  mirror_unwatch_all(state);
+  for (size_t i = 0; i < in_use.count; i++) {
+    const enum mirror_result result = mirror_refresh(state, in_use.uids[i]);
+    mirror_record(state, in_use.uids[i], result);
+    if ((result == MIRROR_CURRENT) || (result == MIRROR_REFRESHED)) {
+      mirror_watch(state, in_use.uids[i]);
+    }
+  }
+  for (size_t i = 0; i < mirrored.count; i++) {
+    if ((state->only.count == 0) && (bsearch(&mirrored.uids[i], in_use.uids, in_use.count, sizeof(uid_t), mirror_uid_cmp) == NULL)) {
+      mirror_record(state, mirrored.uids[i], mirror_drop(state, mirrored.uids[i]));
+    }
+  }
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &end);
+  const double elapsed = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+  (void)fprintf(stderr, "%s: %zu uids in use, %zu current, %zu refreshed, %zu dropped, %zu failed in %.3f s\n", __PROGRAM_NAME, in_use.count, state->counts[MIRROR_CURRENT],
+                state->counts[MIRROR_REFRESHED], state->counts[MIRROR_DROPPED], state->counts[MIRROR_FAILED], elapsed);
+
+  (void)free(in_use.uids);
+  (void)free(mirrored.uids);
+  return 0;
+}
+
+/* Refresh the uids whose shared directory changed, until the next sweep is due */
+static void mirror_wait(struct mirror_state *state, long interval) __attribute__((nonnull(1)));
+static void mirror_wait(struct mirror_state *state, long interval) {
+  struct timespec start = {0};
+  struct timespec now = {0};
+  char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &start);
+  for (;;) {
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    const long left = interval * 1000 - ((long)(now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+    if (left <= 0) {
+      return;
+    }
+    if (state->inotify_fd < 0) {
+      const struct timespec pause = {.tv_sec = left / 1000, .tv_nsec = (left % 1000) * 1000000};
+      (void)nanosleep(&pause, NULL);
+      return;
+    }
+
+    struct pollfd pfd = {.fd = state->inotify_fd, .events = POLLIN, .revents = 0};
+    if (poll(&pfd, 1, (int)left) <= 0) {
+      continue;
+    }
+    const ssize_t got = read(state->inotify_fd, events, sizeof(events));
+    for (ssize_t off = 0; off + (ssize_t)sizeof(struct inotify_event) <= got;) {
+      const struct inotify_event *ev = (const struct inotify_event *)(events + off);
+      off += (ssize_t)(sizeof(struct inotify_event) + ev->len);
+      if ((ev->len > 0) && (strcmp(ev->name, state->keytab_filename) != 0)) {
+        continue;
+      }
+      for (size_t i = 0; i < state->nwatches; i++) {
+        if (state->watches[i].wd == ev->wd) {
+          mirror_record(state, state->watches[i].uid, mirror_refresh(state, state->watches[i].uid));
+        }
+      }
+    }
+  }
+}
+
+static void usage(void) __attribute__((noreturn));
+static void usage(void) {
+  (void)fprintf(stderr, "Usage: %s [-v] [-w] [-i seconds] [-c spool] [-u uid]...\n", __PROGRAM_NAME);
+  (void)fprintf(stderr, "  Copy the keytab of every uid with a crontab or a running process from\n");
+  (void)fprintf(stderr, "  %s to %s, and drop the copies of uids no longer in use.\n", __CLIENT_KEYTAB_DIR, __MIRROR_KEYTAB_DIR);
+  (void)fprintf(stderr, "  Whoever reads a copy checks it against the shared keytab first.\n");
+  (void)fprintf(stderr, "  -v  print 'uid current|refreshed|dropped|failed' for each uid\n");
+  (void)fprintf(stderr, "  -w  keep running, passing every -i seconds and following local changes\n");
+  (void)fprintf(stderr, "  -i  seconds between passes with -w (default %d)\n", MIRROR_DEFAULT_INTERVAL);
+  (void)fprintf(stderr, "  -c  cron spool directory, one file per user (default %s)\n", MIRROR_DEFAULT_SPOOL);
+  (void)fprintf(stderr, "  -u  only this uid, may be repeated; other copies are left alone\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+
+  const char *nullstring = NULL;
+  struct mirror_state state = {.keytab_filename = NULL, .spool = MIRROR_DEFAULT_SPOOL, .top_fd = -1, .verbose = 0, .watches = NULL, .nwatches = 0, .inotify_fd = -1};
+  long interval = MIRROR_DEFAULT_INTERVAL;
+  int watch = 0;
+  int opt = 0;
+  uid_t uid = 0;
+
+  char *keytab = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+  char *keytab_dirname = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+  char *keytab_filename = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+
+  if ((keytab == nullstring) || (keytab_dirname == nullstring) || (keytab_filename == nullstring)) {
+    (void)fprintf(stderr, "%s: unable to allocate memory.\n", __PROGRAM_NAME);
+    exit(EXIT_FAILURE);
+  }
+
+  while ((opt = getopt(argc, argv, "vwi:c:u:h")) != -1) {
+    switch (opt) {
+    case 'v':
+      state.verbose = 1;
+      break;
+    case 'w':
+      watch = 1;
+      break;
+    case 'i':
+      interval = strtol(optarg, NULL, 10);
+      if (interval <= 0) {
+        usage();
+      }
+      break;
+    case 'c':
+      state.spool = optarg;
+      break;
+    case 'u':
+      if ((kcron_parse_uid(optarg, &uid) != 0) || (mirror_uids_add(&state.only, uid) != 0)) {
+        usage();
+      }
+      break;
+    default:
+      usage();
+    }
+  }
+
+  if (geteuid() != 0) {
+    (void)fprintf(stderr, "%s: must run as root to copy keytabs for other users.\n", __PROGRAM_NAME);
+    exit(EXIT_FAILURE);
+  }
+
+  /* only the file name part is wanted, uid 0 is as good as any */
+  if (get_filenames_for_uid(0, keytab_dirname, keytab_filename, keytab) != 0) {
+    exit(EXIT_FAILURE);
+  }
+  state.keytab_filename = keytab_filename;
+
+  (void)umask(022);
+  if ((mkdir(__MIRROR_KEYTAB_DIR, _0755) != 0) && (errno != EEXIST)) {
+    (void)fprintf(stderr, "%s: unable to create %s: %s\n", __PROGRAM_NAME, __MIRROR_KEYTAB_DIR, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  state.top_fd = open(__MIRROR_KEYTAB_DIR, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  struct stat st = {0};
+  if ((state.top_fd < 0) || (fstat(state.top_fd, &st) != 0) || (st.st_uid != 0) || ((st.st_mode & (S_IWGRP | S_IWOTH)) != 0)) {
+    (void)fprintf(stderr, "%s: %s must be a directory only root can change.\n", __PROGRAM_NAME, __MIRROR_KEYTAB_DIR);
+    exit(EXIT_FAILURE);
+  }
+
+  if (watch) {
+    state.inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+  }
+
+  for (;;) {
+    if ((mirror_sweep(&state) != 0) && !watch) {
+      exit(EXIT_FAILURE);
+    }
+    if (!watch) {
+      break;
+    }
+    mirror_wait(&state, interval);
+  }
+
+  (void)close(state.top_fd);
+  (void)free(state.only.uids);
+  (void)free(state.watches);
+  (void)free(keytab);
+  (void)free(keytab_dirname);
+  (void)free(keytab_filename);
+
+  exit((state.counts[MIRROR_FAILED] > 0) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,298 @@
+/*
+ *
+ * Run a command with a Kerberos ticket from the kcron keytab
+ * kept in the kernel keyring so later runs reuse it
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef __PROGRAM_NAME
+#define __PROGRAM_NAME "kcron-run"
+#endif
+
+#include <errno.h>
+#include <krb5.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kcron_filename.h"
+#include "kcron_mirror.h"
+#include "kcron_prefetch.h"
+
+/* a job should not start on a ticket about to run out */
+#define KCRON_RUN_MIN_SECONDS 300
+/* longer than any ticket a KDC would issue */
+#define KCRON_RUN_MAX_SECONDS (7 * 24 * 3600)
+
+static void usage(void) __attribute__((noreturn));
+static void usage(void) {
+  (void)fprintf(stderr, "Usage: %s [-p principal] [-c ccache] [-m seconds] [--] command [args...]\n", __PROGRAM_NAME);
+  (void)fprintf(stderr, "  Run command with KRB5CCNAME pointing at a ticket from your kcron keytab.\n");
+  (void)fprintf(stderr, "  The ticket is kept in the kernel keyring and reused by later runs.\n");
+  (void)fprintf(stderr, "  -p  principal to use (default: the first one in the keytab)\n");
+  (void)fprintf(stderr, "  -c  credential cache (default: KEYRING:persistent:<uid>:kcron)\n");
+  (void)fprintf(stderr, "  -m  get a new ticket if less than this many seconds remain (0 to %d, default %d)\n", KCRON_RUN_MAX_SECONDS, KCRON_RUN_MIN_SECONDS);
+  exit(EXIT_FAILURE);
+}
+
+static void report(krb5_context context, krb5_error_code ret, const char *what, const char *name) __attribute__((nonnull(1, 3, 4)));
+static void report(krb5_context context, krb5_error_code ret, const char *what, const char *name) {
+  const char *message = krb5_get_error_message(context, ret);
+  (void)fprintf(stderr, "%s: %s %s: %s\n", __PROGRAM_NAME, what, name, message);
+  (void)krb5_free_error_message(context, message);
+}
+
+/* Slot 1 of the keytab, the same choice kinit -k makes */
+static krb5_error_code first_principal(krb5_context context, krb5_keytab keytab, krb5_principal *client) __attribute__((nonnull(1, 2, 3)));
+static krb5_error_code first_principal(krb5_context context, krb5_keytab keytab, krb5_principal *client) {
+  krb5_kt_cursor cursor = NULL;
+  krb5_keytab_entry entry = {0};
+  krb5_error_code ret = 0;
+
+  ret = krb5_kt_start_seq_get(context, keytab, &cursor);
+  if (ret != 0) {
+    return ret;
+  }
+  ret = krb5_kt_next_entry(context, keytab, &entry, &cursor);
+  if (ret == 0) {
+    ret = krb5_copy_principal(context, entry.principal, client);
+    (void)krb5_free_keytab_entry_contents(context, &entry);
+  }
+  (void)krb5_kt_end_seq_get(context, keytab, &cursor);
+  return ret;
+}
+
+/*
+ * Is there already a TGT for client in ccache that outlives min_seconds?
+ * This is the common case and costs no KDC traffic at all.
+ */
+static int reusable(krb5_context context, krb5_ccache ccache, krb5_principal client, long min_seconds) __attribute__((nonnull(1, 2, 3)));
+static int reusable(krb5_context context, krb5_ccache ccache, krb5_principal client, long min_seconds) {
+  krb5_principal cached = NULL;
+  krb5_principal tgs = NULL;
+  krb5_creds match = {0};
+  krb5_creds creds = {0};
+  const krb5_data *realm = &client->realm;
+  int ok = 0;
+
+  if (krb5_cc_get_principal(context, ccache, &cached) != 0) {
+    return 0;
+  }
+  if (!krb5_principal_compare(context, cached, client)) {
+    (void)krb5_free_principal(context, cached);
+    return 0;
+  }
+  (void)krb5_free_principal(context, cached);
+
+  if (krb5_build_principal_ext(context, &tgs, realm->length, realm->data, KRB5_TGS_NAME_SIZE, KRB5_TGS_NAME, realm->length, realm->data, 0) != 0) {
+    return 0;
+  }
+
+  match.client = client;
+  match.server = tgs;
+  if (krb5_cc_retrieve_cred(context, ccache, 0, &match, &creds) == 0) {
+    ok = ((long)creds.times.endtime - (long)time(NULL)) > min_seconds;
+    (void)krb5_free_cred_contents(context, &creds);
+  }
+
+  (void)krb5_free_principal(context, tgs);
+  return ok;
+}
+
+/*
+ * One AS exchange into a private MEMORY cache, the prefetch list on top,
+ * then moved into place in one step so concurrent jobs never see a
+ * half-filled cache.
+ */
+static int acquire(krb5_context context, krb5_keytab keytab, krb5_principal client, const char *ccache_name, uid_t uid) __attribute__((nonnull(1, 2, 3, 4)));
+static int acquire(krb5_context context, krb5_keytab keytab, krb5_principal client, const char *ccache_name, uid_t uid) {
+  krb5_get_init_creds_opt *opt = NULL;
+  krb5_ccache staging = NULL;
+  krb5_ccache ccache = NULL;
+  krb5_creds creds = {0};
+  krb5_error_code ret = 0;
+  char staging_name[64] = {0};
+  char **services = NULL;
+  size_t count = 0;
+
+  (void)snprintf(staging_name, sizeof(staging_name), "MEMORY:kcron-run-%ld", (long)getpid());
+
+  ret = krb5_cc_resolve(context, staging_name, &staging);
+  if (ret == 0) {
+    ret = krb5_get_init_creds_opt_alloc(context, &opt);
+  }
+  if (ret == 0) {
+    ret = krb5_get_init_creds_opt_set_out_ccache(context, opt, staging);
+  }
+  if (ret == 0) {
+    ret = krb5_get_init_creds_keytab(context, &creds, client, keytab, 0, NULL, opt);
+  }
+  if (opt != NULL) {
+    (void)krb5_get_init_creds_opt_free(context, opt);
+  }
+  if (ret != 0) {
+    report(context, ret, "unable to get a ticket for", "your kcron principal");
+    if (staging != NULL) {
+      (void)krb5_cc_destroy(context, staging);
+    }
+    return 1;
+  }
+  (void)krb5_free_cred_contents(context, &creds);
+
+  if ((kcron_prefetch_load(uid, &services, &count) == 0) && (count > 0)) {
+    (void)kcron_prefetch(context, staging_name, services, count);
+  }
+  kcron_prefetch_free(services, count);
+
+  ret = krb5_cc_resolve(context, ccache_name, &ccache);
+  if (ret == 0) {
+    /* consumes staging on success */
+    ret = krb5_cc_move(context, staging, ccache);
+  }
+  if (ret != 0) {
+    report(context, ret, "unable to store credentials in", ccache_name);
+    (void)krb5_cc_destroy(context, staging);
+    if (ccache != NULL) {
+      (void)krb5_cc_close(context, ccache);
+    }
+    return 1;
+  }
+
+  (void)krb5_cc_close(context, ccache);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+
+  const char *nullstring = NULL;
+  const char *principal = NULL;
+  krb5_context context = NULL;
+  krb5_keytab kt = NULL;
+  krb5_principal client = NULL;
+  krb5_ccache ccache = NULL;
+  krb5_error_code ret = 0;
+  char ccache_name[FILE_PATH_MAX_LENGTH + 1] = {0};
+  char keytab_name[FILE_PATH_MAX_LENGTH + 8] = {0};
+  long min_seconds = KCRON_RUN_MIN_SECONDS;
+  char *end = NULL;
+  int opt = 0;
+  int have_ticket = 0;
+
+  const uid_t uid = getuid();
+
+  char *keytab = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+  char *keytab_dirname = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+  char *keytab_filename = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+
+  if ((keytab == nullstring) || (keytab_dirname == nullstring) || (keytab_filename == nullstring)) {
+    (void)fprintf(stderr, "%s: unable to allocate memory.\n", __PROGRAM_NAME);
+    exit(EXIT_FAILURE);
+  }
+
+  (void)snprintf(ccache_name, sizeof(ccache_name), "KEYRING:persistent:%u:kcron", uid);
+
+  /* + so options after the command belong to the command */
+  while ((opt = getopt(argc, argv, "+p:c:m:h")) != -1) {
+    switch (opt) {
+    case 'p':
+      principal = optarg;
+      break;
+    case 'c':
+      (void)snprintf(ccache_name, sizeof(ccache_name), "%s", optarg);
+      break;
+    case 'm':
+      min_seconds = strtol(optarg, &end, 10);
+      if ((end == optarg) || (*end != '\0') || (min_seconds < 0) || (min_seconds > KCRON_RUN_MAX_SECONDS)) {
+        usage();
+      }
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind >= argc) {
+    usage();
+  }
+
+  if (get_mirrored_filenames(keytab_dirname, keytab_filename, keytab) != 0) {
+    (void)fprintf(stderr, "%s: Cannot determine keytab filename.\n", __PROGRAM_NAME);
+    exit(EXIT_FAILURE);
+  }
+  (void)snprintf(keytab_name, sizeof(keytab_name), "FILE:%s", keytab);
+
+  if (krb5_init_context(&context) != 0) {
+    (void)fprintf(stderr, "%s: unable to initialize Kerberos.\n", __PROGRAM_NAME);
+    exit(EXIT_FAILURE);
+  }
+
+  ret = krb5_kt_resolve(context, keytab_name, &kt);
+  if (ret == 0) {
+    ret = (principal != nullstring) ? krb5_parse_name(context, principal, &client) : first_principal(context, kt, &client);
+  }
+  if (ret != 0) {
+    report(context, ret, "unable to find a principal in", keytab);
+    exit(EXIT_FAILURE);
+  }
+
+  if (krb5_cc_resolve(context, ccache_name, &ccache) == 0) {
+    have_ticket = reusable(context, ccache, client, min_seconds);
+    (void)krb5_cc_close(context, ccache);
+  }
+
+  if (!have_ticket && (acquire(context, kt, client, ccache_name, uid) != 0)) {
+    exit(EXIT_FAILURE);
+  }
+
+  (void)krb5_free_principal(context, client);
+  (void)krb5_kt_close(context, kt);
+  (void)krb5_free_context(context);
+
+  /* the job can renew on its own from the same keytab if it runs long */
+  if ((setenv("KRB5CCNAME", ccache_name, 1) != 0) || (setenv("KRB5_CLIENT_KTNAME", keytab_name, 0) != 0)) {
+    (void)fprintf(stderr, "%s: unable to set the environment.\n", __PROGRAM_NAME);
+    exit(EXIT_FAILURE);
+  }
+
+  (void)free(keytab);
+  (void)free(keytab_dirname);
+  (void)free(keytab_filename);
+
+  (void)execvp(argv[optind], &argv[optind]);
+  (void)fprintf(stderr, "%s: unable to run %s: %s\n", __PROGRAM_NAME, argv[optind], strerror(errno));
+  exit(127);
+}
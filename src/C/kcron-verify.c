@@ -0,0 +1,516 @@
+/*
+ *
+ * Get a ticket with every populated keytab on this host
+ * and report failures and latency per realm
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef __PROGRAM_NAME
+#define __PROGRAM_NAME "kcron-verify"
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <krb5.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kcron_filename.h"
+#include "kcron_keytab_parse.h"
+#include "kcron_ratelimit.h"
+
+#define VERIFY_DEFAULT_THREADS 8
+#define VERIFY_MAX_THREADS 256
+#define VERIFY_DEFAULT_RATE 20.0
+#define VERIFY_MAX_PRINCIPALS 32
+
+struct verify_principal {
+  char name[KCRON_PRINCIPAL_MAX_LENGTH];
+  double seconds;
+  int ok;
+  char message[256];
+};
+
+struct verify_dir {
+  uid_t uid;
+  char name[32];
+  const char *reason;
+  int error; /* errno instead of a reason, strerror() is not for the workers */
+  size_t nprincipals;
+  struct verify_principal *principals;
+};
+
+struct verify_job {
+  int top_fd;
+  const char *keytab_filename;
+  struct verify_dir *dirs;
+  size_t ndirs;
+  atomic_size_t next;
+  atomic_size_t serial;
+  struct kcron_bucket bucket;
+};
+
+static int verify_dir_cmp(const void *a, const void *b) __attribute__((nonnull(1, 2)));
+static int verify_dir_cmp(const void *a, const void *b) {
+  const uid_t x = ((const struct verify_dir *)a)->uid;
+  const uid_t y = ((const struct verify_dir *)b)->uid;
+  return (x > y) - (x < y);
+}
+
+static int verify_seconds_cmp(const void *a, const void *b) __attribute__((nonnull(1, 2)));
+static int verify_seconds_cmp(const void *a, const void *b) {
+  const double x = *(const double *)a;
+  const double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static const char *verify_realm(const struct verify_principal *p) __attribute__((nonnull(1)));
+static const char *verify_realm(const struct verify_principal *p) { return strrchr(p->name, '@') + 1; }
+
+static int verify_collect(const struct kcron_keytab_entry *entry, void *data) __attribute__((nonnull(1, 2)));
+static int verify_collect(const struct kcron_keytab_entry *entry, void *data) {
+  struct verify_dir *dir = data;
+  const char *at = strrchr(entry->principal, '@');
+
+  for (size_t i = 0; i < dir->nprincipals; i++) {
+    if (strcmp(dir->principals[i].name, entry->principal) == 0) {
+      return 0;
+    }
+  }
+  if ((at == NULL) || (dir->nprincipals == VERIFY_MAX_PRINCIPALS)) {
+    return 0;
+  }
+
+  struct verify_principal *bigger = reallocarray(dir->principals, dir->nprincipals + 1, sizeof(struct verify_principal));
+  if (bigger == NULL) {
+    return 1;
+  }
+  dir->principals = bigger;
+
+  struct verify_principal *p = &dir->principals[dir->nprincipals++];
+  (void)memset(p, 0, sizeof(*p));
+  (void)snprintf(p->name, sizeof(p->name), "%s", entry->principal);
+  return 0;
+}
+
+/*
+ * What a cron job would do with this keytab: an AS exchange, with the
+ * ticket kept in a MEMORY cache that is thrown away straight after.
+ * The keytab is named through /proc/self/fd so libkrb5 reads the file we
+ * opened without following links, not whatever the path points at now.
+ */
+static void verify_principal(krb5_context context, struct verify_job *job, int keytab_fd, struct verify_principal *p) __attribute__((nonnull(1, 2, 4)));
+static void verify_principal(krb5_context context, struct verify_job *job, int keytab_fd, struct verify_principal *p) {
+  krb5_get_init_creds_opt *opt = NULL;
+  krb5_principal client = NULL;
+  krb5_keytab keytab = NULL;
+  krb5_ccache ccache = NULL;
+  krb5_creds creds = {0};
+  krb5_error_code ret = 0;
+  struct timespec start = {0};
+  char keytab_name[64] = {0};
+  char ccache_name[64] = {0};
+
+  (void)snprintf(keytab_name, sizeof(keytab_name), "FILE:/proc/self/fd/%d", keytab_fd);
+  (void)snprintf(ccache_name, sizeof(ccache_name), "MEMORY:kcron-verify-%zu", atomic_fetch_add(&job->serial, 1));
+
+  ret = krb5_parse_name(context, p->name, &client);
+  if (ret == 0) {
+    ret = krb5_kt_resolve(context, keytab_name, &keytab);
+  }
+  if (ret == 0) {
+    ret = krb5_cc_resolve(context, ccache_name, &ccache);
+  }
+  if (ret == 0) {
+    ret = krb5_get_init_creds_opt_alloc(context, &opt);
+  }
+  if (ret == 0) {
+    ret = krb5_get_init_creds_opt_set_out_ccache(context, opt, ccache);
+  }
+  if (ret == 0) {
+    kcron_bucket_take(&job->bucket);
+    (void)clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = krb5_get_init_creds_keytab(context, &creds, client, keytab, 0, NULL, opt);
+    p->seconds = kcron_since(&start);
+  }
+
+  if (ret == 0) {
+    p->ok = 1;
+    (void)krb5_free_cred_contents(context, &creds);
+  } else {
+    const char *message = krb5_get_error_message(context, ret);
+    (void)snprintf(p->message, sizeof(p->message), "%s", message);
+    (void)krb5_free_error_message(context, message);
+  }
+
+  if (opt != NULL) {
+    (void)krb5_get_init_creds_opt_free(context, opt);
+  }
+  if (ccache != NULL) {
+    (void)krb5_cc_destroy(context, ccache);
+  }
+  if (keytab != NULL) {
+    (void)krb5_kt_close(context, keytab);
+  }
+  if (client != NULL) {
+    (void)krb5_free_principal(context, client);
+  }
+}
+
+static void verify_dir(krb5_context context, struct verify_job *job, struct verify_dir *dir) __attribute__((nonnull(1, 2, 3)));
+static void verify_dir(krb5_context context, struct verify_job *job, struct verify_dir *dir) {
+  struct stat st = {0};
+  unsigned char *buf = NULL;
+  size_t len = 0;
+  int dir_fd = -1;
+  int keytab_fd = -1;
+
+  dir_fd = openat(job->top_fd, dir->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if ((dir_fd < 0) || (fstat(dir_fd, &st) != 0)) {
+    dir->error = errno;
+    if (dir_fd >= 0) {
+      (void)close(dir_fd);
+    }
+    return;
+  }
+  if (st.st_uid != dir->uid) {
+    dir->reason = "directory owner does not match its name";
+    (void)close(dir_fd);
+    return;
+  }
+
+  keytab_fd = openat(dir_fd, job->keytab_filename, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+  (void)close(dir_fd);
+  if (keytab_fd < 0) {
+    if (errno != ENOENT) {
+      dir->error = errno;
+    }
+    return;
+  }
+
+  if (kcron_keytab_read(keytab_fd, &buf, &len) != 0) {
+    dir->reason = "keytab is not a regular file of sane size";
+    (void)close(keytab_fd);
+    return;
+  }
+  if (kcron_keytab_parse(buf, len, verify_collect, dir) != 0) {
+    dir->reason = "keytab is damaged, verifying what could be read";
+  }
+  (void)free(buf);
+
+  for (size_t i = 0; i < dir->nprincipals; i++) {
+    verify_principal(context, job, keytab_fd, &dir->principals[i]);
+  }
+  (void)close(keytab_fd);
+}
+
+static void *verify_worker(void *arg) __attribute__((nonnull(1)));
+static void *verify_worker(void *arg) {
+  struct verify_job *job = arg;
+  krb5_context context = NULL;
+
+  /* a krb5_context must not be shared between threads */
+  if (krb5_init_context(&context) != 0) {
+    (void)fprintf(stderr, "%s: unable to initialize Kerberos.\n", __PROGRAM_NAME);
+    return NULL;
+  }
+
+  for (;;) {
+    const size_t i = atomic_fetch_add(&job->next, 1);
+    if (i >= job->ndirs) {
+      break;
+    }
+    verify_dir(context, job, &job->dirs[i]);
+  }
+
+  (void)krb5_free_context(context);
+  return NULL;
+}
+
+/* nearest rank, seconds must be sorted */
+static double verify_percentile(const double *seconds, size_t count, size_t percent) __attribute__((nonnull(1)));
+static double verify_percentile(const double *seconds, size_t count, size_t percent) {
+  size_t rank = (count * percent + 99) / 100;
+  if (count == 0) {
+    return 0;
+  }
+  if (rank == 0) {
+    rank = 1;
+  }
+  return seconds[rank - 1];
+}
+
+/*
+ * One line per realm, over the principals that got a ticket; a failed
+ * exchange says more about the keytab than about the KDC.
+ */
+static void verify_report_realms(const struct verify_job *job, size_t total) __attribute__((nonnull(1)));
+static void verify_report_realms(const struct verify_job *job, size_t total) {
+  double *seconds = calloc(total + 1, sizeof(double));
+  const char **done = calloc(total + 1, sizeof(char *));
+  size_t ndone = 0;
+
+  if ((seconds == NULL) || (done == NULL)) {
+    (void)fprintf(stderr, "%s: unable to allocate memory.\n", __PROGRAM_NAME);
+    (void)free(seconds);
+    (void)free(done);
+    return;
+  }
+
+  (void)printf("%-24s %6s %6s %9s %9s %9s\n", "realm", "ok", "failed", "p50_ms", "p99_ms", "max_ms");
+  for (size_t d = 0; d < job->ndirs; d++) {
+    for (size_t p = 0; p < job->dirs[d].nprincipals; p++) {
+      const char *realm = verify_realm(&job->dirs[d].principals[p]);
+      size_t ok = 0;
+      size_t failed = 0;
+      int seen = 0;
+
+      for (size_t i = 0; i < ndone; i++) {
+        seen |= (strcmp(done[i], realm) == 0);
+      }
+      if (seen) {
+        continue;
+      }
+      done[ndone++] = realm;
+
+      for (size_t dd = d; dd < job->ndirs; dd++) {
+        for (size_t pp = 0; pp < job->dirs[dd].nprincipals; pp++) {
+          const struct verify_principal *other = &job->dirs[dd].principals[pp];
+          if (strcmp(verify_realm(other), realm) != 0) {
+            continue;
+          }
+          if (other->ok) {
+            seconds[ok++] = other->seconds;
+          } else {
+            failed++;
+          }
+        }
+      }
+
+      qsort(seconds, ok, sizeof(double), verify_seconds_cmp);
+      (void)printf("%-24s %6zu %6zu %9.1f %9.1f %9.1f\n", realm, ok, failed, verify_percentile(seconds, ok, 50) * 1e3, verify_percentile(seconds, ok, 99) * 1e3,
+                   (ok > 0) ? seconds[ok - 1] * 1e3 : 0.0);
+    }
+  }
+
+  (void)free(seconds);
+  (void)free(done);
+}
+
+static void usage(void) __attribute__((noreturn));
+static void usage(void) {
+  (void)fprintf(stderr, "Usage: %s [-v] [-j threads] [-r rate] [-u uid] [-d directory]\n", __PROGRAM_NAME);
+  (void)fprintf(stderr, "  Get a ticket with every populated keytab, as its cron jobs would,\n");
+  (void)fprintf(stderr, "  and list the principals that failed:\n");
+  (void)fprintf(stderr, "    uid failed principal error\n");
+  (void)fprintf(stderr, "  followed by ticket latency per realm.  Exits 1 if anything failed.\n");
+  (void)fprintf(stderr, "  -v  also list the principals that worked, with their latency\n");
+  (void)fprintf(stderr, "  -j  threads to use (default %d)\n", VERIFY_DEFAULT_THREADS);
+  (void)fprintf(stderr, "  -r  AS requests per second across all threads, 0 for no limit (default %.0f)\n", VERIFY_DEFAULT_RATE);
+  (void)fprintf(stderr, "  -u  only this uid\n");
+  (void)fprintf(stderr, "  -d  keytab directory (default %s)\n", __CLIENT_KEYTAB_DIR);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+
+  const char *nullstring = NULL;
+  const char *top = __CLIENT_KEYTAB_DIR;
+  struct verify_job job = {.top_fd = -1, .keytab_filename = NULL, .dirs = NULL, .ndirs = 0};
+  pthread_t threads[VERIFY_MAX_THREADS];
+  struct timespec start = {0};
+  size_t size = 0;
+  size_t nthreads = VERIFY_DEFAULT_THREADS;
+  size_t total = 0;
+  size_t failed = 0;
+  double rate = VERIFY_DEFAULT_RATE;
+  uid_t only = 0;
+  int only_set = 0;
+  int verbose = 0;
+  int opt = 0;
+
+  char *keytab = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+  char *keytab_dirname = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+  char *keytab_filename = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+
+  if ((keytab == nullstring) || (keytab_dirname == nullstring) || (keytab_filename == nullstring)) {
+    (void)fprintf(stderr, "%s: unable to allocate memory.\n", __PROGRAM_NAME);
+    exit(EXIT_FAILURE);
+  }
+
+  while ((opt = getopt(argc, argv, "vj:r:u:d:h")) != -1) {
+    switch (opt) {
+    case 'v':
+      verbose = 1;
+      break;
+    case 'j':
+      nthreads = strtoul(optarg, NULL, 10);
+      if ((nthreads == 0) || (nthreads > VERIFY_MAX_THREADS)) {
+        usage();
+      }
+      break;
+    case 'r':
+      rate = strtod(optarg, NULL);
+      if (!(rate >= 0)) {
+        usage();
+      }
+      break;
+    case 'u':
+      if (kcron_parse_uid(optarg, &only) != 0) {
+        usage();
+      }
+      only_set = 1;
+      break;
+    case 'd':
+      top = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+
+  /* only the file name part is wanted, uid 0 is as good as any */
+  if (get_filenames_for_uid(0, keytab_dirname, keytab_filename, keytab) != 0) {
+    exit(EXIT_FAILURE);
+  }
+  job.keytab_filename = keytab_filename;
+
+  job.top_fd = open(top, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (job.top_fd < 0) {
+    (void)fprintf(stderr, "%s: unable to open %s: %s\n", __PROGRAM_NAME, top, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  const struct dirent *de = NULL;
+  DIR *d = NULL;
+  int fd = dup(job.top_fd);
+  uid_t uid = 0;
+
+  if ((fd < 0) || ((d = fdopendir(fd)) == NULL)) {
+    (void)fprintf(stderr, "%s: unable to read %s: %s\n", __PROGRAM_NAME, top, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  while ((de = readdir(d)) != NULL) {
+    if ((kcron_parse_uid(de->d_name, &uid) != 0) || (only_set && (uid != only))) {
+      continue;
+    }
+    if (job.ndirs == size) {
+      const size_t bigger_size = (size == 0) ? 64 : size * 2;
+      struct verify_dir *bigger = reallocarray(job.dirs, bigger_size, sizeof(struct verify_dir));
+      if (bigger == NULL) {
+        (void)fprintf(stderr, "%s: unable to allocate memory.\n", __PROGRAM_NAME);
+        exit(EXIT_FAILURE);
+      }
+      job.dirs = bigger;
+      size = bigger_size;
+    }
+    struct verify_dir *dir = &job.dirs[job.ndirs++];
+    (void)memset(dir, 0, sizeof(*dir));
+    dir->uid = uid;
+    (void)snprintf(dir->name, sizeof(dir->name), "%u", uid);
+  }
+  (void)closedir(d);
+
+  qsort(job.dirs, job.ndirs, sizeof(struct verify_dir), verify_dir_cmp);
+
+  kcron_bucket_init(&job.bucket, rate);
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &start);
+  if (nthreads > job.ndirs) {
+    nthreads = (job.ndirs == 0) ? 1 : job.ndirs;
+  }
+  atomic_init(&job.next, 0);
+  atomic_init(&job.serial, 0);
+  for (size_t i = 0; i < nthreads; i++) {
+    if (pthread_create(&threads[i], NULL, verify_worker, &job) != 0) {
+      (void)fprintf(stderr, "%s: unable to start thread.\n", __PROGRAM_NAME);
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (size_t i = 0; i < nthreads; i++) {
+    (void)pthread_join(threads[i], NULL);
+  }
+  const double elapsed = kcron_since(&start);
+
+  for (size_t i = 0; i < job.ndirs; i++) {
+    const struct verify_dir *dir = &job.dirs[i];
+
+    if (dir->reason != NULL) {
+      (void)fprintf(stderr, "%s: %s/%s: %s\n", __PROGRAM_NAME, top, dir->name, dir->reason);
+    } else if (dir->error != 0) {
+      (void)fprintf(stderr, "%s: %s/%s: %s\n", __PROGRAM_NAME, top, dir->name, strerror(dir->error));
+    }
+    for (size_t p = 0; p < dir->nprincipals; p++) {
+      const struct verify_principal *principal = &dir->principals[p];
+      total++;
+      if (!principal->ok) {
+        failed++;
+        (void)printf("%s failed %s %s\n", dir->name, principal->name, principal->message);
+      } else if (verbose) {
+        (void)printf("%s ok %s %.1fms\n", dir->name, principal->name, principal->seconds * 1e3);
+      }
+    }
+  }
+  if ((failed > 0) || verbose) {
+    (void)printf("\n");
+  }
+  verify_report_realms(&job, total);
+  (void)fflush(stdout);
+
+  (void)fprintf(stderr, "%s: %zu of %zu principals failed, %zu directories, verified in %.3f s, %.1f principals/s\n", __PROGRAM_NAME, failed, total, job.ndirs, elapsed,
+                (elapsed > 0) ? (double)total / elapsed : 0.0);
+
+  kcron_bucket_destroy(&job.bucket);
+  (void)close(job.top_fd);
+  for (size_t i = 0; i < job.ndirs; i++) {
+    (void)free(job.dirs[i].principals);
+  }
+  (void)free(job.dirs);
+  (void)free(keytab);
+  (void)free(keytab_dirname);
+  (void)free(keytab_filename);
+
+  exit((failed > 0) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
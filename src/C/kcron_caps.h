@@ -41,29 +41,115 @@
 #ifndef KCRON_CAPS_H
 #define KCRON_CAPS_H 1
 
+#include "kcron_profile.h"
+
 #if USE_CAPABILITIES == 1
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/capability.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <unistd.h>
+
+#include <linux/capability.h>
+
+/*
+ * We only ever want none, CAP_CHOWN, CAP_DAC_OVERRIDE or both of them
+ * in the effective set.  Read what we were given once with capget and
+ * build all four states up front, so each enable or disable is a single
+ * capset on a table entry: no cap_t to allocate, parse or free.
+ *
+ * The permitted and inheritable sets stay as the kernel gave them to us,
+ * which is what cap_set_proc did when we asked it for caps we already had.
+ */
+#define KCRON_CAP_CHOWN 0x1U
+#define KCRON_CAP_DAC_OVERRIDE 0x2U
+#define KCRON_CAP_STATES 4U
+#define KCRON_CAP_UNKNOWN KCRON_CAP_STATES
+
+static struct __user_cap_header_struct kcron_cap_header = {0};
+static struct __user_cap_data_struct kcron_cap_state[KCRON_CAP_STATES][_LINUX_CAPABILITY_U32S_3] = {0};
+static unsigned int kcron_cap_permitted = 0;
+static unsigned int kcron_cap_current = KCRON_CAP_UNKNOWN;
+static int kcron_cap_ready = 0;
+
+int precompute_capabilities(void) __attribute__((warn_unused_result)) __attribute__((cold));
+int precompute_capabilities(void) {
+  struct __user_cap_data_struct given[_LINUX_CAPABILITY_U32S_3] = {0};
+
+  if (kcron_cap_ready) {
+    return 0;
+  }
+
+  kcron_cap_header.version = _LINUX_CAPABILITY_VERSION_3;
+  kcron_cap_header.pid = 0;
+
+  if (syscall(SYS_capget, &kcron_cap_header, given) != 0) {
+    (void)fprintf(stderr, "%s: Unable to read CAPABILITIES\n", __PROGRAM_NAME);
+    return 1;
+  }
+
+  /* both caps we use live in the first word */
+  if (given[CAP_TO_INDEX(CAP_CHOWN)].permitted & CAP_TO_MASK(CAP_CHOWN)) {
+    kcron_cap_permitted |= KCRON_CAP_CHOWN;
+  }
+  if (given[CAP_TO_INDEX(CAP_DAC_OVERRIDE)].permitted & CAP_TO_MASK(CAP_DAC_OVERRIDE)) {
+    kcron_cap_permitted |= KCRON_CAP_DAC_OVERRIDE;
+  }
+
+  for (unsigned int state = 0; state < KCRON_CAP_STATES; state++) {
+    for (unsigned int i = 0; i < _LINUX_CAPABILITY_U32S_3; i++) {
+      kcron_cap_state[state][i].permitted = given[i].permitted;
+      kcron_cap_state[state][i].inheritable = given[i].inheritable;
+      kcron_cap_state[state][i].effective = 0;
+    }
+    if (state & KCRON_CAP_CHOWN) {
+      kcron_cap_state[state][CAP_TO_INDEX(CAP_CHOWN)].effective |= CAP_TO_MASK(CAP_CHOWN);
+    }
+    if (state & KCRON_CAP_DAC_OVERRIDE) {
+      kcron_cap_state[state][CAP_TO_INDEX(CAP_DAC_OVERRIDE)].effective |= CAP_TO_MASK(CAP_DAC_OVERRIDE);
+    }
+  }
+
+  kcron_cap_ready = 1;
+  return 0;
+}
+
+static int set_capability_state(unsigned int state) __attribute__((warn_unused_result)) __attribute__((hot));
+static int set_capability_state(unsigned int state) {
+  if (state == kcron_cap_current) {
+    /* already there, nothing to ask the kernel */
+    return 0;
+  }
+
+  (void)kcron_profile_cap_toggle();
+  if (syscall(SYS_capset, &kcron_cap_header, kcron_cap_state[state]) != 0) {
+    kcron_cap_current = KCRON_CAP_UNKNOWN;
+    return 1;
+  }
+
+  kcron_cap_current = state;
+  return 0;
+}
 
 int disable_capabilities(void) __attribute__((flatten)) __attribute__((hot));
 int disable_capabilities(void) {
-  cap_t capabilities = cap_get_proc();
+  if (precompute_capabilities() != 0) {
+    exit(EXIT_FAILURE);
+  }
 
-  if (cap_clear(capabilities)) {
+  if (set_capability_state(0) != 0) {
     /* error */
-    (void)cap_free(capabilities);
     (void)fprintf(stderr, "%s: Unable to clear CAPABILITIES\n", __PROGRAM_NAME);
     exit(EXIT_FAILURE);
   }
 
-  (void)cap_free(capabilities);
   return 0;
 }
 
-static void print_cap_error(const char *mode, const cap_value_t expected_cap[], const int num_caps) __attribute__((nonnull(1))) __attribute__((access(read_only, 1))) __attribute__((flatten));
+static void print_cap_error(const char *mode, const cap_value_t expected_cap[], const int num_caps) __attribute__((nonnull(1))) __attribute__((access(read_only, 1))) __attribute__((cold));
 static void print_cap_error(const char *mode, const cap_value_t expected_cap[], const int num_caps) {
   (void)fprintf(stderr, "%s: Unable to set CAPABILITIES %s\n", __PROGRAM_NAME, mode);
   (void)fprintf(stderr, "%s: Requested CAPABILITIES %s %i:\n", __PROGRAM_NAME, mode, num_caps);
@@ -74,42 +160,47 @@ static void print_cap_error(const char *mode, const cap_value_t expected_cap[],
 
 int enable_capabilities(const cap_value_t expected_cap[], const int num_caps) __attribute__((nonnull(1))) __attribute__((warn_unused_result)) __attribute__((flatten)) __attribute__((hot)) __attribute__((access(read_only, 1)));
 int enable_capabilities(const cap_value_t expected_cap[], const int num_caps) {
-  cap_t capabilities = cap_get_proc();
+  unsigned int state = 0;
 
-  /* clear any active capabilities */
-  if (disable_capabilities() != 0) {
-    (void)cap_free(capabilities);
+  if (precompute_capabilities() != 0) {
     exit(EXIT_FAILURE);
   }
 
-  if (cap_set_flag(capabilities, CAP_PERMITTED, num_caps, expected_cap, CAP_SET) == -1) {
-    (void)cap_free(capabilities);
-    /* error */
-    (void)print_cap_error("PERMITTED", expected_cap, num_caps);
-    exit(EXIT_FAILURE);
+  for (int i = 0; i < num_caps; i++) {
+    if (expected_cap[i] == CAP_CHOWN) {
+      state |= KCRON_CAP_CHOWN;
+    } else if (expected_cap[i] == CAP_DAC_OVERRIDE) {
+      state |= KCRON_CAP_DAC_OVERRIDE;
+    } else {
+      /* error, not one of the states we built */
+      (void)print_cap_error("ACTIVE", expected_cap, num_caps);
+      exit(EXIT_FAILURE);
+    }
   }
 
-  if (cap_set_flag(capabilities, CAP_EFFECTIVE, num_caps, expected_cap, CAP_SET) == -1) {
-    (void)cap_free(capabilities);
+  if ((state & kcron_cap_permitted) != state) {
     /* error */
-    (void)print_cap_error("ACTIVE", expected_cap, num_caps);
+    (void)print_cap_error("PERMITTED", expected_cap, num_caps);
     exit(EXIT_FAILURE);
   }
 
-  if (cap_set_proc(capabilities) == -1) {
-    (void)cap_free(capabilities);
+  if (set_capability_state(state) != 0) {
     /* error */
     (void)print_cap_error("ACTIVE", expected_cap, num_caps);
     exit(EXIT_FAILURE);
   }
 
-  (void)cap_free(capabilities);
   return 0;
 }
 #else
 typedef int cap_value_t; /* so prototypes stay identical */
 
 /* If not caps, just return 0 */
+int precompute_capabilities(void) __attribute__((warn_unused_result));
+int precompute_capabilities(void) {
+  return 0;
+}
+
 int disable_capabilities(void) __attribute__((warn_unused_result)) __attribute__((flatten));
 int disable_capabilities(void) {
   return 0;
@@ -117,6 +208,8 @@ int disable_capabilities(void) {
 
 int enable_capabilities(const cap_value_t expected_cap[], const int num_caps) __attribute__((nonnull(1))) __attribute__((warn_unused_result)) __attribute__((flatten)) __attribute__((access(read_only, 1))) __attribute__((access(read_only, 2)));
 int enable_capabilities(const cap_value_t expected_cap[], const int num_caps) {
+  (void)expected_cap;
+  (void)num_caps;
   return 0;
 }
 #endif
@@ -49,7 +49,7 @@ int write_empty_keytab(int filedescriptor) {
 
   if (filedescriptor == 0) {
     (void)fprintf(stderr, "%s: no keytab file specified.\n", __PROGRAM_NAME);
-    exit(EXIT_FAILURE);
+    return 1;
   }
 
   /* This magic string makes ktutil and kadmin happy with an empty file */
@@ -58,11 +58,11 @@ int write_empty_keytab(int filedescriptor) {
 
   if (write(filedescriptor, &emptykeytab_a, sizeof(emptykeytab_a)) != sizeof(emptykeytab_a)) {
     (void)fprintf(stderr, "%s: could not write initial block to keytab.\n", __PROGRAM_NAME);
-    exit(EXIT_FAILURE);
+    return 1;
   }
   if (write(filedescriptor, &emptykeytab_b, sizeof(emptykeytab_b)) != sizeof(emptykeytab_b)) {
     (void)fprintf(stderr, "%s: could not write initial blocks to keytab.\n", __PROGRAM_NAME);
-    exit(EXIT_FAILURE);
+    return 1;
   }
 
   (void)fsync(filedescriptor);
@@ -41,8 +41,11 @@
 #ifndef KCRON_FILENAME_H
 #define KCRON_FILENAME_H 1
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
 #include <unistd.h>
 
 int get_client_dirname(char *keytab_dir) __attribute__((nonnull(1))) __attribute__((access(read_write, 1))) __attribute__((warn_unused_result)) __attribute__((flatten));
@@ -60,11 +63,9 @@ int get_client_dirname(char *keytab_dir) {
   return 0;
 }
 
-int get_filenames(char *keytab_dir, char *keytab_filename, char *keytab) __attribute__((nonnull(1, 2, 3))) __attribute__((access(read_only, 1)))
-__attribute((access(read_only, 2))) __attribute((access(read_write, 3))) __attribute__((warn_unused_result)) __attribute__((flatten));
-int get_filenames(char *keytab_dir, char *keytab_filename, char *keytab) {
-
-  const uid_t uid = getuid();
+int get_filenames_for_uid(uid_t uid, char *keytab_dir, char *keytab_filename, char *keytab) __attribute__((nonnull(2, 3, 4))) __attribute__((access(read_write, 2)))
+__attribute((access(read_write, 3))) __attribute((access(read_write, 4))) __attribute__((warn_unused_result)) __attribute__((flatten));
+int get_filenames_for_uid(uid_t uid, char *keytab_dir, char *keytab_filename, char *keytab) {
 
   const char *nullpointer = NULL;
 
@@ -73,16 +74,17 @@ int get_filenames(char *keytab_dir, char *keytab_filename, char *keytab) {
 
   if (uid_str == nullpointer) {
     (void)fprintf(stderr, "%s: unable to allocate memory.\n", __PROGRAM_NAME);
-    exit(EXIT_FAILURE);
+    return 1;
   }
 
   if ((keytab == nullpointer) || (keytab_dir == nullpointer) || (keytab_filename == nullpointer)) {
     (void)fprintf(stderr, "%s: invalid memory passed in.\n", __PROGRAM_NAME);
-    exit(EXIT_FAILURE);
+    (void)free(uid_str);
+    return 1;
   }
 
   /* safely copy the uid from the system into a string */
-  (void)snprintf(uid_str, USERNAME_MAX_LENGTH, "%d", uid);
+  (void)snprintf(uid_str, USERNAME_MAX_LENGTH, "%u", uid);
 
   /* build our filename variables */
   (void)snprintf(keytab_filename, FILE_PATH_MAX_LENGTH, "client.keytab");
@@ -93,4 +95,39 @@ int get_filenames(char *keytab_dir, char *keytab_filename, char *keytab) {
 
   return 0;
 }
+
+/*
+ * The other way round, for tools walking CLIENT_KEYTAB_DIR: a uid
+ * directory name is plain decimal digits and never the (uid_t)-1 of
+ * "no uid".  Returns 1 for anything else.
+ */
+int kcron_parse_uid(const char *name, uid_t *uid) __attribute__((nonnull(1, 2))) __attribute__((warn_unused_result));
+int kcron_parse_uid(const char *name, uid_t *uid) {
+  char *end = NULL;
+  unsigned long value = 0;
+
+  if ((name[0] < '0') || (name[0] > '9') || (strlen(name) > 10)) {
+    return 1;
+  }
+  errno = 0;
+  value = strtoul(name, &end, 10);
+  if ((errno != 0) || (*end != '\0') || (value > (uid_t)-2)) {
+    return 1;
+  }
+  *uid = (uid_t)value;
+  return 0;
+}
+
+int get_filenames(char *keytab_dir, char *keytab_filename, char *keytab) __attribute__((nonnull(1, 2, 3))) __attribute__((access(read_only, 1)))
+__attribute((access(read_only, 2))) __attribute((access(read_write, 3))) __attribute__((warn_unused_result)) __attribute__((flatten));
+int get_filenames(char *keytab_dir, char *keytab_filename, char *keytab) {
+
+  const uid_t uid = getuid();
+
+  if (get_filenames_for_uid(uid, keytab_dir, keytab_filename, keytab) != 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  return 0;
+}
 #endif
@@ -0,0 +1,455 @@
+/*
+ *
+ * Fixed record index of keytab state per uid
+ * Updated one record at a time, read through mmap without locking
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef KCRON_INDEX_H
+#define KCRON_INDEX_H 1
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kcron_keytab_parse.h"
+
+/*
+ * The index lives in CLIENT_KEYTAB_DIR.  It is a header record followed by
+ * an open addressed table of fixed size records keyed by uid.  Records are
+ * never moved or removed, so a writer only ever rewrites one record in
+ * place with a single pwrite.  Readers map the file and check each record's
+ * checksum instead of taking the lock.
+ */
+#define KCRON_INDEX_FILENAME ".kcron-index"
+#define KCRON_INDEX_MAGIC 0x3158434bU /* "KCX1" */
+#define KCRON_INDEX_VERSION 1U
+#define KCRON_INDEX_SLOT_BITS 17U
+#define KCRON_INDEX_SLOTS (1U << KCRON_INDEX_SLOT_BITS)
+#define KCRON_INDEX_RECORD_BYTES 32U
+#define KCRON_INDEX_BYTES ((off_t)(KCRON_INDEX_SLOTS + 1U) * (off_t)KCRON_INDEX_RECORD_BYTES)
+/* where init-kcron-keytab keeps the index, its seccomp rules expect it */
+#define KCRON_INDEX_FD 5
+#define KCRON_INDEX_READ_RETRIES 8
+
+#ifndef _0644
+#define _0644 S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH
+#endif
+
+enum kcron_index_state {
+  KCRON_INDEX_FREE = 0,      /* slot never used                         */
+  KCRON_INDEX_MISSING = 1,   /* no keytab any more                      */
+  KCRON_INDEX_EMPTY = 2,     /* keytab without keys                     */
+  KCRON_INDEX_POPULATED = 3, /* keytab with at least one key            */
+};
+
+struct kcron_index_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slots;
+  uint32_t record_bytes;
+  uint32_t reserved[3];
+  uint32_t checksum;
+};
+
+struct kcron_index_record {
+  uint32_t uid;
+  uint8_t state;
+  uint8_t reserved[3];
+  uint32_t kvno;           /* of the cron principal, or the first one   */
+  uint32_t principal_hash; /* FNV-1a of that principal, 0 when empty    */
+  int64_t mtime;           /* of client.keytab                          */
+  uint32_t entries;        /* keys in the keytab                        */
+  uint32_t checksum;
+};
+
+_Static_assert(sizeof(struct kcron_index_header) == KCRON_INDEX_RECORD_BYTES, "index header must be one record");
+_Static_assert(sizeof(struct kcron_index_record) == KCRON_INDEX_RECORD_BYTES, "index records must be 32 bytes");
+
+struct kcron_index_map {
+  const unsigned char *base;
+  size_t len;
+  uint32_t slots;
+};
+
+static uint32_t kcron_index_fnv1a(const void *data, size_t len) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+static uint32_t kcron_index_fnv1a(const void *data, size_t len) {
+  const unsigned char *p = data;
+  uint32_t hash = 2166136261U;
+  size_t i = 0;
+
+  for (i = 0; i < len; i++) {
+    hash ^= p[i];
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+/* Everything ahead of the checksum field, the same for both layouts */
+static uint32_t kcron_index_checksum(const void *record) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+static uint32_t kcron_index_checksum(const void *record) { return kcron_index_fnv1a(record, KCRON_INDEX_RECORD_BYTES - sizeof(uint32_t)); }
+
+uint32_t kcron_index_hash_principal(const char *principal) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+uint32_t kcron_index_hash_principal(const char *principal) { return kcron_index_fnv1a(principal, strlen(principal)); }
+
+static uint32_t kcron_index_home_slot(uint32_t uid) __attribute__((warn_unused_result));
+static uint32_t kcron_index_home_slot(uint32_t uid) { return (uint32_t)(uid * 2654435761U) >> (32U - KCRON_INDEX_SLOT_BITS); }
+
+static off_t kcron_index_offset(uint32_t slot) __attribute__((warn_unused_result));
+static off_t kcron_index_offset(uint32_t slot) { return (off_t)(slot + 1U) * (off_t)KCRON_INDEX_RECORD_BYTES; }
+
+/*
+ * Keytab summary
+ */
+struct kcron_index_scan {
+  int cron_found;
+  uint32_t entries;
+  uint32_t kvno;
+  char principal[KCRON_PRINCIPAL_MAX_LENGTH];
+};
+
+static int kcron_index_scan_entry(const struct kcron_keytab_entry *entry, void *data) __attribute__((nonnull(1, 2)));
+static int kcron_index_scan_entry(const struct kcron_keytab_entry *entry, void *data) {
+  struct kcron_index_scan *scan = data;
+  const int is_cron = (strstr(entry->principal, "/cron/") != NULL);
+
+  scan->entries++;
+
+  /* the cron principal wins over anything else, then the newest key */
+  if ((scan->entries == 1) || (is_cron && !scan->cron_found)) {
+    (void)snprintf(scan->principal, sizeof(scan->principal), "%s", entry->principal);
+    scan->kvno = entry->kvno;
+    scan->cron_found = is_cron;
+  } else if ((strcmp(scan->principal, entry->principal) == 0) && (entry->kvno > scan->kvno)) {
+    scan->kvno = entry->kvno;
+  }
+  return 0;
+}
+
+/*
+ * Fill in state, kvno, principal_hash, mtime and entries from an open
+ * keytab.  The uid is left to the caller.
+ */
+int kcron_index_summarize(int keytab_fd, struct kcron_index_record *record) __attribute__((nonnull(2))) __attribute__((warn_unused_result));
+int kcron_index_summarize(int keytab_fd, struct kcron_index_record *record) {
+
+  struct kcron_index_scan *scan = NULL;
+  struct stat st = {0};
+  unsigned char *buf = NULL;
+  size_t len = 0;
+
+  if (fstat(keytab_fd, &st) != 0) {
+    return 1;
+  }
+  record->mtime = (int64_t)st.st_mtime;
+  record->state = KCRON_INDEX_EMPTY;
+  record->kvno = 0;
+  record->principal_hash = 0;
+  record->entries = 0;
+
+  if (kcron_keytab_read(keytab_fd, &buf, &len) != 0) {
+    return 1;
+  }
+
+  scan = calloc(1, sizeof(struct kcron_index_scan));
+  if (scan == NULL) {
+    (void)free(buf);
+    return 1;
+  }
+
+  /* a file we cannot parse holds no usable keys */
+  if (kcron_keytab_parse(buf, len, kcron_index_scan_entry, scan) != 0) {
+    scan->entries = 0;
+  }
+  if (scan->entries > 0) {
+    record->state = KCRON_INDEX_POPULATED;
+    record->kvno = scan->kvno;
+    record->principal_hash = kcron_index_hash_principal(scan->principal);
+    record->entries = scan->entries;
+  }
+
+  (void)free(scan);
+  (void)free(buf);
+  return 0;
+}
+
+/*
+ * Writers
+ */
+
+/*
+ * Open the index for writing with an exclusive lock held, creating it if
+ * needed.  want_fd >= 0 moves it to that descriptor.  Without wait a lock
+ * held by someone else fails with EWOULDBLOCK instead of blocking.  If the
+ * file was replaced by a rebuild while we waited for the lock, open the
+ * new one.  Returns the fd or -1.
+ */
+int kcron_index_open(const char *path, int want_fd, int wait) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+int kcron_index_open(const char *path, int want_fd, int wait) {
+
+  struct stat by_fd = {0};
+  struct stat by_path = {0};
+  int fd = -1;
+  int tries = 0;
+
+  for (tries = 0; tries < 3; tries++) {
+    fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, _0644);
+    if (fd < 0) {
+      return -1;
+    }
+    if ((want_fd >= 0) && (fd != want_fd)) {
+      const int moved = fcntl(fd, F_DUPFD_CLOEXEC, want_fd);
+      (void)close(fd);
+      if (moved != want_fd) {
+        if (moved >= 0) {
+          (void)close(moved);
+        }
+        return -1;
+      }
+      fd = moved;
+    }
+
+    if ((flock(fd, wait ? LOCK_EX : (LOCK_EX | LOCK_NB)) != 0) || (fstat(fd, &by_fd) != 0) || (!S_ISREG(by_fd.st_mode))) {
+      (void)close(fd);
+      return -1;
+    }
+    if ((stat(path, &by_path) == 0) && (by_path.st_ino == by_fd.st_ino) && (by_path.st_dev == by_fd.st_dev)) {
+      return fd;
+    }
+    (void)close(fd);
+  }
+  return -1;
+}
+
+/*
+ * Size and stamp a new or foreign file, keep a valid one as it is.
+ * Readers may have the file mapped without the lock, so it only ever
+ * grows: shrinking it under them would turn their next read into SIGBUS.
+ */
+static int kcron_index_prepare(int fd) __attribute__((warn_unused_result));
+static int kcron_index_prepare(int fd) {
+  static const unsigned char zeros[4096] = {0};
+  struct kcron_index_header header = {0};
+  struct stat st = {0};
+  off_t offset = 0;
+
+  if ((pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header)) && (header.magic == KCRON_INDEX_MAGIC) && (header.version == KCRON_INDEX_VERSION) &&
+      (header.slots == KCRON_INDEX_SLOTS) && (header.record_bytes == KCRON_INDEX_RECORD_BYTES) && (header.checksum == kcron_index_checksum(&header))) {
+    return 0;
+  }
+
+  if (fstat(fd, &st) != 0) {
+    return 1;
+  }
+
+  /* clear what is already there so every slot starts out free, growing zero fills the rest */
+  for (offset = 0; (offset < st.st_size) && (offset < KCRON_INDEX_BYTES); offset += (off_t)sizeof(zeros)) {
+    const size_t len = (KCRON_INDEX_BYTES - offset < (off_t)sizeof(zeros)) ? (size_t)(KCRON_INDEX_BYTES - offset) : sizeof(zeros);
+    if (pwrite(fd, zeros, len, offset) != (ssize_t)len) {
+      return 1;
+    }
+  }
+  if ((st.st_size < KCRON_INDEX_BYTES) && (ftruncate(fd, KCRON_INDEX_BYTES) != 0)) {
+    return 1;
+  }
+
+  (void)memset(&header, 0, sizeof(header));
+  header.magic = KCRON_INDEX_MAGIC;
+  header.version = KCRON_INDEX_VERSION;
+  header.slots = KCRON_INDEX_SLOTS;
+  header.record_bytes = KCRON_INDEX_RECORD_BYTES;
+  header.checksum = kcron_index_checksum(&header);
+  if (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+    return 1;
+  }
+  /* the header and table are world readable whatever the umask */
+  return fchmod(fd, _0644);
+}
+
+/*
+ * Store record in the index open on fd (from kcron_index_open).  Linear
+ * probing from the uid's home slot, one pwrite for the record itself.
+ */
+int kcron_index_store(int fd, struct kcron_index_record *record) __attribute__((nonnull(2))) __attribute__((warn_unused_result));
+int kcron_index_store(int fd, struct kcron_index_record *record) {
+
+  struct kcron_index_record slot_record = {0};
+  const uint32_t home = kcron_index_home_slot(record->uid);
+  uint32_t i = 0;
+
+  if (kcron_index_prepare(fd) != 0) {
+    return 1;
+  }
+
+  (void)memset(record->reserved, 0, sizeof(record->reserved));
+  record->checksum = kcron_index_checksum(record);
+
+  for (i = 0; i < KCRON_INDEX_SLOTS; i++) {
+    const uint32_t slot = (home + i) & (KCRON_INDEX_SLOTS - 1U);
+
+    if (pread(fd, &slot_record, sizeof(slot_record), kcron_index_offset(slot)) != (ssize_t)sizeof(slot_record)) {
+      return 1;
+    }
+    if ((slot_record.state == KCRON_INDEX_FREE) || (slot_record.uid == record->uid)) {
+      if (pwrite(fd, record, sizeof(*record), kcron_index_offset(slot)) != (ssize_t)sizeof(*record)) {
+        return 1;
+      }
+      return 0;
+    }
+  }
+
+  /* table full */
+  errno = ENOSPC;
+  return 1;
+}
+
+/*
+ * Readers
+ */
+int kcron_index_map_open(const char *path, struct kcron_index_map *map) __attribute__((nonnull(1, 2))) __attribute__((warn_unused_result));
+int kcron_index_map_open(const char *path, struct kcron_index_map *map) {
+
+  struct kcron_index_header header = {0};
+  struct stat st = {0};
+  void *base = NULL;
+  const int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+
+  (void)memset(map, 0, sizeof(*map));
+  if (fd < 0) {
+    return 1;
+  }
+  if ((fstat(fd, &st) != 0) || (!S_ISREG(st.st_mode)) || (st.st_size < KCRON_INDEX_BYTES)) {
+    (void)close(fd);
+    errno = EINVAL;
+    return 1;
+  }
+
+  base = mmap(NULL, (size_t)KCRON_INDEX_BYTES, PROT_READ, MAP_SHARED, fd, 0);
+  (void)close(fd);
+  if (base == MAP_FAILED) {
+    return 1;
+  }
+
+  (void)memcpy(&header, base, sizeof(header));
+  if ((header.magic != KCRON_INDEX_MAGIC) || (header.version != KCRON_INDEX_VERSION) || (header.slots != KCRON_INDEX_SLOTS) ||
+      (header.record_bytes != KCRON_INDEX_RECORD_BYTES) || (header.checksum != kcron_index_checksum(&header))) {
+    (void)munmap(base, (size_t)KCRON_INDEX_BYTES);
+    errno = EINVAL;
+    return 1;
+  }
+
+  map->base = base;
+  map->len = (size_t)KCRON_INDEX_BYTES;
+  map->slots = header.slots;
+  return 0;
+}
+
+void kcron_index_map_close(struct kcron_index_map *map) __attribute__((nonnull(1)));
+void kcron_index_map_close(struct kcron_index_map *map) {
+  if (map->base != NULL) {
+    (void)munmap((void *)map->base, map->len);
+  }
+  (void)memset(map, 0, sizeof(*map));
+}
+
+/*
+ * Copy out one slot.  A writer may be halfway through the same record, so
+ * a bad checksum is retried a few times before giving up on it.
+ * Returns 0 for a record, 1 for a free slot, -1 if it never settled.
+ */
+int kcron_index_map_record(const struct kcron_index_map *map, uint32_t slot, struct kcron_index_record *record) __attribute__((nonnull(1, 3))) __attribute__((warn_unused_result));
+int kcron_index_map_record(const struct kcron_index_map *map, uint32_t slot, struct kcron_index_record *record) {
+
+  const unsigned char *src = map->base + kcron_index_offset(slot);
+  int tries = 0;
+
+  for (tries = 0; tries < KCRON_INDEX_READ_RETRIES; tries++) {
+    (void)memcpy(record, src, sizeof(*record));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (record->state == KCRON_INDEX_FREE) {
+      return 1;
+    }
+    if (record->checksum == kcron_index_checksum(record)) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/* Returns 0 and fills record if uid is in the index, 1 if not, -1 on a torn record */
+int kcron_index_lookup(const struct kcron_index_map *map, uint32_t uid, struct kcron_index_record *record) __attribute__((nonnull(1, 3))) __attribute__((warn_unused_result));
+int kcron_index_lookup(const struct kcron_index_map *map, uint32_t uid, struct kcron_index_record *record) {
+
+  const uint32_t home = kcron_index_home_slot(uid);
+  uint32_t i = 0;
+
+  for (i = 0; i < map->slots; i++) {
+    const int rc = kcron_index_map_record(map, (home + i) & (map->slots - 1U), record);
+    if (rc == 1) {
+      return 1;
+    }
+    if ((rc == 0) && (record->uid == uid)) {
+      return 0;
+    }
+    if (rc < 0) {
+      /* cannot tell whose record this was, keep probing */
+      continue;
+    }
+  }
+  return 1;
+}
+
+const char *kcron_index_state_name(uint8_t state) __attribute__((warn_unused_result));
+const char *kcron_index_state_name(uint8_t state) {
+  switch (state) {
+  case KCRON_INDEX_MISSING:
+    return "missing";
+  case KCRON_INDEX_EMPTY:
+    return "empty";
+  case KCRON_INDEX_POPULATED:
+    return "populated";
+  default:
+    return "free";
+  }
+}
+
+#endif
@@ -0,0 +1,228 @@
+/*
+ *
+ * Minimal reader for the MIT keytab file format
+ * Only what the admin tools need to report principals and key versions
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef KCRON_KEYTAB_PARSE_H
+#define KCRON_KEYTAB_PARSE_H 1
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* A cron keytab holds a handful of entries, anything bigger is not ours */
+#define KCRON_KEYTAB_MAX_BYTES (1024 * 1024)
+#define KCRON_PRINCIPAL_MAX_LENGTH 1024
+
+struct kcron_keytab_entry {
+  char principal[KCRON_PRINCIPAL_MAX_LENGTH];
+  uint32_t timestamp;
+  uint32_t kvno;
+  int32_t enctype;
+};
+
+typedef int (*kcron_keytab_entry_fn)(const struct kcron_keytab_entry *entry, void *data);
+
+static uint32_t kcron_keytab_be32(const unsigned char *p) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+static uint32_t kcron_keytab_be32(const unsigned char *p) { return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3]; }
+
+static uint16_t kcron_keytab_be16(const unsigned char *p) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+static uint16_t kcron_keytab_be16(const unsigned char *p) { return (uint16_t)(((unsigned)p[0] << 8) | (unsigned)p[1]); }
+
+/*
+ * Walk the entries of a version 0x0502 keytab (the only one MIT writes)
+ * calling fn for each.  Holes left by ktremove are skipped.  fn returning
+ * non-zero stops the walk and is passed back.  Returns 1 if the buffer is
+ * not a keytab or an entry runs past its record.
+ */
+int kcron_keytab_parse(const unsigned char *buf, size_t len, kcron_keytab_entry_fn fn, void *data) __attribute__((nonnull(1, 3))) __attribute__((warn_unused_result));
+int kcron_keytab_parse(const unsigned char *buf, size_t len, kcron_keytab_entry_fn fn, void *data) {
+
+  struct kcron_keytab_entry entry;
+  size_t pos = 2;
+
+  if ((len < 2) || (buf[0] != 0x05) || (buf[1] != 0x02)) {
+    return 1;
+  }
+
+  while (pos + 4 <= len) {
+    const int32_t size = (int32_t)kcron_keytab_be32(buf + pos);
+    pos += 4;
+
+    if (size == 0) {
+      break;
+    }
+    if (size < 0) {
+      /* a deleted entry, its bytes are still there */
+      if ((size_t)(-(int64_t)size) > len - pos) {
+        return 1;
+      }
+      pos += (size_t)(-(int64_t)size);
+      continue;
+    }
+    if ((size_t)size > len - pos) {
+      return 1;
+    }
+
+    const unsigned char *p = buf + pos;
+    const unsigned char *end = p + size;
+    size_t used = 0;
+    uint16_t components = 0;
+    uint16_t n = 0;
+    int ret = 0;
+
+    (void)memset(&entry, 0, sizeof(entry));
+
+    if (end - p < 4) {
+      return 1;
+    }
+    components = kcron_keytab_be16(p);
+    n = kcron_keytab_be16(p + 2);
+    p += 4;
+    if (end - p < n) {
+      return 1;
+    }
+    const unsigned char *realm = p;
+    const uint16_t realm_len = n;
+    p += n;
+
+    for (uint16_t i = 0; i < components; i++) {
+      if (end - p < 2) {
+        return 1;
+      }
+      n = kcron_keytab_be16(p);
+      p += 2;
+      if ((end - p < n) || (used + n + 2 >= sizeof(entry.principal))) {
+        return 1;
+      }
+      if (i > 0) {
+        entry.principal[used++] = '/';
+      }
+      (void)memcpy(entry.principal + used, p, n);
+      used += n;
+      p += n;
+    }
+    if (used + realm_len + 2 >= sizeof(entry.principal)) {
+      return 1;
+    }
+    entry.principal[used++] = '@';
+    (void)memcpy(entry.principal + used, realm, realm_len);
+    used += realm_len;
+    entry.principal[used] = '\0';
+
+    /* name type, timestamp, 8 bit kvno, enctype, key length */
+    if (end - p < 4 + 4 + 1 + 2 + 2) {
+      return 1;
+    }
+    entry.timestamp = kcron_keytab_be32(p + 4);
+    entry.kvno = p[8];
+    entry.enctype = (int32_t)kcron_keytab_be16(p + 9);
+    n = kcron_keytab_be16(p + 11);
+    p += 13;
+    if (end - p < n) {
+      return 1;
+    }
+    p += n;
+
+    /* newer writers append the full 32 bit kvno */
+    if ((end - p >= 4) && (kcron_keytab_be32(p) != 0)) {
+      entry.kvno = kcron_keytab_be32(p);
+    }
+
+    ret = fn(&entry, data);
+    if (ret != 0) {
+      return ret;
+    }
+
+    pos += (size_t)size;
+  }
+
+  return 0;
+}
+
+/*
+ * Read a whole keytab from an already opened fd.  The caller frees *buf.
+ */
+int kcron_keytab_read(int fd, unsigned char **buf, size_t *len) __attribute__((nonnull(2, 3))) __attribute__((warn_unused_result));
+int kcron_keytab_read(int fd, unsigned char **buf, size_t *len) {
+
+  const unsigned char *nullstring = NULL;
+  struct stat st = {0};
+  size_t got = 0;
+
+  *buf = NULL;
+  *len = 0;
+
+  if (fstat(fd, &st) != 0) {
+    return 1;
+  }
+  if ((!S_ISREG(st.st_mode)) || (st.st_size > KCRON_KEYTAB_MAX_BYTES)) {
+    errno = EINVAL;
+    return 1;
+  }
+
+  *buf = calloc((size_t)st.st_size + 1, sizeof(unsigned char));
+  if (*buf == nullstring) {
+    return 1;
+  }
+
+  while (got < (size_t)st.st_size) {
+    const ssize_t r = read(fd, *buf + got, (size_t)st.st_size - got);
+    if (r < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      (void)free(*buf);
+      *buf = NULL;
+      return 1;
+    }
+    if (r == 0) {
+      break;
+    }
+    got += (size_t)r;
+  }
+
+  *len = got;
+  return 0;
+}
+
+#endif
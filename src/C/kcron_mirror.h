@@ -0,0 +1,219 @@
+/*
+ *
+ * Local copies of keytabs kept on shared storage
+ * Validated against the shared keytab before they are handed out
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef KCRON_MIRROR_H
+#define KCRON_MIRROR_H 1
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kcron_filename.h"
+
+/*
+ * Where CLIENT_KEYTAB_DIR is on shared storage, kcron-mirror keeps a copy
+ * of each in-use keytab in MIRROR_KEYTAB_DIR, normally a tmpfs:
+ *
+ *   <mirror>/<uid>/                        root, 0755
+ *   <mirror>/<uid>/client.keytab           uid, 0600
+ *   <mirror>/<uid>/client.keytab.source    root, 0644
+ *
+ * The .source sidecar says what the shared keytab looked like when it was
+ * copied.  Readers pay one stat of the shared keytab to check it still
+ * looks that way: kcroninit may have re-keyed it from another NFS client,
+ * which no local watch can see.  Anything that does not check out sends
+ * the reader back to the shared keytab.
+ */
+#define KCRON_MIRROR_SOURCE_SUFFIX ".source"
+#define KCRON_MIRROR_MAGIC 0x314d434bU /* "KCM1" */
+
+#ifndef _0600
+#define _0600 S_IRUSR | S_IWUSR
+#endif
+
+struct kcron_mirror_source {
+  uint32_t magic;
+  uint32_t uid;
+  uint32_t gid;
+  uint32_t mode;
+  uint64_t dev;
+  uint64_t ino;
+  int64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  int64_t ctime_sec;
+  int64_t ctime_nsec;
+};
+
+void kcron_mirror_describe(const struct stat *st, struct kcron_mirror_source *source) __attribute__((nonnull(1, 2)));
+void kcron_mirror_describe(const struct stat *st, struct kcron_mirror_source *source) {
+  (void)memset(source, 0, sizeof(*source));
+  source->magic = KCRON_MIRROR_MAGIC;
+  source->uid = (uint32_t)st->st_uid;
+  source->gid = (uint32_t)st->st_gid;
+  source->mode = (uint32_t)st->st_mode;
+  source->dev = (uint64_t)st->st_dev;
+  source->ino = (uint64_t)st->st_ino;
+  source->size = (int64_t)st->st_size;
+  source->mtime_sec = (int64_t)st->st_mtim.tv_sec;
+  source->mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+  source->ctime_sec = (int64_t)st->st_ctim.tv_sec;
+  source->ctime_nsec = (int64_t)st->st_ctim.tv_nsec;
+}
+
+/* Did the shared keytab stay exactly as it was when the copy was taken? */
+int kcron_mirror_matches(const struct stat *st, const struct kcron_mirror_source *source) __attribute__((nonnull(1, 2))) __attribute__((warn_unused_result));
+int kcron_mirror_matches(const struct stat *st, const struct kcron_mirror_source *source) {
+  struct kcron_mirror_source now;
+
+  kcron_mirror_describe(st, &now);
+  return memcmp(&now, source, sizeof(now)) == 0;
+}
+
+int kcron_mirror_dirname(uid_t uid, char *mirror_dir) __attribute__((nonnull(2))) __attribute__((access(read_write, 2))) __attribute__((warn_unused_result));
+int kcron_mirror_dirname(uid_t uid, char *mirror_dir) {
+  const int len = snprintf(mirror_dir, FILE_PATH_MAX_LENGTH, "%s/%u", __MIRROR_KEYTAB_DIR, uid);
+  return ((len < 0) || (len >= FILE_PATH_MAX_LENGTH)) ? 1 : 0;
+}
+
+/*
+ * Read the sidecar of an open mirror directory.  Only root may have
+ * written it, and it must describe a keytab belonging to uid.
+ */
+int kcron_mirror_read_source(int dir_fd, const char *keytab_filename, uid_t uid, struct kcron_mirror_source *source, struct stat *sidecar)
+    __attribute__((nonnull(2, 4, 5))) __attribute__((warn_unused_result));
+int kcron_mirror_read_source(int dir_fd, const char *keytab_filename, uid_t uid, struct kcron_mirror_source *source, struct stat *sidecar) {
+  char name[256] = {0};
+  int fd = -1;
+  ssize_t got = 0;
+
+  (void)snprintf(name, sizeof(name), "%s%s", keytab_filename, KCRON_MIRROR_SOURCE_SUFFIX);
+
+  fd = openat(dir_fd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    return 1;
+  }
+  if ((fstat(fd, sidecar) != 0) || (!S_ISREG(sidecar->st_mode)) || (sidecar->st_uid != 0) || (sidecar->st_size != (off_t)sizeof(*source))) {
+    (void)close(fd);
+    return 1;
+  }
+  got = read(fd, source, sizeof(*source));
+  (void)close(fd);
+
+  if ((got != (ssize_t)sizeof(*source)) || (source->magic != KCRON_MIRROR_MAGIC) || (source->uid != (uint32_t)uid)) {
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Is the copy in mirror_dir one we can hand out for uid's shared keytab?
+ * The directory must be root's and not writable by anyone else, the
+ * copy uid's own, 0600 and the size the sidecar recorded, and the shared
+ * keytab unchanged since.
+ */
+int kcron_mirror_valid(uid_t uid, const char *mirror_dir, const char *keytab_filename, const char *shared_keytab) __attribute__((nonnull(2, 3, 4)))
+__attribute__((warn_unused_result));
+int kcron_mirror_valid(uid_t uid, const char *mirror_dir, const char *keytab_filename, const char *shared_keytab) {
+  struct kcron_mirror_source source;
+  struct stat sidecar = {0};
+  struct stat st = {0};
+  int valid = 0;
+
+  const int dir_fd = open(mirror_dir, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (dir_fd < 0) {
+    return 0;
+  }
+
+  if ((fstat(dir_fd, &st) != 0) || (st.st_uid != 0) || ((st.st_mode & (S_IWGRP | S_IWOTH)) != 0)) {
+    (void)close(dir_fd);
+    return 0;
+  }
+  if (kcron_mirror_read_source(dir_fd, keytab_filename, uid, &source, &sidecar) != 0) {
+    (void)close(dir_fd);
+    return 0;
+  }
+  if ((fstatat(dir_fd, keytab_filename, &st, AT_SYMLINK_NOFOLLOW) != 0) || (!S_ISREG(st.st_mode)) || (st.st_uid != uid) || ((st.st_mode & 07777) != (_0600)) ||
+      ((int64_t)st.st_size != source.size)) {
+    (void)close(dir_fd);
+    return 0;
+  }
+  (void)close(dir_fd);
+
+  if (lstat(shared_keytab, &st) == 0) {
+    valid = kcron_mirror_matches(&st, &source);
+  }
+  return valid;
+}
+
+/*
+ * get_filenames(), but pointing at the mirrored copy when there is a
+ * current one.  Only for readers: anything that creates or changes the
+ * keytab must keep using get_filenames().
+ */
+int get_mirrored_filenames(char *keytab_dir, char *keytab_filename, char *keytab) __attribute__((nonnull(1, 2, 3))) __attribute__((access(read_write, 1)))
+__attribute((access(read_write, 2))) __attribute((access(read_write, 3))) __attribute__((warn_unused_result));
+int get_mirrored_filenames(char *keytab_dir, char *keytab_filename, char *keytab) {
+
+  if (get_filenames(keytab_dir, keytab_filename, keytab) != 0) {
+    return 1;
+  }
+
+#if USE_MIRROR == 1
+  const uid_t uid = getuid();
+  char mirror_dir[FILE_PATH_MAX_LENGTH + 1] = {0};
+  char mirror_keytab[FILE_PATH_MAX_LENGTH + 1] = {0};
+
+  if ((kcron_mirror_dirname(uid, mirror_dir) != 0) || (snprintf(mirror_keytab, FILE_PATH_MAX_LENGTH, "%s/%s", mirror_dir, keytab_filename) >= FILE_PATH_MAX_LENGTH)) {
+    return 0;
+  }
+  if (kcron_mirror_valid(uid, mirror_dir, keytab_filename, keytab)) {
+    (void)memcpy(keytab_dir, mirror_dir, FILE_PATH_MAX_LENGTH);
+    (void)memcpy(keytab, mirror_keytab, FILE_PATH_MAX_LENGTH);
+  }
+#endif
+
+  return 0;
+}
+#endif
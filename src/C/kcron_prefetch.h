@@ -0,0 +1,522 @@
+/*
+ *
+ * Fetch service tickets listed in ~/.config/kcron-prefetch
+ * right after a TGT has been obtained from the client keytab
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef KCRON_PREFETCH_H
+#define KCRON_PREFETCH_H 1
+
+#include <errno.h>
+#include <fcntl.h>
+#include <krb5.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <profile.h>
+#include <pwd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KCRON_PREFETCH_FILE ".config/kcron-prefetch"
+#define KCRON_PREFETCH_MAX_BYTES 65536
+#define KCRON_PREFETCH_MAX_SERVICES 64
+
+/* the library's default udp_preference_limit, larger requests go over TCP */
+#define KCRON_PREFETCH_UDP_LIMIT 1465
+#define KCRON_PREFETCH_MAX_REPLY 65536
+#define KCRON_PREFETCH_TRY_MS 1000
+#define KCRON_PREFETCH_MAX_REALMS 4
+#define KCRON_PREFETCH_MAX_KDCS 8
+
+struct kcron_prefetch_realm {
+  char *name;
+  struct sockaddr_storage kdcs[KCRON_PREFETCH_MAX_KDCS];
+  socklen_t kdc_len[KCRON_PREFETCH_MAX_KDCS];
+  size_t count;
+};
+
+enum kcron_prefetch_state {
+  KCRON_PREFETCH_RETRY = 0, /* hand it to the library one at a time */
+  KCRON_PREFETCH_SENT,
+  KCRON_PREFETCH_DONE,
+  KCRON_PREFETCH_FAILED, /* the KDC said no, already reported */
+};
+
+struct kcron_prefetch_exchange {
+  krb5_tkt_creds_context ctx;
+  krb5_data request;
+  const struct kcron_prefetch_realm *realm;
+  size_t kdc; /* index into realm->kdcs */
+  uint64_t deadline;
+  int fd;
+  enum kcron_prefetch_state state;
+};
+
+void kcron_prefetch_free(char **services, size_t count);
+void kcron_prefetch_free(char **services, size_t count) {
+  if (services == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < count; i++) {
+    (void)free(services[i]);
+  }
+  (void)free(services);
+}
+
+/*
+ * Read ~/.config/kcron-prefetch for uid: one service principal per line,
+ * blank lines and # comments ignored.  A missing file is not an error,
+ * it just yields no services.  The file must belong to uid and not be
+ * writable by anyone else, since whoever runs this may be root.
+ */
+int kcron_prefetch_load(uid_t uid, char ***services, size_t *count) __attribute__((nonnull(2, 3))) __attribute__((warn_unused_result));
+int kcron_prefetch_load(uid_t uid, char ***services, size_t *count) {
+  struct passwd pw;
+  struct passwd *result = NULL;
+  struct stat st = {0};
+  char pwbuf[4096];
+  char path[FILE_PATH_MAX_LENGTH + 1];
+  char *buf = NULL;
+  char *line = NULL;
+  char *save = NULL;
+  ssize_t len = 0;
+  int fd = -1;
+
+  *services = NULL;
+  *count = 0;
+
+  if ((getpwuid_r(uid, &pw, pwbuf, sizeof(pwbuf), &result) != 0) || (result == NULL)) {
+    return 0;
+  }
+  (void)snprintf(path, sizeof(path), "%s/%s", pw.pw_dir, KCRON_PREFETCH_FILE);
+
+  fd = open(path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    return (errno == ENOENT || errno == ENOTDIR || errno == EACCES) ? 0 : 1;
+  }
+  if ((fstat(fd, &st) != 0) || (!S_ISREG(st.st_mode)) || (st.st_uid != uid) || ((st.st_mode & (S_IWGRP | S_IWOTH)) != 0)) {
+    (void)fprintf(stderr, "%s: ignoring %s, it must be a regular file owned by %u and writable only by them\n", __PROGRAM_NAME, path, uid);
+    (void)close(fd);
+    return 1;
+  }
+
+  buf = calloc(KCRON_PREFETCH_MAX_BYTES + 1, sizeof(char));
+  *services = calloc(KCRON_PREFETCH_MAX_SERVICES, sizeof(char *));
+  if ((buf == NULL) || (*services == NULL)) {
+    (void)close(fd);
+    (void)free(buf);
+    (void)free(*services);
+    *services = NULL;
+    return 1;
+  }
+
+  len = read(fd, buf, KCRON_PREFETCH_MAX_BYTES);
+  (void)close(fd);
+  if (len < 0) {
+    (void)free(buf);
+    (void)free(*services);
+    *services = NULL;
+    return 1;
+  }
+  buf[len] = '\0';
+
+  for (line = strtok_r(buf, "\n", &save); (line != NULL) && (*count < KCRON_PREFETCH_MAX_SERVICES); line = strtok_r(NULL, "\n", &save)) {
+    size_t end = 0;
+
+    line += strspn(line, " \t\r");
+    end = strcspn(line, " \t\r#");
+    if ((line[0] == '#') || (end == 0)) {
+      continue;
+    }
+    (*services)[*count] = strndup(line, end);
+    if ((*services)[*count] == NULL) {
+      break;
+    }
+    (*count)++;
+  }
+
+  (void)free(buf);
+  return 0;
+}
+
+/* One request after another through the library, which finds the KDCs and picks UDP or TCP itself */
+static int kcron_prefetch_one(krb5_context context, krb5_ccache ccache, krb5_principal client, const char *ccache_name, const char *service) __attribute__((nonnull(1, 2, 3, 4, 5)));
+static int kcron_prefetch_one(krb5_context context, krb5_ccache ccache, krb5_principal client, const char *ccache_name, const char *service) {
+  krb5_creds in = {0};
+  krb5_creds *out = NULL;
+  krb5_error_code ret = 0;
+
+  ret = krb5_parse_name(context, service, &in.server);
+  if (ret == 0) {
+    in.client = client;
+    /* stores into ccache as well */
+    ret = krb5_get_credentials(context, 0, ccache, &in, &out);
+    (void)krb5_free_principal(context, in.server);
+  }
+
+  if (ret != 0) {
+    const char *message = krb5_get_error_message(context, ret);
+    (void)fprintf(stderr, "%s: unable to prefetch %s into %s: %s\n", __PROGRAM_NAME, service, ccache_name, message);
+    (void)krb5_free_error_message(context, message);
+    return 1;
+  }
+
+  (void)krb5_free_creds(context, out);
+  return 0;
+}
+
+static uint64_t kcron_prefetch_ms(void) {
+  struct timespec ts = {0};
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000) + ((uint64_t)ts.tv_nsec / 1000000);
+}
+
+/*
+ * Split a krb5.conf kdc entry into host and port.  Entries the library
+ * would only reach over TCP or HTTPS are refused, those exchanges are
+ * left to kcron_prefetch_one().
+ */
+static int kcron_prefetch_kdc_entry(const char *entry, char *host, size_t hostlen, const char **port) __attribute__((nonnull(1, 2, 4))) __attribute__((warn_unused_result));
+static int kcron_prefetch_kdc_entry(const char *entry, char *host, size_t hostlen, const char **port) {
+  const char *colon = NULL;
+  size_t len = 0;
+
+  *port = "88";
+
+  if ((strncmp(entry, "tcp/", 4) == 0) || (strstr(entry, "://") != NULL)) {
+    return 1;
+  }
+  if (strncmp(entry, "udp/", 4) == 0) {
+    entry += 4;
+  }
+
+  if (entry[0] == '[') {
+    const char *close = strchr(entry, ']');
+    if (close == NULL) {
+      return 1;
+    }
+    entry++;
+    len = (size_t)(close - entry);
+    if (close[1] == ':') {
+      *port = close + 2;
+    }
+  } else {
+    colon = strchr(entry, ':');
+    /* more than one colon is a bare IPv6 address */
+    if ((colon != NULL) && (strchr(colon + 1, ':') == NULL)) {
+      len = (size_t)(colon - entry);
+      *port = colon + 1;
+    } else {
+      len = strlen(entry);
+    }
+  }
+
+  if ((len == 0) || (len >= hostlen) || (**port == '\0')) {
+    return 1;
+  }
+  (void)memcpy(host, entry, len);
+  host[len] = '\0';
+  return 0;
+}
+
+/* The UDP addresses of a realm's KDCs from krb5.conf, looked up once per call */
+static struct kcron_prefetch_realm *kcron_prefetch_realm(krb5_context context, struct kcron_prefetch_realm *realms, size_t *nrealms, const krb5_data *name) __attribute__((nonnull(1, 2, 3, 4)));
+static struct kcron_prefetch_realm *kcron_prefetch_realm(krb5_context context, struct kcron_prefetch_realm *realms, size_t *nrealms, const krb5_data *name) {
+  struct kcron_prefetch_realm *realm = NULL;
+  profile_t profile = NULL;
+  char **values = NULL;
+  const char *names[4] = {"realms", NULL, "kdc", NULL};
+
+  for (size_t i = 0; i < *nrealms; i++) {
+    if ((strlen(realms[i].name) == name->length) && (memcmp(realms[i].name, name->data, name->length) == 0)) {
+      return &realms[i];
+    }
+  }
+  if (*nrealms >= KCRON_PREFETCH_MAX_REALMS) {
+    return NULL;
+  }
+
+  realm = &realms[*nrealms];
+  *realm = (struct kcron_prefetch_realm){0};
+  realm->name = strndup(name->data, name->length);
+  if (realm->name == NULL) {
+    return NULL;
+  }
+  (*nrealms)++;
+
+  /* realms found only through DNS are left to the library */
+  names[1] = realm->name;
+  if ((krb5_get_profile(context, &profile) != 0) || (profile_get_values(profile, names, &values) != 0)) {
+    if (profile != NULL) {
+      (void)profile_release(profile);
+    }
+    return realm;
+  }
+
+  for (size_t i = 0; (values[i] != NULL) && (realm->count < KCRON_PREFETCH_MAX_KDCS); i++) {
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_DGRAM, .ai_protocol = IPPROTO_UDP};
+    struct addrinfo *found = NULL;
+    char host[NI_MAXHOST];
+    const char *port = NULL;
+
+    if ((kcron_prefetch_kdc_entry(values[i], host, sizeof(host), &port) != 0) || (getaddrinfo(host, port, &hints, &found) != 0)) {
+      continue;
+    }
+    for (const struct addrinfo *ai = found; (ai != NULL) && (realm->count < KCRON_PREFETCH_MAX_KDCS); ai = ai->ai_next) {
+      if (ai->ai_addrlen <= sizeof(realm->kdcs[0])) {
+        (void)memcpy(&realm->kdcs[realm->count], ai->ai_addr, ai->ai_addrlen);
+        realm->kdc_len[realm->count] = ai->ai_addrlen;
+        realm->count++;
+      }
+    }
+    (void)freeaddrinfo(found);
+  }
+
+  (void)profile_free_list(values);
+  (void)profile_release(profile);
+  return realm;
+}
+
+/* Send the exchange's request to its current KDC on a fresh socket */
+static int kcron_prefetch_send(struct kcron_prefetch_exchange *ex) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+static int kcron_prefetch_send(struct kcron_prefetch_exchange *ex) {
+  const struct sockaddr *kdc = (const struct sockaddr *)&ex->realm->kdcs[ex->kdc];
+
+  if (ex->fd >= 0) {
+    (void)close(ex->fd);
+  }
+  ex->fd = socket(kdc->sa_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+  if (ex->fd < 0) {
+    return 1;
+  }
+  /* connected, so only that KDC's replies (and its port unreachable) come back */
+  if ((connect(ex->fd, kdc, ex->realm->kdc_len[ex->kdc]) != 0) || (send(ex->fd, ex->request.data, ex->request.length, MSG_NOSIGNAL) != (ssize_t)ex->request.length)) {
+    return 1;
+  }
+  ex->deadline = kcron_prefetch_ms() + KCRON_PREFETCH_TRY_MS;
+  return 0;
+}
+
+/* Give up on the current KDC and try the realm's next one */
+static void kcron_prefetch_next_kdc(struct kcron_prefetch_exchange *ex) __attribute__((nonnull(1)));
+static void kcron_prefetch_next_kdc(struct kcron_prefetch_exchange *ex) {
+  while (++ex->kdc < ex->realm->count) {
+    if (kcron_prefetch_send(ex) == 0) {
+      return;
+    }
+  }
+  ex->state = KCRON_PREFETCH_RETRY;
+}
+
+/*
+ * Feed a reply (empty to start) to the exchange and send whatever it asks
+ * for next.  A referral can move it to another realm between steps.
+ */
+static void kcron_prefetch_step(krb5_context context, struct kcron_prefetch_realm *realms, size_t *nrealms, struct kcron_prefetch_exchange *ex, krb5_data *reply, const char *ccache_name, const char *service) __attribute__((nonnull(1, 2, 3, 4, 5, 6, 7)));
+static void kcron_prefetch_step(krb5_context context, struct kcron_prefetch_realm *realms, size_t *nrealms, struct kcron_prefetch_exchange *ex, krb5_data *reply, const char *ccache_name, const char *service) {
+  krb5_data realm = {0};
+  unsigned int flags = 0;
+  krb5_error_code ret = 0;
+
+  (void)krb5_free_data_contents(context, &ex->request);
+  ret = krb5_tkt_creds_step(context, ex->ctx, reply, &ex->request, &realm, &flags);
+
+  if (ret == KRB5KRB_ERR_RESPONSE_TOO_BIG) {
+    /* the library switches to TCP for this one */
+    ex->state = KCRON_PREFETCH_RETRY;
+  } else if (ret != 0) {
+    const char *message = krb5_get_error_message(context, ret);
+    (void)fprintf(stderr, "%s: unable to prefetch %s into %s: %s\n", __PROGRAM_NAME, service, ccache_name, message);
+    (void)krb5_free_error_message(context, message);
+    ex->state = KCRON_PREFETCH_FAILED;
+  } else if ((flags & KRB5_TKT_CREDS_STEP_FLAG_CONTINUE) == 0) {
+    /* stored into the ccache by the last step */
+    ex->state = KCRON_PREFETCH_DONE;
+  } else {
+    ex->realm = kcron_prefetch_realm(context, realms, nrealms, &realm);
+    ex->kdc = 0;
+    if ((ex->realm == NULL) || (ex->realm->count == 0) || (ex->request.length > KCRON_PREFETCH_UDP_LIMIT)) {
+      ex->state = KCRON_PREFETCH_RETRY;
+    } else if (kcron_prefetch_send(ex) != 0) {
+      kcron_prefetch_next_kdc(ex);
+    }
+  }
+
+  (void)krb5_free_data_contents(context, &realm);
+}
+
+/*
+ * Get a service ticket for each service into ccache_name, which must
+ * already hold a TGT.  Every TGS request is in flight at once over UDP
+ * from the caller's thread and context, stepped with krb5_tkt_creds_step()
+ * as its reply lands, so a list of services costs about one round trip.
+ * Exchanges that need TCP, a KDC krb5.conf does not list, or more than
+ * one pass over the KDCs are finished one at a time by the library.
+ * Returns the number of tickets stored.
+ */
+size_t kcron_prefetch(krb5_context context, const char *ccache_name, char *const *services, size_t count) __attribute__((nonnull(1, 2)));
+size_t kcron_prefetch(krb5_context context, const char *ccache_name, char *const *services, size_t count) {
+  krb5_ccache ccache = NULL;
+  krb5_principal client = NULL;
+  struct kcron_prefetch_exchange *exchanges = NULL;
+  struct kcron_prefetch_realm realms[KCRON_PREFETCH_MAX_REALMS];
+  struct pollfd *fds = NULL;
+  size_t *waiting = NULL;
+  char *buf = NULL;
+  size_t nrealms = 0;
+  size_t stored = 0;
+
+  if ((count == 0) || (services == NULL)) {
+    return 0;
+  }
+
+  if ((krb5_cc_resolve(context, ccache_name, &ccache) != 0) || (krb5_cc_get_principal(context, ccache, &client) != 0)) {
+    if (ccache != NULL) {
+      (void)krb5_cc_close(context, ccache);
+    }
+    return 0;
+  }
+
+  exchanges = calloc(count, sizeof(*exchanges));
+  fds = calloc(count, sizeof(*fds));
+  waiting = calloc(count, sizeof(*waiting));
+  buf = malloc(KCRON_PREFETCH_MAX_REPLY);
+
+  for (size_t i = 0; (exchanges != NULL) && (i < count); i++) {
+    struct kcron_prefetch_exchange *ex = &exchanges[i];
+    krb5_data empty = {0};
+    krb5_creds in = {0};
+
+    ex->fd = -1;
+    ex->state = KCRON_PREFETCH_RETRY;
+    if ((fds == NULL) || (waiting == NULL) || (buf == NULL) || (krb5_parse_name(context, services[i], &in.server) != 0)) {
+      continue;
+    }
+    in.client = client;
+    if (krb5_tkt_creds_init(context, ccache, &in, 0, &ex->ctx) == 0) {
+      ex->state = KCRON_PREFETCH_SENT;
+      kcron_prefetch_step(context, realms, &nrealms, ex, &empty, ccache_name, services[i]);
+    }
+    (void)krb5_free_principal(context, in.server);
+  }
+
+  for (;;) {
+    nfds_t nfds = 0;
+    uint64_t now = kcron_prefetch_ms();
+    uint64_t first = UINT64_MAX;
+
+    for (size_t i = 0; (exchanges != NULL) && (i < count); i++) {
+      if (exchanges[i].state == KCRON_PREFETCH_SENT) {
+        fds[nfds] = (struct pollfd){.fd = exchanges[i].fd, .events = POLLIN};
+        waiting[nfds++] = i;
+        if (exchanges[i].deadline < first) {
+          first = exchanges[i].deadline;
+        }
+      }
+    }
+    if (nfds == 0) {
+      break;
+    }
+
+    if ((poll(fds, nfds, (first > now) ? (int)(first - now) : 0) < 0) && (errno != EINTR)) {
+      break;
+    }
+    now = kcron_prefetch_ms();
+
+    for (nfds_t j = 0; j < nfds; j++) {
+      struct kcron_prefetch_exchange *ex = &exchanges[waiting[j]];
+
+      if ((fds[j].revents & (POLLIN | POLLERR)) != 0) {
+        const ssize_t len = recv(ex->fd, buf, KCRON_PREFETCH_MAX_REPLY, 0);
+        if (len > 0) {
+          krb5_data reply = {.length = (unsigned int)len, .data = buf};
+          kcron_prefetch_step(context, realms, &nrealms, ex, &reply, ccache_name, services[waiting[j]]);
+        } else if ((len < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+          /* port unreachable and the like */
+          kcron_prefetch_next_kdc(ex);
+        }
+      } else if (now >= ex->deadline) {
+        kcron_prefetch_next_kdc(ex);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (exchanges != NULL) {
+      struct kcron_prefetch_exchange *ex = &exchanges[i];
+
+      if (ex->fd >= 0) {
+        (void)close(ex->fd);
+      }
+      (void)krb5_free_data_contents(context, &ex->request);
+      if (ex->ctx != NULL) {
+        (void)krb5_tkt_creds_free(context, ex->ctx);
+      }
+      if (ex->state == KCRON_PREFETCH_DONE) {
+        stored++;
+        continue;
+      }
+      if (ex->state == KCRON_PREFETCH_FAILED) {
+        continue;
+      }
+    }
+    if (kcron_prefetch_one(context, ccache, client, ccache_name, services[i]) == 0) {
+      stored++;
+    }
+  }
+
+  for (size_t i = 0; i < nrealms; i++) {
+    (void)free(realms[i].name);
+  }
+  (void)free(buf);
+  (void)free(waiting);
+  (void)free(fds);
+  (void)free(exchanges);
+  (void)krb5_free_principal(context, client);
+  (void)krb5_cc_close(context, ccache);
+  return stored;
+}
+
+#endif
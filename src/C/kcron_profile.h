@@ -0,0 +1,258 @@
+/*
+ *
+ * A simple place where we keep our opt-in self profiling
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef KCRON_PROFILE_H
+#define KCRON_PROFILE_H 1
+
+enum kcron_profile_phase {
+  KCRON_PHASE_LOADER,    /* exec until we get control               */
+  KCRON_PHASE_HARDEN,    /* harden_runtime()                        */
+  KCRON_PHASE_SETUP,     /* memory and filename discovery           */
+  KCRON_PHASE_MKDIR,     /* per user directory                      */
+  KCRON_PHASE_KEYTAB,    /* keytab stat/creation                    */
+  KCRON_PHASE_OUTPUT,    /* reporting back to the caller            */
+  KCRON_PHASE_COUNT
+};
+
+/* /proc/self/io stays open here, above the open file limit, for the exit report */
+#define KCRON_PROFILE_IO_FD 9
+
+#if USE_PROFILING == 1
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+struct kcron_profile {
+  int active;
+  struct timespec start;
+  struct timespec mark;
+  uint64_t phase_usec[KCRON_PHASE_COUNT];
+  uint64_t cap_toggles;
+  int io_fd;
+};
+
+static struct kcron_profile kcron_prof = {.io_fd = -1};
+
+static uint64_t kcron_profile_usec_between(const struct timespec *from, const struct timespec *to) __attribute__((nonnull(1, 2)));
+static uint64_t kcron_profile_usec_between(const struct timespec *from, const struct timespec *to) {
+  const int64_t nsec = ((int64_t)to->tv_sec - (int64_t)from->tv_sec) * 1000000000 + ((int64_t)to->tv_nsec - (int64_t)from->tv_nsec);
+  return (nsec > 0) ? (uint64_t)nsec / 1000U : 0;
+}
+
+/* Only an admin can switch this on at runtime: the file must be root owned and not writable by anyone else */
+static int kcron_profile_requested(void) {
+#if PROFILE_BY_DEFAULT == 1
+  return 1;
+#else
+  struct stat st = {0};
+
+  if (stat(__PROFILE_CONFIG, &st) != 0) {
+    return 0;
+  }
+  if (!S_ISREG(st.st_mode) || st.st_uid != 0 || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+    return 0;
+  }
+  return 1;
+#endif
+}
+
+/*
+ * The kernel records our start time in clock ticks since boot, which is
+ * coarse (usually 10ms) but is the only view we have of exec and the
+ * dynamic loader from inside the process.
+ */
+static uint64_t kcron_profile_loader_usec(const struct timespec *now_boot) __attribute__((nonnull(1)));
+static uint64_t kcron_profile_loader_usec(const struct timespec *now_boot) {
+  unsigned long long starttime = 0;
+  const long ticks = sysconf(_SC_CLK_TCK);
+  uint64_t started_usec = 0;
+  uint64_t now_usec = 0;
+  FILE *stat_file = NULL;
+
+  if (ticks <= 0) {
+    return 0;
+  }
+
+  stat_file = fopen("/proc/self/stat", "re");
+  if (stat_file == NULL) {
+    return 0;
+  }
+  /* field 22, the comm field cannot contain ')' followed by a space for us */
+  if (fscanf(stat_file, "%*d (%*[^)]) %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu", &starttime) != 1) {
+    starttime = 0;
+  }
+  (void)fclose(stat_file);
+
+  if (starttime == 0) {
+    return 0;
+  }
+
+  started_usec = (uint64_t)starttime * 1000000U / (uint64_t)ticks;
+  now_usec = (uint64_t)now_boot->tv_sec * 1000000U + (uint64_t)now_boot->tv_nsec / 1000U;
+
+  return (now_usec > started_usec) ? now_usec - started_usec : 0;
+}
+
+/*
+ * The kernel's own count of read and write class syscalls, everything
+ * libc and libseccomp did on our behalf included.  Zero when the kernel
+ * lacks task I/O accounting.
+ */
+static void kcron_profile_io(unsigned long long *syscr, unsigned long long *syscw) __attribute__((nonnull(1, 2)));
+static void kcron_profile_io(unsigned long long *syscr, unsigned long long *syscw) {
+  char buf[512] = {0};
+  const char *field = NULL;
+  ssize_t len = 0;
+
+  *syscr = 0;
+  *syscw = 0;
+
+  if (kcron_prof.io_fd < 0) {
+    return;
+  }
+  len = pread(kcron_prof.io_fd, buf, sizeof(buf) - 1, 0);
+  if (len <= 0) {
+    return;
+  }
+  buf[len] = '\0';
+
+  field = strstr(buf, "syscr: ");
+  if (field != NULL) {
+    *syscr = strtoull(field + strlen("syscr: "), NULL, 10);
+  }
+  field = strstr(buf, "syscw: ");
+  if (field != NULL) {
+    *syscw = strtoull(field + strlen("syscw: "), NULL, 10);
+  }
+}
+
+static void kcron_profile_report(void) {
+  struct timespec now = {0};
+  struct rusage usage = {0};
+  unsigned long long syscr = 0;
+  unsigned long long syscw = 0;
+
+  if (!kcron_prof.active) {
+    return;
+  }
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  (void)getrusage(RUSAGE_SELF, &usage);
+  kcron_profile_io(&syscr, &syscw);
+
+  /* one line, so it survives being mixed with other stderr output */
+  (void)fprintf(stderr,
+                "%s: profile total_us=%llu loader_us=%llu harden_us=%llu setup_us=%llu mkdir_us=%llu keytab_us=%llu output_us=%llu syscr=%llu syscw=%llu cap_toggles=%llu minflt=%ld majflt=%ld nvcsw=%ld nivcsw=%ld maxrss_kb=%ld\n",
+                __PROGRAM_NAME, (unsigned long long)(kcron_profile_usec_between(&kcron_prof.start, &now) + kcron_prof.phase_usec[KCRON_PHASE_LOADER]),
+                (unsigned long long)kcron_prof.phase_usec[KCRON_PHASE_LOADER], (unsigned long long)kcron_prof.phase_usec[KCRON_PHASE_HARDEN],
+                (unsigned long long)kcron_prof.phase_usec[KCRON_PHASE_SETUP], (unsigned long long)kcron_prof.phase_usec[KCRON_PHASE_MKDIR],
+                (unsigned long long)kcron_prof.phase_usec[KCRON_PHASE_KEYTAB], (unsigned long long)kcron_prof.phase_usec[KCRON_PHASE_OUTPUT],
+                syscr, syscw, (unsigned long long)kcron_prof.cap_toggles, usage.ru_minflt, usage.ru_majflt, usage.ru_nvcsw, usage.ru_nivcsw,
+                usage.ru_maxrss);
+}
+
+/* Must run before harden_runtime() so /proc and the config file are still reachable */
+void kcron_profile_init(void) __attribute__((flatten));
+void kcron_profile_init(void) {
+  struct timespec boot = {0};
+  int fd = -1;
+
+  if (!kcron_profile_requested()) {
+    return;
+  }
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &kcron_prof.start);
+  (void)clock_gettime(CLOCK_BOOTTIME, &boot);
+  kcron_prof.mark = kcron_prof.start;
+  kcron_prof.phase_usec[KCRON_PHASE_LOADER] = kcron_profile_loader_usec(&boot);
+
+  /* landlock and the file limits come later, an fd opened now stays readable */
+  fd = open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+  if (fd >= 0) {
+    kcron_prof.io_fd = fcntl(fd, F_DUPFD_CLOEXEC, KCRON_PROFILE_IO_FD);
+    (void)close(fd);
+    if ((kcron_prof.io_fd >= 0) && (kcron_prof.io_fd != KCRON_PROFILE_IO_FD)) {
+      /* seccomp only lets us read the one we expect */
+      (void)close(kcron_prof.io_fd);
+      kcron_prof.io_fd = -1;
+    }
+  }
+
+  if (atexit(kcron_profile_report) != 0) {
+    return;
+  }
+
+  kcron_prof.active = 1;
+}
+
+/* Charge the time since the previous mark to 'phase' */
+void kcron_profile_phase(enum kcron_profile_phase phase) __attribute__((hot));
+void kcron_profile_phase(enum kcron_profile_phase phase) {
+  struct timespec now = {0};
+
+  if (!kcron_prof.active) {
+    return;
+  }
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  kcron_prof.phase_usec[phase] += kcron_profile_usec_between(&kcron_prof.mark, &now);
+  kcron_prof.mark = now;
+}
+
+void kcron_profile_cap_toggle(void) __attribute__((hot));
+void kcron_profile_cap_toggle(void) { kcron_prof.cap_toggles++; }
+#else
+/* If not profiling, these are all no-ops */
+void kcron_profile_init(void);
+void kcron_profile_init(void) {}
+
+void kcron_profile_phase(enum kcron_profile_phase phase);
+void kcron_profile_phase(enum kcron_profile_phase phase) { (void)phase; }
+
+void kcron_profile_cap_toggle(void);
+void kcron_profile_cap_toggle(void) {}
+#endif
+#endif
@@ -0,0 +1,107 @@
+/*
+ *
+ * A simple place where we keep the rate limit our bulk tools share
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef KCRON_RATELIMIT_H
+#define KCRON_RATELIMIT_H 1
+
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * Shared by every worker of a tool so at most rate operations a second
+ * go out, however many threads are waiting.  One token of burst keeps
+ * them evenly spaced.  A rate of 0 or less means no limit.
+ */
+struct kcron_bucket {
+  pthread_mutex_t lock;
+  double rate;
+  double tokens;
+  struct timespec last;
+};
+
+/* Seconds of CLOCK_MONOTONIC since start */
+double kcron_since(const struct timespec *start) __attribute__((nonnull(1)));
+double kcron_since(const struct timespec *start) {
+  struct timespec now = {0};
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void kcron_bucket_init(struct kcron_bucket *bucket, double rate) __attribute__((nonnull(1)));
+void kcron_bucket_init(struct kcron_bucket *bucket, double rate) {
+  (void)pthread_mutex_init(&bucket->lock, NULL);
+  bucket->rate = rate;
+  bucket->tokens = 1.0;
+  (void)clock_gettime(CLOCK_MONOTONIC, &bucket->last);
+}
+
+void kcron_bucket_destroy(struct kcron_bucket *bucket) __attribute__((nonnull(1)));
+void kcron_bucket_destroy(struct kcron_bucket *bucket) { (void)pthread_mutex_destroy(&bucket->lock); }
+
+/* Wait for a token, sleeping outside the lock */
+void kcron_bucket_take(struct kcron_bucket *bucket) __attribute__((nonnull(1)));
+void kcron_bucket_take(struct kcron_bucket *bucket) {
+  if (bucket->rate <= 0) {
+    return;
+  }
+
+  for (;;) {
+    double wait = 0;
+
+    (void)pthread_mutex_lock(&bucket->lock);
+    struct timespec now = {0};
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    bucket->tokens += kcron_since(&bucket->last) * bucket->rate;
+    bucket->last = now;
+    if (bucket->tokens > 1.0) {
+      bucket->tokens = 1.0;
+    }
+    if (bucket->tokens >= 1.0) {
+      bucket->tokens -= 1.0;
+      (void)pthread_mutex_unlock(&bucket->lock);
+      return;
+    }
+    wait = (1.0 - bucket->tokens) / bucket->rate;
+    (void)pthread_mutex_unlock(&bucket->lock);
+
+    const struct timespec pause = {.tv_sec = (time_t)wait, .tv_nsec = (long)((wait - (double)(time_t)wait) * 1e9)};
+    (void)nanosleep(&pause, NULL);
+  }
+}
+#endif
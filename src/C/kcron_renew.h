@@ -0,0 +1,110 @@
+/*
+ *
+ * Public interface of the kcron credential renewal library
+ *
+ */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef KCRON_RENEW_H
+#define KCRON_RENEW_H 1
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A renewal engine keeps credentials for many kcron principals fresh
+ * from a single thread.  Each registered principal is acquired from
+ * <CLIENT_KEYTAB_DIR>/<uid>/client.keytab into the named ccache and
+ * re-acquired 'lead_seconds' (minus up to 'jitter_seconds') before the
+ * ticket expires.  Expiry times live in a hierarchical timer wheel so
+ * the thread only wakes when something is actually due.
+ *
+ * After each acquisition the services listed in the owner's
+ * ~/.config/kcron-prefetch are fetched into the same ccache.
+ *
+ * The calling process must be able to read the keytabs it registers.
+ */
+
+struct kcron_renew_engine;
+
+struct kcron_renew_config {
+  unsigned int lead_seconds;      /* renew this long before the ticket ends, default 900 */
+  unsigned int jitter_seconds;    /* spread renewals over this window, default 300       */
+  unsigned int retry_min_seconds; /* first retry after a failure, default 30              */
+  unsigned int retry_max_seconds; /* retry backoff ceiling, default 900                   */
+};
+
+struct kcron_renew_stats {
+  uint64_t principals;         /* currently registered                   */
+  uint64_t acquisitions;       /* successful keytab exchanges            */
+  uint64_t failures;           /* failed keytab exchanges                */
+  uint64_t wakeups;            /* times the engine thread woke up        */
+  uint64_t latency_usec_last;  /* duration of the most recent exchange   */
+  uint64_t latency_usec_max;   /* slowest exchange seen                  */
+  uint64_t latency_usec_total; /* sum of all exchanges, for averages     */
+  uint64_t prefetched;         /* service tickets stored after a renewal */
+  uint64_t prefetch_failures;  /* listed services that could not be had  */
+};
+
+/* NULL config selects the defaults, returns NULL on failure */
+struct kcron_renew_engine *kcron_renew_new(const struct kcron_renew_config *config);
+
+/*
+ * Register a principal, it is acquired as soon as the engine runs.
+ * principal may be NULL to use the first entry in the keytab (like kinit -k),
+ * ccache_name may be NULL for "MEMORY:kcron_<uid>".  Returns 0 on success.
+ */
+int kcron_renew_add(struct kcron_renew_engine *engine, uid_t uid, const char *principal, const char *ccache_name);
+
+/* Forget the principal stored in ccache_name, returns 0 if it was registered */
+int kcron_renew_remove(struct kcron_renew_engine *engine, const char *ccache_name);
+
+/* Start/stop the engine thread, returns 0 on success */
+int kcron_renew_start(struct kcron_renew_engine *engine);
+void kcron_renew_stop(struct kcron_renew_engine *engine);
+
+void kcron_renew_get_stats(struct kcron_renew_engine *engine, struct kcron_renew_stats *stats);
+
+/* Stops the engine if needed and releases everything */
+void kcron_renew_free(struct kcron_renew_engine *engine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
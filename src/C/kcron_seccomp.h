@@ -45,8 +45,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <sys/resource.h>
 #include <sys/stat.h>
 
+#if USE_INDEX == 1
+#include <fcntl.h>
+
+#include "kcron_index.h"
+#endif
+
+#if USE_PROFILING == 1
+#include "kcron_profile.h"
+#endif
+
 #ifndef _0600
 #define _0600 S_IRUSR | S_IWUSR
 #endif
@@ -158,6 +169,56 @@ int set_kcron_seccomp(void) {
     exit(EXIT_FAILURE);
   }
 
+#if USE_INDEX == 1
+  /*
+   *   Reading the keytab for --index-only
+   */
+  if (seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(read), 1, SCMP_A0(SCMP_CMP_EQ, 4)) != 0) {
+    (void)fprintf(stderr, "%s: Cannot set allowlist 'read' on file handle.\n", __PROGRAM_NAME);
+    (void)seccomp_release(ctx);
+    exit(EXIT_FAILURE);
+  }
+
+  /*
+   *   The index, moved to its own handle whichever fd open returned
+   */
+  if (seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(fcntl), 2, SCMP_A1(SCMP_CMP_EQ, F_DUPFD_CLOEXEC), SCMP_A2(SCMP_CMP_EQ, KCRON_INDEX_FD)) != 0) {
+    (void)fprintf(stderr, "%s: Cannot set allowlist 'fcntl' to move the index handle.\n", __PROGRAM_NAME);
+    (void)seccomp_release(ctx);
+    exit(EXIT_FAILURE);
+  }
+  if (seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(flock), 1, SCMP_A0(SCMP_CMP_EQ, KCRON_INDEX_FD)) != 0) {
+    (void)fprintf(stderr, "%s: Cannot set allowlist 'flock' on index handle.\n", __PROGRAM_NAME);
+    (void)seccomp_release(ctx);
+    exit(EXIT_FAILURE);
+  }
+  if (seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(pread64), 1, SCMP_A0(SCMP_CMP_EQ, KCRON_INDEX_FD)) != 0) {
+    (void)fprintf(stderr, "%s: Cannot set allowlist 'pread64' on index handle.\n", __PROGRAM_NAME);
+    (void)seccomp_release(ctx);
+    exit(EXIT_FAILURE);
+  }
+  if (seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(pwrite64), 1, SCMP_A0(SCMP_CMP_EQ, KCRON_INDEX_FD)) != 0) {
+    (void)fprintf(stderr, "%s: Cannot set allowlist 'pwrite64' on index handle.\n", __PROGRAM_NAME);
+    (void)seccomp_release(ctx);
+    exit(EXIT_FAILURE);
+  }
+  if (seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(ftruncate), 1, SCMP_A0(SCMP_CMP_EQ, KCRON_INDEX_FD)) != 0) {
+    (void)fprintf(stderr, "%s: Cannot set allowlist 'ftruncate' on index handle.\n", __PROGRAM_NAME);
+    (void)seccomp_release(ctx);
+    exit(EXIT_FAILURE);
+  }
+  if (seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(fchmod), 2, SCMP_A0(SCMP_CMP_EQ, KCRON_INDEX_FD), SCMP_A1(SCMP_CMP_EQ, _0644)) != 0) {
+    (void)fprintf(stderr, "%s: Cannot set allowlist 'fchmod' on index handle for mode 0644 only.\n", __PROGRAM_NAME);
+    (void)seccomp_release(ctx);
+    exit(EXIT_FAILURE);
+  }
+  if (seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(close), 1, SCMP_A0(SCMP_CMP_EQ, KCRON_INDEX_FD)) != 0) {
+    (void)fprintf(stderr, "%s: Cannot set allowlist 'close' on index handle.\n", __PROGRAM_NAME);
+    (void)seccomp_release(ctx);
+    exit(EXIT_FAILURE);
+  }
+#endif
+
   /*
    *   General usage, not sure how to restrict these to the args I want....
    */
@@ -200,6 +261,25 @@ int set_kcron_seccomp(void) {
   }
 #endif
 
+#if USE_PROFILING == 1
+  /* the exit report needs these, clock_gettime normally stays in the vDSO */
+  if (seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(clock_gettime), 0) != 0) {
+    (void)fprintf(stderr, "%s: Cannot set allowlist 'clock_gettime'.\n", __PROGRAM_NAME);
+    (void)seccomp_release(ctx);
+    exit(EXIT_FAILURE);
+  }
+  if (seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(getrusage), 1, SCMP_A0(SCMP_CMP_EQ, RUSAGE_SELF)) != 0) {
+    (void)fprintf(stderr, "%s: Cannot set allowlist 'getrusage'.\n", __PROGRAM_NAME);
+    (void)seccomp_release(ctx);
+    exit(EXIT_FAILURE);
+  }
+  if (seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(pread64), 1, SCMP_A0(SCMP_CMP_EQ, KCRON_PROFILE_IO_FD)) != 0) {
+    (void)fprintf(stderr, "%s: Cannot set allowlist 'pread64' on /proc/self/io.\n", __PROGRAM_NAME);
+    (void)seccomp_release(ctx);
+    exit(EXIT_FAILURE);
+  }
+#endif
+
   /* Load rules */
   (void)seccomp_load(ctx);
 
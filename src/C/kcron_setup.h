@@ -55,10 +55,18 @@
 #include "kcron_landlock.h"
 #endif
 
+#if USE_INDEX == 1
+#include "kcron_index.h"
+#endif
+
 #include "kcron_caps.h"
 
-int set_kcron_ulimits(void) __attribute__((warn_unused_result)) __attribute__((flatten));
-int set_kcron_ulimits(void) {
+/*
+ * index_only is for a run that will write the index and nothing else,
+ * only that one gets the file size and open files the index needs.
+ */
+int set_kcron_ulimits(int index_only) __attribute__((warn_unused_result)) __attribute__((flatten));
+int set_kcron_ulimits(int index_only) {
 
   const struct rlimit proc = {0, 0};
   if (setrlimit(RLIMIT_NPROC, &proc) != 0) {
@@ -66,7 +74,14 @@ int set_kcron_ulimits(void) {
     return 1;
   }
 
+#if USE_INDEX == 1
+  /* the index is written at fixed offsets up to its full size */
+  const rlim_t max_filesize = index_only ? (rlim_t)KCRON_INDEX_BYTES : 64;
+  const struct rlimit filesize = {max_filesize, max_filesize};
+#else
+  (void)index_only;
   const struct rlimit filesize = {64, 64};
+#endif
   if (setrlimit(RLIMIT_FSIZE, &filesize) != 0) {
     (void)fprintf(stderr, "%s: Cannot lower max file size.\n", __PROGRAM_NAME);
     return 1;
@@ -90,7 +105,13 @@ int set_kcron_ulimits(void) {
     return 1;
   }
 
+#if USE_INDEX == 1
+  /* one more for the index on fd 5 */
+  const rlim_t max_fileopen = index_only ? 6 : 5;
+  const struct rlimit fileopen = {max_fileopen, max_fileopen};
+#else
   const struct rlimit fileopen = {5, 5};
+#endif
   if (setrlimit(RLIMIT_NOFILE, &fileopen) != 0) {
     (void)fprintf(stderr, "%s: Cannot lower max open files.\n", __PROGRAM_NAME);
     return 1;
@@ -112,8 +133,8 @@ int set_kcron_ulimits(void) {
   return 0;
 }
 
-void harden_runtime(void) __attribute__((flatten));
-void harden_runtime(void) {
+void harden_runtime(int index_only) __attribute__((flatten));
+void harden_runtime(int index_only) {
   if (freopen("/dev/null", "r", stdin) == NULL) {
     (void)fprintf(stderr, "%s: Cannot reset stdin to /dev/null.\n", __PROGRAM_NAME);
     exit(EXIT_FAILURE);
@@ -134,11 +155,17 @@ void harden_runtime(void) {
     exit(EXIT_FAILURE);
   }
 
-  if (set_kcron_ulimits() != 0) {
+  if (set_kcron_ulimits(index_only) != 0) {
     (void)fprintf(stderr, "%s: Cannot set ulimits.\n", __PROGRAM_NAME);
     exit(EXIT_FAILURE);
   }
 
+  /* read our capabilities once, every later toggle is a single capset */
+  if (precompute_capabilities() != 0) {
+    (void)fprintf(stderr, "%s: Cannot read capabilities.\n", __PROGRAM_NAME);
+    exit(EXIT_FAILURE);
+  }
+
 #if USE_LANDLOCK == 1
   /* do landlock before seccomp so the tools to change it become unreachable */
   (void)set_kcron_landlock();
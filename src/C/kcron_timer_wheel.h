@@ -0,0 +1,247 @@
+/*
+ *
+ * A simple hierarchical timer wheel so one thread can track many expiry times
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef KCRON_TIMER_WHEEL_H
+#define KCRON_TIMER_WHEEL_H 1
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Four levels of 64 slots with a one second tick covers 2^24 seconds
+ * (about 194 days).  Anything further out is parked in the top level
+ * and the owner re-arms it when it fires early.
+ */
+#define KCRON_WHEEL_BITS 6
+#define KCRON_WHEEL_SLOTS (1U << KCRON_WHEEL_BITS)
+#define KCRON_WHEEL_MASK (KCRON_WHEEL_SLOTS - 1)
+#define KCRON_WHEEL_LEVELS 4
+#define KCRON_WHEEL_MAX_DELTA ((UINT64_C(1) << (KCRON_WHEEL_BITS * KCRON_WHEEL_LEVELS)) - 1)
+
+struct kcron_timer {
+  struct kcron_timer *next;
+  struct kcron_timer *prev;
+  uint64_t expires;
+  unsigned int level;
+  unsigned int slot;
+  int armed;
+};
+
+struct kcron_wheel {
+  uint64_t now;
+  uint64_t occupied[KCRON_WHEEL_LEVELS];
+  struct kcron_timer *slots[KCRON_WHEEL_LEVELS][KCRON_WHEEL_SLOTS];
+};
+
+void kcron_wheel_init(struct kcron_wheel *wheel, uint64_t now) __attribute__((nonnull(1)));
+void kcron_wheel_init(struct kcron_wheel *wheel, uint64_t now) {
+  *wheel = (struct kcron_wheel){0};
+  wheel->now = now;
+}
+
+static void kcron_wheel_link(struct kcron_wheel *wheel, struct kcron_timer *timer) __attribute__((nonnull(1, 2)));
+static void kcron_wheel_link(struct kcron_wheel *wheel, struct kcron_timer *timer) {
+  uint64_t delta = 0;
+  unsigned int level = 0;
+  unsigned int slot = 0;
+
+  if (timer->expires < wheel->now) {
+    timer->expires = wheel->now;
+  }
+
+  delta = timer->expires - wheel->now;
+  if (delta > KCRON_WHEEL_MAX_DELTA) {
+    timer->expires = wheel->now + KCRON_WHEEL_MAX_DELTA;
+    delta = KCRON_WHEEL_MAX_DELTA;
+  }
+
+  while (level < KCRON_WHEEL_LEVELS - 1 && delta >= (UINT64_C(1) << (KCRON_WHEEL_BITS * (level + 1)))) {
+    level++;
+  }
+
+  slot = (unsigned int)((timer->expires >> (KCRON_WHEEL_BITS * level)) & KCRON_WHEEL_MASK);
+
+  timer->prev = NULL;
+  timer->next = wheel->slots[level][slot];
+  if (timer->next != NULL) {
+    timer->next->prev = timer;
+  }
+  wheel->slots[level][slot] = timer;
+  wheel->occupied[level] |= UINT64_C(1) << slot;
+  timer->level = level;
+  timer->slot = slot;
+  timer->armed = 1;
+}
+
+void kcron_wheel_add(struct kcron_wheel *wheel, struct kcron_timer *timer, uint64_t expires) __attribute__((nonnull(1, 2)));
+void kcron_wheel_add(struct kcron_wheel *wheel, struct kcron_timer *timer, uint64_t expires) {
+  /* the current tick has already been processed, so anything due fires on the next one */
+  timer->expires = (expires > wheel->now) ? expires : wheel->now + 1;
+  kcron_wheel_link(wheel, timer);
+}
+
+void kcron_wheel_del(struct kcron_wheel *wheel, struct kcron_timer *timer) __attribute__((nonnull(1, 2)));
+void kcron_wheel_del(struct kcron_wheel *wheel, struct kcron_timer *timer) {
+  if (!timer->armed) {
+    return;
+  }
+
+  if (timer->prev != NULL) {
+    timer->prev->next = timer->next;
+  } else {
+    wheel->slots[timer->level][timer->slot] = timer->next;
+  }
+  if (timer->next != NULL) {
+    timer->next->prev = timer->prev;
+  }
+  if (wheel->slots[timer->level][timer->slot] == NULL) {
+    wheel->occupied[timer->level] &= ~(UINT64_C(1) << timer->slot);
+  }
+
+  timer->next = NULL;
+  timer->prev = NULL;
+  timer->armed = 0;
+}
+
+/* Move one upper level slot down, feeding from the level above first if it wrapped */
+static void kcron_wheel_cascade(struct kcron_wheel *wheel, unsigned int level) __attribute__((nonnull(1)));
+static void kcron_wheel_cascade(struct kcron_wheel *wheel, unsigned int level) {
+  struct kcron_timer *timer = NULL;
+  unsigned int slot = 0;
+
+  if (level >= KCRON_WHEEL_LEVELS) {
+    return;
+  }
+
+  slot = (unsigned int)((wheel->now >> (KCRON_WHEEL_BITS * level)) & KCRON_WHEEL_MASK);
+  if (slot == 0) {
+    kcron_wheel_cascade(wheel, level + 1);
+  }
+
+  timer = wheel->slots[level][slot];
+  wheel->slots[level][slot] = NULL;
+  wheel->occupied[level] &= ~(UINT64_C(1) << slot);
+
+  while (timer != NULL) {
+    struct kcron_timer *next = timer->next;
+    kcron_wheel_link(wheel, timer);
+    timer = next;
+  }
+}
+
+/*
+ * Advance the wheel to 'now' and return the expired timers as a singly
+ * linked list through ->next.  Empty stretches of level 0 are skipped a
+ * whole rotation at a time, so a long sleep costs one step per 64 ticks.
+ */
+struct kcron_timer *kcron_wheel_advance(struct kcron_wheel *wheel, uint64_t now) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+struct kcron_timer *kcron_wheel_advance(struct kcron_wheel *wheel, uint64_t now) {
+  struct kcron_timer *expired = NULL;
+
+  while (wheel->now < now) {
+    unsigned int slot = 0;
+    struct kcron_timer *timer = NULL;
+
+    if (wheel->occupied[0] == 0) {
+      const uint64_t last_in_rotation = wheel->now | KCRON_WHEEL_MASK;
+      if (last_in_rotation >= now) {
+        wheel->now = now;
+        break;
+      }
+      if (last_in_rotation > wheel->now) {
+        wheel->now = last_in_rotation;
+        continue;
+      }
+    }
+
+    wheel->now++;
+    slot = (unsigned int)(wheel->now & KCRON_WHEEL_MASK);
+    if (slot == 0) {
+      kcron_wheel_cascade(wheel, 1);
+    }
+
+    timer = wheel->slots[0][slot];
+    wheel->slots[0][slot] = NULL;
+    wheel->occupied[0] &= ~(UINT64_C(1) << slot);
+
+    while (timer != NULL) {
+      struct kcron_timer *next = timer->next;
+      timer->armed = 0;
+      timer->prev = NULL;
+      timer->next = expired;
+      expired = timer;
+      timer = next;
+    }
+  }
+
+  return expired;
+}
+
+/*
+ * Earliest tick at which the wheel has work to do: either a level 0 slot
+ * firing or an upper slot cascading.  Returns UINT64_MAX when empty.
+ */
+uint64_t kcron_wheel_next(const struct kcron_wheel *wheel) __attribute__((nonnull(1))) __attribute__((warn_unused_result));
+uint64_t kcron_wheel_next(const struct kcron_wheel *wheel) {
+  uint64_t next = UINT64_MAX;
+
+  for (unsigned int level = 0; level < KCRON_WHEEL_LEVELS; level++) {
+    const unsigned int shift = KCRON_WHEEL_BITS * level;
+    const uint64_t base = wheel->now >> shift;
+    const unsigned int current = (unsigned int)(base & KCRON_WHEEL_MASK);
+    uint64_t ahead = 0;
+    uint64_t candidate = 0;
+
+    if (wheel->occupied[level] == 0) {
+      continue;
+    }
+
+    /* rotate so bit 0 is the slot after the current one, the current slot becomes bit 63 */
+    ahead = (wheel->occupied[level] >> ((current + 1) & KCRON_WHEEL_MASK)) | (wheel->occupied[level] << ((KCRON_WHEEL_SLOTS - current - 1) & KCRON_WHEEL_MASK));
+
+    candidate = (base + (uint64_t)__builtin_ctzll(ahead) + 1) << shift;
+    if (candidate < next) {
+      next = candidate;
+    }
+  }
+
+  return next;
+}
+
+#endif
@@ -0,0 +1,552 @@
+/*
+ *
+ * A small library that keeps many kcron principals supplied with tickets
+ * from their client.keytab using a single timer wheel thread.
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef __PROGRAM_NAME
+#define __PROGRAM_NAME "libkcron"
+#endif
+
+#include <errno.h>
+#include <krb5.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kcron_filename.h"
+#include "kcron_prefetch.h"
+#include "kcron_renew.h"
+#include "kcron_timer_wheel.h"
+
+#define KCRON_EXPORT __attribute__((visibility("default")))
+
+struct kcron_renew_entry {
+  struct kcron_timer timer; /* must stay first, the wheel hands these back */
+  uid_t uid;
+  char *principal;
+  char *ccache_name;
+  char *keytab;
+  unsigned int failures;
+  uint64_t next_delay; /* seconds until the next attempt, set while in flight */
+  int in_flight;
+  int removed;
+};
+
+struct kcron_renew_engine {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_t thread;
+  int running;
+  int stopping;
+
+  struct timespec epoch;
+  struct kcron_wheel wheel;
+
+  struct kcron_renew_entry **entries;
+  size_t count;
+  size_t capacity;
+
+  struct kcron_renew_config config;
+  struct kcron_renew_stats stats;
+  uint64_t rng;
+
+  krb5_context context; /* only touched from the engine thread */
+};
+
+static uint64_t kcron_renew_ticks(const struct kcron_renew_engine *engine) __attribute__((nonnull(1)));
+static uint64_t kcron_renew_ticks(const struct kcron_renew_engine *engine) {
+  struct timespec now = {0};
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)(now.tv_sec - engine->epoch.tv_sec);
+}
+
+static uint64_t kcron_renew_usec(void) {
+  struct timespec now = {0};
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000U + (uint64_t)now.tv_nsec / 1000U;
+}
+
+/* xorshift64, only used to spread renewals so quality does not matter */
+static unsigned int kcron_renew_jitter(struct kcron_renew_engine *engine, unsigned int window) __attribute__((nonnull(1)));
+static unsigned int kcron_renew_jitter(struct kcron_renew_engine *engine, unsigned int window) {
+  if (window == 0) {
+    return 0;
+  }
+  engine->rng ^= engine->rng << 13;
+  engine->rng ^= engine->rng >> 7;
+  engine->rng ^= engine->rng << 17;
+  return (unsigned int)(engine->rng % ((uint64_t)window + 1));
+}
+
+static void kcron_renew_entry_free(struct kcron_renew_entry *entry) {
+  if (entry == NULL) {
+    return;
+  }
+  (void)free(entry->principal);
+  (void)free(entry->ccache_name);
+  (void)free(entry->keytab);
+  (void)free(entry);
+}
+
+static char *kcron_renew_keytab_name(uid_t uid) {
+  char *keytab = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+  char *keytab_dirname = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+  char *keytab_filename = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+  char *keytab_name = calloc(FILE_PATH_MAX_LENGTH + 8, sizeof(char));
+
+  if ((keytab == NULL) || (keytab_dirname == NULL) || (keytab_filename == NULL) || (keytab_name == NULL) || (get_filenames_for_uid(uid, keytab_dirname, keytab_filename, keytab) != 0)) {
+    (void)free(keytab);
+    (void)free(keytab_dirname);
+    (void)free(keytab_filename);
+    (void)free(keytab_name);
+    return NULL;
+  }
+
+  (void)snprintf(keytab_name, FILE_PATH_MAX_LENGTH + 8, "FILE:%s", keytab);
+
+  (void)free(keytab);
+  (void)free(keytab_dirname);
+  (void)free(keytab_filename);
+  return keytab_name;
+}
+
+/*
+ * One AS exchange from the keytab straight into the target ccache.
+ * Runs without the engine lock held, returns 0 and the ticket end time on success.
+ */
+static int kcron_renew_acquire(struct kcron_renew_engine *engine, const struct kcron_renew_entry *entry, time_t *endtime) __attribute__((nonnull(1, 2, 3)));
+static int kcron_renew_acquire(struct kcron_renew_engine *engine, const struct kcron_renew_entry *entry, time_t *endtime) {
+  krb5_error_code ret = 0;
+  krb5_keytab keytab = NULL;
+  krb5_ccache ccache = NULL;
+  krb5_principal client = NULL;
+  krb5_get_init_creds_opt *opt = NULL;
+  krb5_creds creds = {0};
+  krb5_kt_cursor cursor = NULL;
+  krb5_keytab_entry kt_entry = {0};
+  const char *message = NULL;
+
+  ret = krb5_kt_resolve(engine->context, entry->keytab, &keytab);
+
+  if (ret == 0 && entry->principal != NULL) {
+    ret = krb5_parse_name(engine->context, entry->principal, &client);
+  } else if (ret == 0) {
+    /* slot 1 of the keytab, the same choice kinit -k makes */
+    ret = krb5_kt_start_seq_get(engine->context, keytab, &cursor);
+    if (ret == 0) {
+      ret = krb5_kt_next_entry(engine->context, keytab, &kt_entry, &cursor);
+      if (ret == 0) {
+        ret = krb5_copy_principal(engine->context, kt_entry.principal, &client);
+        (void)krb5_free_keytab_entry_contents(engine->context, &kt_entry);
+      }
+      (void)krb5_kt_end_seq_get(engine->context, keytab, &cursor);
+    }
+  }
+
+  if (ret == 0) {
+    ret = krb5_cc_resolve(engine->context, entry->ccache_name, &ccache);
+  }
+  if (ret == 0) {
+    ret = krb5_get_init_creds_opt_alloc(engine->context, &opt);
+  }
+  if (ret == 0) {
+    ret = krb5_get_init_creds_opt_set_out_ccache(engine->context, opt, ccache);
+  }
+  if (ret == 0) {
+    ret = krb5_get_init_creds_keytab(engine->context, &creds, client, keytab, 0, NULL, opt);
+  }
+
+  if (ret == 0) {
+    *endtime = (time_t)creds.times.endtime;
+    (void)krb5_free_cred_contents(engine->context, &creds);
+  } else {
+    message = krb5_get_error_message(engine->context, ret);
+    (void)fprintf(stderr, "%s: uid %u: unable to renew %s from %s: %s\n", __PROGRAM_NAME, entry->uid, entry->ccache_name, entry->keytab, message);
+    (void)krb5_free_error_message(engine->context, message);
+  }
+
+  if (opt != NULL) {
+    (void)krb5_get_init_creds_opt_free(engine->context, opt);
+  }
+  if (ccache != NULL) {
+    (void)krb5_cc_close(engine->context, ccache);
+  }
+  if (client != NULL) {
+    (void)krb5_free_principal(engine->context, client);
+  }
+  if (keytab != NULL) {
+    (void)krb5_kt_close(engine->context, keytab);
+  }
+
+  return (ret == 0) ? 0 : 1;
+}
+
+/* Service tickets the owner asked for, returns how many were stored */
+static size_t kcron_renew_prefetch(struct kcron_renew_engine *engine, const struct kcron_renew_entry *entry, size_t *wanted) __attribute__((nonnull(1, 2, 3)));
+static size_t kcron_renew_prefetch(struct kcron_renew_engine *engine, const struct kcron_renew_entry *entry, size_t *wanted) {
+  char **services = NULL;
+  size_t stored = 0;
+
+  /* re-read every time, so edits apply at the next renewal */
+  *wanted = 0;
+  if (kcron_prefetch_load(entry->uid, &services, wanted) != 0) {
+    return 0;
+  }
+
+  stored = kcron_prefetch(engine->context, entry->ccache_name, services, *wanted);
+  kcron_prefetch_free(services, *wanted);
+
+  return stored;
+}
+
+/* Seconds from now until this entry should be acquired again */
+static uint64_t kcron_renew_next_delay(struct kcron_renew_engine *engine, struct kcron_renew_entry *entry, int failed, time_t endtime) __attribute__((nonnull(1, 2)));
+static uint64_t kcron_renew_next_delay(struct kcron_renew_engine *engine, struct kcron_renew_entry *entry, int failed, time_t endtime) {
+  const time_t now = time(NULL);
+  uint64_t delay = 0;
+
+  if (failed) {
+    const unsigned int shift = (entry->failures < 16) ? entry->failures : 16;
+    delay = (uint64_t)engine->config.retry_min_seconds << shift;
+    if (delay > engine->config.retry_max_seconds) {
+      delay = engine->config.retry_max_seconds;
+    }
+    entry->failures++;
+    return delay + kcron_renew_jitter(engine, engine->config.retry_min_seconds);
+  }
+
+  entry->failures = 0;
+
+  if (endtime - now > (time_t)engine->config.lead_seconds) {
+    delay = (uint64_t)(endtime - now) - engine->config.lead_seconds;
+    delay -= kcron_renew_jitter(engine, (delay < engine->config.jitter_seconds) ? (unsigned int)delay : engine->config.jitter_seconds);
+  }
+
+  /* very short tickets would otherwise spin against the KDC */
+  if (delay < engine->config.retry_min_seconds) {
+    delay = engine->config.retry_min_seconds;
+  }
+
+  return delay;
+}
+
+static void *kcron_renew_thread(void *arg) __attribute__((nonnull(1)));
+static void *kcron_renew_thread(void *arg) {
+  struct kcron_renew_engine *engine = arg;
+
+  (void)pthread_mutex_lock(&engine->lock);
+
+  while (!engine->stopping) {
+    struct kcron_timer *expired = kcron_wheel_advance(&engine->wheel, kcron_renew_ticks(engine));
+
+    if (expired != NULL) {
+      struct kcron_timer *timer = expired;
+
+      for (timer = expired; timer != NULL; timer = timer->next) {
+        ((struct kcron_renew_entry *)timer)->in_flight = 1;
+      }
+
+      /* talk to the KDC without blocking add/remove/stats */
+      (void)pthread_mutex_unlock(&engine->lock);
+
+      for (timer = expired; timer != NULL; timer = timer->next) {
+        struct kcron_renew_entry *entry = (struct kcron_renew_entry *)timer;
+        time_t endtime = 0;
+        const uint64_t start = kcron_renew_usec();
+        const int failed = kcron_renew_acquire(engine, entry, &endtime);
+        const uint64_t elapsed = kcron_renew_usec() - start;
+        size_t wanted = 0;
+        size_t prefetched = 0;
+
+        if (!failed) {
+          prefetched = kcron_renew_prefetch(engine, entry, &wanted);
+        }
+
+        (void)pthread_mutex_lock(&engine->lock);
+        engine->stats.prefetched += prefetched;
+        engine->stats.prefetch_failures += wanted - prefetched;
+        engine->stats.latency_usec_last = elapsed;
+        engine->stats.latency_usec_total += elapsed;
+        if (elapsed > engine->stats.latency_usec_max) {
+          engine->stats.latency_usec_max = elapsed;
+        }
+        if (failed) {
+          engine->stats.failures++;
+        } else {
+          engine->stats.acquisitions++;
+        }
+        entry->next_delay = kcron_renew_next_delay(engine, entry, failed, endtime);
+        (void)pthread_mutex_unlock(&engine->lock);
+      }
+
+      (void)pthread_mutex_lock(&engine->lock);
+
+      timer = expired;
+      while (timer != NULL) {
+        struct kcron_timer *next = timer->next;
+        struct kcron_renew_entry *entry = (struct kcron_renew_entry *)timer;
+
+        entry->in_flight = 0;
+        if (entry->removed) {
+          kcron_renew_entry_free(entry);
+        } else {
+          kcron_wheel_add(&engine->wheel, timer, kcron_renew_ticks(engine) + entry->next_delay);
+        }
+        timer = next;
+      }
+      continue;
+    }
+
+    const uint64_t next = kcron_wheel_next(&engine->wheel);
+    if (next == UINT64_MAX) {
+      (void)pthread_cond_wait(&engine->wake, &engine->lock);
+    } else {
+      struct timespec deadline = engine->epoch;
+      deadline.tv_sec += (time_t)next;
+      (void)pthread_cond_timedwait(&engine->wake, &engine->lock, &deadline);
+    }
+    engine->stats.wakeups++;
+  }
+
+  (void)pthread_mutex_unlock(&engine->lock);
+  return NULL;
+}
+
+KCRON_EXPORT struct kcron_renew_engine *kcron_renew_new(const struct kcron_renew_config *config) {
+  struct kcron_renew_engine *engine = calloc(1, sizeof(struct kcron_renew_engine));
+  pthread_condattr_t condattr;
+
+  if (engine == NULL) {
+    return NULL;
+  }
+
+  engine->config.lead_seconds = 900;
+  engine->config.jitter_seconds = 300;
+  engine->config.retry_min_seconds = 30;
+  engine->config.retry_max_seconds = 900;
+  if (config != NULL) {
+    engine->config = *config;
+  }
+  if (engine->config.retry_min_seconds == 0) {
+    engine->config.retry_min_seconds = 1;
+  }
+  if (engine->config.retry_max_seconds < engine->config.retry_min_seconds) {
+    engine->config.retry_max_seconds = engine->config.retry_min_seconds;
+  }
+
+  if (krb5_init_context(&engine->context) != 0) {
+    (void)free(engine);
+    return NULL;
+  }
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &engine->epoch);
+  engine->rng = ((uint64_t)engine->epoch.tv_nsec << 20) ^ (uint64_t)getpid() ^ UINT64_C(0x9e3779b97f4a7c15);
+  kcron_wheel_init(&engine->wheel, 0);
+
+  (void)pthread_mutex_init(&engine->lock, NULL);
+  (void)pthread_condattr_init(&condattr);
+  (void)pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+  (void)pthread_cond_init(&engine->wake, &condattr);
+  (void)pthread_condattr_destroy(&condattr);
+
+  return engine;
+}
+
+KCRON_EXPORT int kcron_renew_add(struct kcron_renew_engine *engine, uid_t uid, const char *principal, const char *ccache_name) {
+  struct kcron_renew_entry *entry = NULL;
+  char default_ccache[64] = {0};
+
+  if (engine == NULL) {
+    return 1;
+  }
+
+  if (ccache_name == NULL) {
+    (void)snprintf(default_ccache, sizeof(default_ccache), "MEMORY:kcron_%u", uid);
+    ccache_name = default_ccache;
+  }
+
+  entry = calloc(1, sizeof(struct kcron_renew_entry));
+  if (entry == NULL) {
+    return 1;
+  }
+
+  entry->uid = uid;
+  entry->ccache_name = strdup(ccache_name);
+  entry->keytab = kcron_renew_keytab_name(uid);
+  if (principal != NULL) {
+    entry->principal = strdup(principal);
+  }
+
+  if ((entry->ccache_name == NULL) || (entry->keytab == NULL) || (principal != NULL && entry->principal == NULL)) {
+    kcron_renew_entry_free(entry);
+    return 1;
+  }
+
+  (void)pthread_mutex_lock(&engine->lock);
+
+  for (size_t i = 0; i < engine->count; i++) {
+    if (strcmp(engine->entries[i]->ccache_name, ccache_name) == 0) {
+      /* one principal per ccache, anything else would overwrite itself */
+      (void)pthread_mutex_unlock(&engine->lock);
+      kcron_renew_entry_free(entry);
+      return 1;
+    }
+  }
+
+  if (engine->count == engine->capacity) {
+    const size_t capacity = (engine->capacity == 0) ? 16 : engine->capacity * 2;
+    struct kcron_renew_entry **entries = realloc(engine->entries, capacity * sizeof(struct kcron_renew_entry *));
+    if (entries == NULL) {
+      (void)pthread_mutex_unlock(&engine->lock);
+      kcron_renew_entry_free(entry);
+      return 1;
+    }
+    engine->entries = entries;
+    engine->capacity = capacity;
+  }
+
+  engine->entries[engine->count++] = entry;
+  engine->stats.principals = engine->count;
+  kcron_wheel_add(&engine->wheel, &entry->timer, kcron_renew_ticks(engine));
+
+  (void)pthread_cond_signal(&engine->wake);
+  (void)pthread_mutex_unlock(&engine->lock);
+
+  return 0;
+}
+
+KCRON_EXPORT int kcron_renew_remove(struct kcron_renew_engine *engine, const char *ccache_name) {
+  if ((engine == NULL) || (ccache_name == NULL)) {
+    return 1;
+  }
+
+  (void)pthread_mutex_lock(&engine->lock);
+
+  for (size_t i = 0; i < engine->count; i++) {
+    struct kcron_renew_entry *entry = engine->entries[i];
+
+    if (strcmp(entry->ccache_name, ccache_name) != 0) {
+      continue;
+    }
+
+    engine->entries[i] = engine->entries[--engine->count];
+    engine->stats.principals = engine->count;
+
+    if (entry->in_flight) {
+      /* the engine thread owns it right now and frees it when done */
+      entry->removed = 1;
+    } else {
+      kcron_wheel_del(&engine->wheel, &entry->timer);
+      kcron_renew_entry_free(entry);
+    }
+
+    (void)pthread_mutex_unlock(&engine->lock);
+    return 0;
+  }
+
+  (void)pthread_mutex_unlock(&engine->lock);
+  return 1;
+}
+
+KCRON_EXPORT int kcron_renew_start(struct kcron_renew_engine *engine) {
+  int ret = 0;
+
+  if (engine == NULL) {
+    return 1;
+  }
+
+  (void)pthread_mutex_lock(&engine->lock);
+  if (!engine->running) {
+    engine->stopping = 0;
+    ret = pthread_create(&engine->thread, NULL, kcron_renew_thread, engine);
+    engine->running = (ret == 0);
+  }
+  (void)pthread_mutex_unlock(&engine->lock);
+
+  return (ret == 0) ? 0 : 1;
+}
+
+KCRON_EXPORT void kcron_renew_stop(struct kcron_renew_engine *engine) {
+  if (engine == NULL) {
+    return;
+  }
+
+  (void)pthread_mutex_lock(&engine->lock);
+  if (!engine->running) {
+    (void)pthread_mutex_unlock(&engine->lock);
+    return;
+  }
+  engine->stopping = 1;
+  (void)pthread_cond_signal(&engine->wake);
+  (void)pthread_mutex_unlock(&engine->lock);
+
+  (void)pthread_join(engine->thread, NULL);
+  engine->running = 0;
+}
+
+KCRON_EXPORT void kcron_renew_get_stats(struct kcron_renew_engine *engine, struct kcron_renew_stats *stats) {
+  if ((engine == NULL) || (stats == NULL)) {
+    return;
+  }
+
+  (void)pthread_mutex_lock(&engine->lock);
+  *stats = engine->stats;
+  (void)pthread_mutex_unlock(&engine->lock);
+}
+
+KCRON_EXPORT void kcron_renew_free(struct kcron_renew_engine *engine) {
+  if (engine == NULL) {
+    return;
+  }
+
+  kcron_renew_stop(engine);
+
+  for (size_t i = 0; i < engine->count; i++) {
+    kcron_renew_entry_free(engine->entries[i]);
+  }
+  (void)free(engine->entries);
+
+  (void)krb5_free_context(engine->context);
+  (void)pthread_cond_destroy(&engine->wake);
+  (void)pthread_mutex_destroy(&engine->lock);
+  (void)free(engine);
+}
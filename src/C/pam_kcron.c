@@ -0,0 +1,279 @@
+/*
+ *
+ * A PAM session module that prepares the kcron keytab directory at login
+ * so the first job does not have to exec init-kcron-keytab.
+ *
+ * It must run as root, which PAM session modules normally do.
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef __PROGRAM_NAME
+#define __PROGRAM_NAME "pam_kcron"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <security/pam_ext.h>
+#include <security/pam_modules.h>
+#include <security/pam_modutil.h>
+
+#include "kcron_empty_keytab_file.h"
+#include "kcron_filename.h"
+
+#if USE_INDEX == 1
+#include "kcron_index.h"
+#endif
+
+#ifndef _0600
+#define _0600 S_IRUSR | S_IWUSR
+#endif
+#ifndef _0700
+#define _0700 S_IRWXU
+#endif
+
+#define PAM_KCRON_EXPORT __attribute__((visibility("default")))
+
+/*
+ * A keytab we created but could not finish must not stay behind, the
+ * fstatat() fast path would take it as good on every later login.
+ */
+static void pam_kcron_discard(int uid_dir_fd, int keytab_fd, const char *keytab_filename) __attribute__((nonnull(3)));
+static void pam_kcron_discard(int uid_dir_fd, int keytab_fd, const char *keytab_filename) {
+  (void)close(keytab_fd);
+  (void)unlinkat(uid_dir_fd, keytab_filename, 0);
+  (void)close(uid_dir_fd);
+}
+
+#if USE_INDEX == 1
+/*
+ * Record the keytab we just made, as init-kcron-keytab does.  A stale
+ * index is only logged, kcron-index -r puts it right.
+ */
+static void pam_kcron_index(pam_handle_t *pamh, uid_t uid, int keytab_fd) __attribute__((nonnull(1)));
+static void pam_kcron_index(pam_handle_t *pamh, uid_t uid, int keytab_fd) {
+  struct kcron_index_record record = {0};
+  struct stat st = {0};
+  int index_fd = -1;
+
+  record.uid = uid;
+  record.state = KCRON_INDEX_EMPTY;
+  if (fstat(keytab_fd, &st) == 0) {
+    record.mtime = (int64_t)st.st_mtime;
+  }
+
+  /* never wait on the lock, a stuck writer must not hold up logins */
+  index_fd = kcron_index_open(__CLIENT_KEYTAB_DIR "/" KCRON_INDEX_FILENAME, -1, 0);
+  if ((index_fd < 0) || (kcron_index_store(index_fd, &record) != 0)) {
+    pam_syslog(pamh, LOG_WARNING, "index not updated for %u, rebuild it with kcron-index -r", uid);
+  }
+  if (index_fd >= 0) {
+    (void)close(index_fd);
+  }
+}
+#endif
+
+/*
+ * Same result as mkdir_if_missing() + the keytab creation in
+ * init-kcron-keytab, but PAM already runs as root so there are no
+ * capabilities to juggle.  Everything is relative to the directory fds
+ * so nothing in the path can be swapped out from under us.
+ */
+static int pam_kcron_create(pam_handle_t *pamh, uid_t uid, gid_t gid, const char *uid_dirname, const char *keytab_filename) __attribute__((nonnull(1, 4, 5)));
+static int pam_kcron_create(pam_handle_t *pamh, uid_t uid, gid_t gid, const char *uid_dirname, const char *keytab_filename) {
+  struct stat st = {0};
+  int created_dir = 0;
+  int client_dir_fd = -1;
+  int uid_dir_fd = -1;
+  int keytab_fd = -1;
+
+  client_dir_fd = open(__CLIENT_KEYTAB_DIR, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (client_dir_fd < 0) {
+    pam_syslog(pamh, LOG_ERR, "client keytab directory %s is missing: %s", __CLIENT_KEYTAB_DIR, strerror(errno));
+    return 1;
+  }
+
+  if (mkdirat(client_dir_fd, uid_dirname, _0700) == 0) {
+    created_dir = 1;
+  } else if (errno != EEXIST) {
+    pam_syslog(pamh, LOG_ERR, "unable to mkdir %s/%s: %s", __CLIENT_KEYTAB_DIR, uid_dirname, strerror(errno));
+    (void)close(client_dir_fd);
+    return 1;
+  }
+
+  uid_dir_fd = openat(client_dir_fd, uid_dirname, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  (void)close(client_dir_fd);
+  if (uid_dir_fd < 0) {
+    pam_syslog(pamh, LOG_ERR, "unable to open %s/%s: %s", __CLIENT_KEYTAB_DIR, uid_dirname, strerror(errno));
+    return 1;
+  }
+
+  if (fstat(uid_dir_fd, &st) != 0) {
+    pam_syslog(pamh, LOG_ERR, "unable to stat %s/%s: %s", __CLIENT_KEYTAB_DIR, uid_dirname, strerror(errno));
+    (void)close(uid_dir_fd);
+    return 1;
+  }
+
+  if (created_dir) {
+    if (fchown(uid_dir_fd, uid, gid) != 0) {
+      pam_syslog(pamh, LOG_ERR, "unable to chown %u:%u %s/%s: %s", uid, gid, __CLIENT_KEYTAB_DIR, uid_dirname, strerror(errno));
+      (void)close(uid_dir_fd);
+      return 1;
+    }
+  } else if (st.st_uid != uid) {
+    /* If it exists but has the wrong owner do nothing, it is safer */
+    pam_syslog(pamh, LOG_ERR, "%s/%s is not owned by %u, leaving it alone", __CLIENT_KEYTAB_DIR, uid_dirname, uid);
+    (void)close(uid_dir_fd);
+    return 1;
+  }
+
+  keytab_fd = openat(uid_dir_fd, keytab_filename, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, _0600);
+  if (keytab_fd < 0) {
+    (void)close(uid_dir_fd);
+    if (errno == EEXIST) {
+      /* someone beat us to it, which is just as good */
+      return 0;
+    }
+    pam_syslog(pamh, LOG_ERR, "unable to create %s/%s/%s: %s", __CLIENT_KEYTAB_DIR, uid_dirname, keytab_filename, strerror(errno));
+    return 1;
+  }
+
+  /* write to it first to ensure its content is right before we set owner/mode */
+  if (write_empty_keytab(keytab_fd) != 0) {
+    pam_syslog(pamh, LOG_ERR, "unable to write %s/%s/%s", __CLIENT_KEYTAB_DIR, uid_dirname, keytab_filename);
+    pam_kcron_discard(uid_dir_fd, keytab_fd, keytab_filename);
+    return 1;
+  }
+
+  if ((fchmod(keytab_fd, _0600) != 0) || (fchown(keytab_fd, uid, gid) != 0)) {
+    pam_syslog(pamh, LOG_ERR, "unable to set owner/mode on %s/%s/%s: %s", __CLIENT_KEYTAB_DIR, uid_dirname, keytab_filename, strerror(errno));
+    pam_kcron_discard(uid_dir_fd, keytab_fd, keytab_filename);
+    return 1;
+  }
+
+#if USE_INDEX == 1
+  pam_kcron_index(pamh, uid, keytab_fd);
+#endif
+
+  (void)close(keytab_fd);
+  (void)close(uid_dir_fd);
+  return 0;
+}
+
+PAM_KCRON_EXPORT int pam_sm_open_session(pam_handle_t *pamh, int flags, int argc, const char **argv) {
+  const char *user = NULL;
+  const struct passwd *pw = NULL;
+  unsigned long minuid = 1;
+  struct stat st = {0};
+  char uid_dirname[32] = {0};
+  int ret = PAM_SESSION_ERR;
+  /* a full or read only keytab tree should not stop anyone logging in */
+  int failure = PAM_IGNORE;
+
+  char *keytab = NULL;
+  char *keytab_dirname = NULL;
+  char *keytab_filename = NULL;
+
+  (void)flags;
+
+  for (int i = 0; i < argc; i++) {
+    if (strncmp(argv[i], "minuid=", 7) == 0) {
+      minuid = strtoul(argv[i] + 7, NULL, 10);
+    } else if (strcmp(argv[i], "fatal") == 0) {
+      failure = PAM_SESSION_ERR;
+    } else {
+      pam_syslog(pamh, LOG_ERR, "unknown option: %s", argv[i]);
+    }
+  }
+
+  if ((pam_get_user(pamh, &user, NULL) != PAM_SUCCESS) || (user == NULL)) {
+    return PAM_USER_UNKNOWN;
+  }
+
+  pw = pam_modutil_getpwnam(pamh, user);
+  if (pw == NULL) {
+    return PAM_USER_UNKNOWN;
+  }
+
+  if (pw->pw_uid < minuid) {
+    return PAM_IGNORE;
+  }
+
+  keytab = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+  keytab_dirname = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+  keytab_filename = calloc(FILE_PATH_MAX_LENGTH + 3, sizeof(char));
+
+  if ((keytab == NULL) || (keytab_dirname == NULL) || (keytab_filename == NULL) || (get_filenames_for_uid(pw->pw_uid, keytab_dirname, keytab_filename, keytab) != 0)) {
+    pam_syslog(pamh, LOG_ERR, "cannot determine keytab filename for %s", user);
+    (void)free(keytab);
+    (void)free(keytab_dirname);
+    (void)free(keytab_filename);
+    return failure;
+  }
+
+  /* Repeat logins should cost exactly this one syscall */
+  if (fstatat(AT_FDCWD, keytab, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+    ret = S_ISREG(st.st_mode) ? PAM_SUCCESS : failure;
+    if (ret != PAM_SUCCESS) {
+      pam_syslog(pamh, LOG_ERR, "%s is not a regular file", keytab);
+    }
+  } else {
+    (void)snprintf(uid_dirname, sizeof(uid_dirname), "%u", pw->pw_uid);
+    ret = (pam_kcron_create(pamh, pw->pw_uid, pw->pw_gid, uid_dirname, keytab_filename) == 0) ? PAM_SUCCESS : failure;
+  }
+
+  (void)free(keytab);
+  (void)free(keytab_dirname);
+  (void)free(keytab_filename);
+
+  return ret;
+}
+
+PAM_KCRON_EXPORT int pam_sm_close_session(pam_handle_t *pamh, int flags, int argc, const char **argv) {
+  (void)pamh;
+  (void)flags;
+  (void)argc;
+  (void)argv;
+  return PAM_SUCCESS;
+}
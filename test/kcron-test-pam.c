@@ -0,0 +1,175 @@
+/*
+ *
+ * Drive pam_kcron's session hook against a scratch keytab tree:
+ * minuid, the existing keytab fast path and the fatal option
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef __PROGRAM_NAME
+#define __PROGRAM_NAME "kcron-test-pam"
+#endif
+
+/* keep the module away from the real keytab tree */
+#undef __CLIENT_KEYTAB_DIR
+#define __CLIENT_KEYTAB_DIR KCRON_TEST_KEYTAB_DIR
+
+#include <fcntl.h>
+#include <stdarg.h>
+
+/* a repeat login should stop at the fstatat(), before opening anything */
+static unsigned int opened = 0;
+#define open(...) (opened++, open(__VA_ARGS__))
+
+#include "pam_kcron.c"
+
+static struct passwd test_user;
+static unsigned int logged = 0;
+static int failures = 0;
+
+/* Just enough of libpam for pam_sm_open_session() */
+int pam_get_user(pam_handle_t *pamh, const char **user, const char *prompt) {
+  (void)pamh;
+  (void)prompt;
+  *user = test_user.pw_name;
+  return PAM_SUCCESS;
+}
+
+struct passwd *pam_modutil_getpwnam(pam_handle_t *pamh, const char *user) {
+  (void)pamh;
+  return (strcmp(user, test_user.pw_name) == 0) ? &test_user : NULL;
+}
+
+void pam_syslog(const pam_handle_t *pamh, int priority, const char *fmt, ...) {
+  va_list ap;
+
+  (void)pamh;
+  (void)priority;
+  va_start(ap, fmt);
+  (void)fprintf(stderr, "%s: syslog: ", __PROGRAM_NAME);
+  (void)vfprintf(stderr, fmt, ap);
+  (void)fprintf(stderr, "\n");
+  va_end(ap);
+  logged++;
+}
+
+static void check(int ok, const char *what) {
+  if (!ok) {
+    (void)fprintf(stderr, "%s: FAIL %s\n", __PROGRAM_NAME, what);
+    failures++;
+  }
+}
+
+static int open_session(const char *option1, const char *option2) {
+  const char *argv[2] = {option1, option2};
+  int argc = (option1 == NULL) ? 0 : ((option2 == NULL) ? 1 : 2);
+
+  logged = 0;
+  opened = 0;
+  return pam_sm_open_session((pam_handle_t *)&test_user, 0, argc, argv);
+}
+
+static char uid_dir[FILE_PATH_MAX_LENGTH + 1];
+static char keytab[FILE_PATH_MAX_LENGTH + 1];
+
+static void cleanup(void) {
+  (void)unlink(keytab);
+  (void)rmdir(keytab);
+  (void)rmdir(uid_dir);
+#if USE_INDEX == 1
+  (void)unlink(__CLIENT_KEYTAB_DIR "/" KCRON_INDEX_FILENAME);
+#endif
+  (void)rmdir(__CLIENT_KEYTAB_DIR);
+}
+
+int main(void) {
+  char minuid_above[32] = {0};
+  struct stat st = {0};
+  struct stat before = {0};
+  int ret = 0;
+
+  test_user.pw_name = "kcron-test";
+  test_user.pw_uid = getuid();
+  test_user.pw_gid = getgid();
+  (void)snprintf(uid_dir, sizeof(uid_dir), "%s/%u", __CLIENT_KEYTAB_DIR, test_user.pw_uid);
+  (void)snprintf(keytab, sizeof(keytab), "%s/client.keytab", uid_dir);
+  (void)snprintf(minuid_above, sizeof(minuid_above), "minuid=%u", test_user.pw_uid + 1);
+
+  cleanup();
+  if (mkdir(__CLIENT_KEYTAB_DIR, _0700) != 0) {
+    (void)fprintf(stderr, "%s: unable to mkdir %s: %s\n", __PROGRAM_NAME, __CLIENT_KEYTAB_DIR, strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  /* minuid: users below it are left alone */
+  check(open_session(minuid_above, NULL) == PAM_IGNORE, "minuid: user below minuid not ignored");
+  check(lstat(uid_dir, &st) != 0, "minuid: directory created for a user below minuid");
+
+  /* first login creates the directory and an empty keytab */
+  check(open_session("minuid=0", NULL) == PAM_SUCCESS, "create: session failed");
+  check((lstat(uid_dir, &st) == 0) && S_ISDIR(st.st_mode) && ((st.st_mode & 07777) == (_0700)) && (st.st_uid == test_user.pw_uid), "create: directory wrong");
+  check((lstat(keytab, &st) == 0) && S_ISREG(st.st_mode) && ((st.st_mode & 07777) == (_0600)) && (st.st_uid == test_user.pw_uid) && (st.st_size == 2), "create: keytab wrong");
+
+  /* existing keytab: the fast path succeeds without touching anything */
+  check(lstat(keytab, &before) == 0, "fast path: keytab missing");
+  check(open_session("minuid=0", NULL) == PAM_SUCCESS, "fast path: session failed");
+  check((logged == 0) && (opened == 0), "fast path: went past the fstatat()");
+  check((lstat(keytab, &st) == 0) && (st.st_ino == before.st_ino) && (st.st_mtime == before.st_mtime) && (st.st_size == before.st_size), "fast path: keytab changed");
+
+  /* something other than a file in the keytab's place fails, fatally only with fatal */
+  check(unlink(keytab) == 0, "not a file: unlink");
+  check(symlink("/dev/null", keytab) == 0, "not a file: symlink");
+  check(open_session("minuid=0", NULL) == PAM_IGNORE, "not a file: not ignored without fatal");
+  check(logged == 1, "not a file: not logged");
+  check(open_session("minuid=0", "fatal") == PAM_SESSION_ERR, "not a file: fatal did not fail the session");
+  check((lstat(keytab, &st) == 0) && S_ISLNK(st.st_mode), "not a file: symlink replaced");
+
+  /* a missing keytab tree fails the same way */
+  cleanup();
+  check(open_session("minuid=0", NULL) == PAM_IGNORE, "no tree: not ignored without fatal");
+  check(open_session("fatal", "minuid=0") == PAM_SESSION_ERR, "no tree: fatal did not fail the session");
+  check(lstat(__CLIENT_KEYTAB_DIR, &st) != 0, "no tree: keytab tree created");
+
+  /* unknown options are logged, not fatal */
+  ret = open_session(minuid_above, "bogus");
+  check((ret == PAM_IGNORE) && (logged == 1), "options: unknown option not just logged");
+
+  cleanup();
+  if (failures != 0) {
+    (void)fprintf(stderr, "%s: %d checks failed\n", __PROGRAM_NAME, failures);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,281 @@
+/*
+ *
+ * Check the renew thread's timer wheel: insert, cancel, cascade and expiry order
+ *
+ */
+#include "autoconf.h" /* for our automatic config bits        */
+/*
+
+   Copyright 2023 Fermi Research Alliance, LLC
+
+   This software was produced under U.S. Government contract DE-AC02-07CH11359
+   for Fermi National Accelerator Laboratory (Fermilab), which is operated by
+   Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S.
+   Government has rights to use, reproduce, and distribute this software.
+   NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY,
+   EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+   If software is modified to produce derivative works, such modified software
+   should be clearly marked, so as not to confuse it with the version available
+   from Fermilab.
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR
+   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef __PROGRAM_NAME
+#define __PROGRAM_NAME "kcron-test-timer-wheel"
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "kcron_timer_wheel.h"
+
+#define TEST_RANDOM_TIMERS 4096
+
+struct test_timer {
+  struct kcron_timer timer; /* must stay first, the wheel hands these back */
+  uint64_t due;
+  uint64_t fired_at;
+  unsigned int fired;
+  int cancelled;
+};
+
+static int failures = 0;
+
+static void check(int ok, const char *what, uint64_t detail) {
+  if (!ok) {
+    (void)fprintf(stderr, "%s: FAIL %s (%llu)\n", __PROGRAM_NAME, what, (unsigned long long)detail);
+    failures++;
+  }
+}
+
+/*
+ * Run the wheel the way the renew thread does, jumping to kcron_wheel_next()
+ * each time.  Anything still pending after 'until' was lost by the wheel.
+ */
+static void run_until_empty(struct kcron_wheel *wheel, uint64_t until, uint64_t *last_fired) __attribute__((nonnull(1, 3)));
+static void run_until_empty(struct kcron_wheel *wheel, uint64_t until, uint64_t *last_fired) {
+  uint64_t next = 0;
+
+  while ((next = kcron_wheel_next(wheel)) != UINT64_MAX) {
+    struct kcron_timer *expired = NULL;
+
+    check(next > wheel->now, "next is not in the future", next);
+    check(next <= until, "timers left past their time", next);
+    if ((next <= wheel->now) || (next > until)) {
+      return;
+    }
+
+    expired = kcron_wheel_advance(wheel, next);
+    while (expired != NULL) {
+      struct test_timer *t = (struct test_timer *)expired;
+      expired = expired->next;
+
+      check(!t->timer.armed, "fired timer still armed", t->due);
+      check(wheel->now >= *last_fired, "timers fired out of order", wheel->now);
+      t->fired++;
+      t->fired_at = wheel->now;
+      *last_fired = wheel->now;
+    }
+  }
+}
+
+static void check_fired(const struct test_timer *timers, size_t count, const char *what) __attribute__((nonnull(1, 3)));
+static void check_fired(const struct test_timer *timers, size_t count, const char *what) {
+  for (size_t i = 0; i < count; i++) {
+    if (timers[i].cancelled) {
+      check(timers[i].fired == 0, what, timers[i].due);
+    } else {
+      check(timers[i].fired == 1, what, timers[i].due);
+      check(timers[i].fired_at == timers[i].due, what, timers[i].fired_at);
+    }
+  }
+}
+
+/* Each timer fires exactly once, on its own tick, and in order */
+static void test_insert_and_order(uint64_t start) {
+  static const uint64_t deltas[] = {5, 1, 3, 64, 2, 63, 3, 128, 1};
+  struct test_timer timers[sizeof(deltas) / sizeof(deltas[0])] = {0};
+  const size_t count = sizeof(deltas) / sizeof(deltas[0]);
+  struct kcron_wheel wheel;
+  uint64_t last_fired = 0;
+
+  kcron_wheel_init(&wheel, start);
+  for (size_t i = 0; i < count; i++) {
+    timers[i].due = start + deltas[i];
+    kcron_wheel_add(&wheel, &timers[i].timer, timers[i].due);
+  }
+
+  /* one tick at a time, nothing fires early */
+  for (uint64_t tick = start + 1; tick <= start + 128; tick++) {
+    struct kcron_timer *expired = kcron_wheel_advance(&wheel, tick);
+    while (expired != NULL) {
+      struct test_timer *t = (struct test_timer *)expired;
+      expired = expired->next;
+      check(t->due == tick, "insert: fired on the wrong tick", tick);
+      t->fired++;
+      t->fired_at = tick;
+    }
+  }
+  check(kcron_wheel_next(&wheel) == UINT64_MAX, "insert: wheel not empty", wheel.now);
+  check_fired(timers, count, "insert: fired wrong");
+
+  /* a time already past fires on the next tick rather than being lost */
+  timers[0] = (struct test_timer){.due = wheel.now + 1};
+  kcron_wheel_add(&wheel, &timers[0].timer, wheel.now - 10);
+  run_until_empty(&wheel, wheel.now + 1, &last_fired);
+  check_fired(timers, 1, "insert: past time not fired on the next tick");
+}
+
+/* Cancelled timers never fire, from the head, middle or tail of a slot */
+static void test_cancel(void) {
+  struct test_timer timers[6] = {0};
+  struct kcron_wheel wheel;
+  uint64_t last_fired = 0;
+
+  kcron_wheel_init(&wheel, 1000);
+  for (size_t i = 0; i < 6; i++) {
+    /* three share a level 0 slot, three share a level 2 slot */
+    timers[i].due = (i < 3) ? 1010 : 1000 + 5000;
+    kcron_wheel_add(&wheel, &timers[i].timer, timers[i].due);
+  }
+
+  timers[1].cancelled = 1;
+  kcron_wheel_del(&wheel, &timers[1].timer);
+  timers[3].cancelled = 1;
+  kcron_wheel_del(&wheel, &timers[3].timer);
+  timers[5].cancelled = 1;
+  kcron_wheel_del(&wheel, &timers[5].timer);
+  /* a second cancel is harmless */
+  kcron_wheel_del(&wheel, &timers[5].timer);
+  check(!timers[5].timer.armed, "cancel: still armed", 5);
+
+  run_until_empty(&wheel, 6000, &last_fired);
+  check_fired(timers, 6, "cancel: fired wrong");
+
+  /* cancelling the only timer clears the slot so the wheel reads as empty */
+  timers[0] = (struct test_timer){.due = wheel.now + 300, .cancelled = 1};
+  kcron_wheel_add(&wheel, &timers[0].timer, timers[0].due);
+  kcron_wheel_del(&wheel, &timers[0].timer);
+  check(kcron_wheel_next(&wheel) == UINT64_MAX, "cancel: slot left occupied", wheel.now);
+}
+
+/* Timers either side of every level boundary cascade down and fire on time */
+static void test_cascade(uint64_t start) {
+  struct test_timer timers[3 * KCRON_WHEEL_LEVELS + 1] = {0};
+  size_t count = 0;
+  struct kcron_wheel wheel;
+  uint64_t last_fired = 0;
+
+  kcron_wheel_init(&wheel, start);
+  for (unsigned int level = 1; level <= KCRON_WHEEL_LEVELS; level++) {
+    const uint64_t boundary = UINT64_C(1) << (KCRON_WHEEL_BITS * level);
+    const uint64_t deltas[3] = {boundary - 1, boundary, boundary + 1};
+
+    for (size_t i = 0; i < 3; i++) {
+      if (deltas[i] > KCRON_WHEEL_MAX_DELTA) {
+        continue;
+      }
+      timers[count].due = start + deltas[i];
+      kcron_wheel_add(&wheel, &timers[count].timer, timers[count].due);
+      count++;
+    }
+  }
+
+  /* beyond the wheel's reach it parks at the furthest tick for the owner to re-arm */
+  timers[count].due = start + KCRON_WHEEL_MAX_DELTA;
+  kcron_wheel_add(&wheel, &timers[count].timer, start + KCRON_WHEEL_MAX_DELTA + 12345);
+  count++;
+
+  run_until_empty(&wheel, start + KCRON_WHEEL_MAX_DELTA, &last_fired);
+  check_fired(timers, count, "cascade: fired wrong");
+}
+
+/* One long sleep hands back everything due, and nothing that is not */
+static void test_long_sleep(void) {
+  struct test_timer timers[4] = {0};
+  struct kcron_wheel wheel;
+  struct kcron_timer *expired = NULL;
+  unsigned int seen = 0;
+
+  kcron_wheel_init(&wheel, 7);
+  timers[0].due = 9;
+  timers[1].due = 7 + 70;
+  timers[2].due = 7 + 5000;
+  timers[3].due = 7 + 5001;
+  for (size_t i = 0; i < 4; i++) {
+    kcron_wheel_add(&wheel, &timers[i].timer, timers[i].due);
+  }
+
+  expired = kcron_wheel_advance(&wheel, 7 + 5000);
+  while (expired != NULL) {
+    seen |= 1U << ((struct test_timer *)expired - timers);
+    expired = expired->next;
+  }
+  check(seen == 0x7, "long sleep: wrong timers expired", seen);
+  check(timers[3].timer.armed, "long sleep: later timer lost", timers[3].due);
+  check(kcron_wheel_next(&wheel) == 7 + 5001, "long sleep: wrong next", kcron_wheel_next(&wheel));
+}
+
+/* Many timers at mixed distances with some cancelled along the way */
+static void test_random(void) {
+  static struct test_timer timers[TEST_RANDOM_TIMERS];
+  struct kcron_wheel wheel;
+  uint64_t state = UINT64_C(0x9e3779b97f4a7c15);
+  uint64_t last_fired = 0;
+
+  kcron_wheel_init(&wheel, 123456789);
+  for (size_t i = 0; i < TEST_RANDOM_TIMERS; i++) {
+    unsigned int bits = 0;
+
+    state = state * UINT64_C(6364136223846793005) + UINT64_C(1442695040888963407);
+    /* spread the distances over every level, not just the top one */
+    bits = 1 + (unsigned int)((state >> 59) % (KCRON_WHEEL_BITS * KCRON_WHEEL_LEVELS));
+    timers[i] = (struct test_timer){.due = wheel.now + 1 + ((state >> 8) & ((UINT64_C(1) << bits) - 1))};
+    if (timers[i].due > wheel.now + KCRON_WHEEL_MAX_DELTA) {
+      timers[i].due = wheel.now + KCRON_WHEEL_MAX_DELTA;
+    }
+    kcron_wheel_add(&wheel, &timers[i].timer, timers[i].due);
+  }
+  for (size_t i = 0; i < TEST_RANDOM_TIMERS; i += 7) {
+    timers[i].cancelled = 1;
+    kcron_wheel_del(&wheel, &timers[i].timer);
+  }
+
+  run_until_empty(&wheel, wheel.now + KCRON_WHEEL_MAX_DELTA, &last_fired);
+  check_fired(timers, TEST_RANDOM_TIMERS, "random: fired wrong");
+}
+
+int main(void) {
+  test_insert_and_order(0);
+  test_insert_and_order(62);
+  test_cancel();
+  test_cascade(0);
+  test_cascade(4095);
+  test_cascade(UINT64_C(1) << 30);
+  test_long_sleep();
+  test_random();
+
+  if (failures != 0) {
+    (void)fprintf(stderr, "%s: %d checks failed\n", __PROGRAM_NAME, failures);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
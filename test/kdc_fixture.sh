@@ -0,0 +1,363 @@
+# shellcheck shell=bash
+
+###########################################################
+#
+# Copyright 2023 Fermi Research Alliance, LLC
+#
+# This software was produced under U.S. Government contract DE-AC02-07CH11359 for Fermi National Accelerator Laboratory (Fermilab), which is operated by Fermi Research Alliance, LLC for the U.S. Department of Energy. The U.S. Government has rights to use, reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR FERMI RESEARCH ALLIANCE, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is modified to produce derivative works, such modified software should be clearly marked, so as not to confuse it with the version available from Fermilab.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR FERMI RESEARCH ALLIANCE, LLC BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#
+###########################################################
+#        Throwaway MIT realm for tests and benchmarks
+###########################################################
+# Source this file, then:
+#
+#   kdc_fixture_available || exit 77
+#   kdc_fixture_start
+#   trap kdc_fixture_stop EXIT
+#   kdc_fixture_addprinc someuser password
+#
+# The realm lives under ${KDC_FIXTURE_DIR} and listens on unprivileged
+# loopback ports, so it needs no root and does not touch the host's
+# /etc/krb5.conf.  KRB5_CONFIG, KRB5_KDC_PROFILE and KRB5CCNAME are
+# exported for everything started afterwards.
+#
+# kadmind gets the same ACL the README asks sites to deploy:
+#   *@REALM  acdim  *1/cron/*@REALM
+###########################################################
+KDC_FIXTURE_REALM=${KDC_FIXTURE_REALM:-KCRON.TEST}
+KDC_FIXTURE_MASTER_PW=${KDC_FIXTURE_MASTER_PW:-kcron-fixture-master}
+KDC_FIXTURE_KEEP=${KDC_FIXTURE_KEEP:-0}
+KDC_FIXTURE_ENCTYPES=${KDC_FIXTURE_ENCTYPES:-'aes256-cts-hmac-sha1-96:normal aes128-cts-hmac-sha1-96:normal'}
+KDC_FIXTURE_SHELL_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")/../src/shell" && pwd)
+
+###########################################################
+kdc_fixture_find() {
+    # The daemons usually live in sbin, which is often not in PATH
+    local name=$1
+    local dir
+
+    if command -v "${name}" 2>/dev/null; then
+        return 0
+    fi
+    for dir in /usr/sbin /usr/local/sbin /usr/lib/mit/sbin /usr/bin; do
+        if [[ -x "${dir}/${name}" ]]; then
+            echo "${dir}/${name}"
+            return 0
+        fi
+    done
+    return 1
+}
+
+###########################################################
+kdc_fixture_available() {
+    local tool
+    for tool in krb5kdc kadmind kdb5_util kadmin.local kadmin kinit klist kdestroy; do
+        if ! kdc_fixture_find "${tool}" >/dev/null; then
+            echo "kdc_fixture: '${tool}' not found, need krb5-server and krb5-workstation" >&2
+            return 1
+        fi
+    done
+    return 0
+}
+
+###########################################################
+kdc_fixture_free_port() {
+    # Anything nobody answers on will do, the daemons fail loudly on a clash
+    local port
+    for _ in $(seq 1 64); do
+        port=$((20000 + (RANDOM * 32768 + RANDOM) % 40000))
+        if ! (exec 3<>"/dev/tcp/127.0.0.1/${port}") 2>/dev/null; then
+            echo "${port}"
+            return 0
+        fi
+    done
+    return 1
+}
+
+###########################################################
+kdc_fixture_wait_port() {
+    local port=$1
+    for _ in $(seq 1 100); do
+        if (exec 3<>"/dev/tcp/127.0.0.1/${port}") 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo "kdc_fixture: nothing listening on port ${port}" >&2
+    return 1
+}
+
+###########################################################
+kdc_fixture_write_krb5_conf() {
+    # One kdc line per running krb5kdc, in start order
+    local port
+
+    {
+        echo '[libdefaults]'
+        echo "    default_realm = ${KDC_FIXTURE_REALM}"
+        echo '    dns_lookup_kdc = false'
+        echo '    dns_lookup_realm = false'
+        echo '    dns_canonicalize_hostname = false'
+        echo '    rdns = false'
+        echo "    default_ccache_name = FILE:${KDC_FIXTURE_DIR}/ccache/krb5cc_%{uid}"
+        echo ''
+        echo '[realms]'
+        echo "    ${KDC_FIXTURE_REALM} = {"
+        while read -r port; do
+            echo "        kdc = 127.0.0.1:${port}"
+        done <"${KDC_FIXTURE_DIR}/kdc.ports"
+        echo "        admin_server = 127.0.0.1:${KDC_FIXTURE_KADMIN_PORT}"
+        echo "        kpasswd_server = 127.0.0.1:${KDC_FIXTURE_KPASSWD_PORT}"
+        echo '    }'
+    } >"${KDC_FIXTURE_DIR}/krb5.conf"
+}
+
+###########################################################
+kdc_fixture_write_kdc_conf() {
+    # Every krb5kdc shares the database but logs to its own file
+    local name=$1
+
+    {
+        echo '[kdcdefaults]'
+        echo '    kdc_ports = 88'
+        echo '    kdc_tcp_ports = 88'
+        echo ''
+        echo '[realms]'
+        echo "    ${KDC_FIXTURE_REALM} = {"
+        echo "        database_name = ${KDC_FIXTURE_DIR}/principal"
+        echo "        key_stash_file = ${KDC_FIXTURE_DIR}/stash"
+        echo "        acl_file = ${KDC_FIXTURE_DIR}/kadm5.acl"
+        echo "        kadmind_port = ${KDC_FIXTURE_KADMIN_PORT}"
+        echo "        kpasswd_port = ${KDC_FIXTURE_KPASSWD_PORT}"
+        echo '        max_life = 10h 0m 0s'
+        echo '        max_renewable_life = 7d 0h 0m 0s'
+        echo "        supported_enctypes = ${KDC_FIXTURE_ENCTYPES}"
+        echo '    }'
+        echo ''
+        echo '[logging]'
+        echo "    kdc = FILE:${KDC_FIXTURE_DIR}/kdc-${name}.log"
+        echo "    admin_server = FILE:${KDC_FIXTURE_DIR}/kadmind.log"
+        echo "    default = FILE:${KDC_FIXTURE_DIR}/krb5libs.log"
+    } >"${KDC_FIXTURE_DIR}/kdc-${name}.conf"
+}
+
+###########################################################
+kdc_fixture_start_kdc() {
+    # kdc_fixture_start_kdc NAME - another krb5kdc on the same database
+    local name=$1
+    local port
+
+    if ! port=$(kdc_fixture_free_port); then
+        echo "kdc_fixture: no free port for kdc ${name}" >&2
+        return 1
+    fi
+    kdc_fixture_write_kdc_conf "${name}"
+    # Started from a subshell so callers can wait for their own jobs
+    (
+        KRB5_KDC_PROFILE="${KDC_FIXTURE_DIR}/kdc-${name}.conf" \
+            "$(kdc_fixture_find krb5kdc)" -n -p "${port}" -r "${KDC_FIXTURE_REALM}" \
+            >>"${KDC_FIXTURE_DIR}/kdc-${name}.out" 2>&1 &
+        echo $! >"${KDC_FIXTURE_DIR}/kdc-${name}.pid"
+    )
+    echo "${port}" >"${KDC_FIXTURE_DIR}/kdc-${name}.port"
+
+    if ! kdc_fixture_wait_port "${port}"; then
+        cat "${KDC_FIXTURE_DIR}/kdc-${name}.out" >&2
+        return 1
+    fi
+    echo "${port}" >>"${KDC_FIXTURE_DIR}/kdc.ports"
+    kdc_fixture_write_krb5_conf
+}
+
+###########################################################
+kdc_fixture_start() {
+    if ! KDC_FIXTURE_DIR=$(mktemp -d "${TMPDIR:-/tmp}/kcron-kdc.XXXXXX"); then
+        return 1
+    fi
+    mkdir -p "${KDC_FIXTURE_DIR}/ccache"
+    : >"${KDC_FIXTURE_DIR}/kdc.ports"
+
+    KDC_FIXTURE_KADMIN_PORT=$(kdc_fixture_free_port) || return 1
+    KDC_FIXTURE_KPASSWD_PORT=$(kdc_fixture_free_port) || return 1
+
+    echo "*@${KDC_FIXTURE_REALM}    acdim    *1/cron/*@${KDC_FIXTURE_REALM}" >"${KDC_FIXTURE_DIR}/kadm5.acl"
+
+    kdc_fixture_write_kdc_conf main
+    kdc_fixture_write_krb5_conf
+    export KRB5_CONFIG="${KDC_FIXTURE_DIR}/krb5.conf"
+    export KRB5_KDC_PROFILE="${KDC_FIXTURE_DIR}/kdc-main.conf"
+    export KRB5CCNAME="FILE:${KDC_FIXTURE_DIR}/ccache/default"
+    unset KRB5_KTNAME KRB5_CLIENT_KTNAME KRB5RCACHEDIR
+
+    if ! "$(kdc_fixture_find kdb5_util)" -r "${KDC_FIXTURE_REALM}" -P "${KDC_FIXTURE_MASTER_PW}" create -s \
+        >"${KDC_FIXTURE_DIR}/kdb5_util.out" 2>&1; then
+        cat "${KDC_FIXTURE_DIR}/kdb5_util.out" >&2
+        return 1
+    fi
+
+    kdc_fixture_start_kdc main || return 1
+
+    (
+        "$(kdc_fixture_find kadmind)" -nofork -r "${KDC_FIXTURE_REALM}" \
+            >>"${KDC_FIXTURE_DIR}/kadmind.out" 2>&1 &
+        echo $! >"${KDC_FIXTURE_DIR}/kadmind.pid"
+    )
+    if ! kdc_fixture_wait_port "${KDC_FIXTURE_KADMIN_PORT}"; then
+        cat "${KDC_FIXTURE_DIR}/kadmind.out" >&2
+        return 1
+    fi
+    return 0
+}
+
+###########################################################
+kdc_fixture_stop() {
+    local pidfile
+    local pid
+
+    if [[ -z "${KDC_FIXTURE_DIR:-}" || ! -d "${KDC_FIXTURE_DIR}" ]]; then
+        return 0
+    fi
+    kdc_fixture_netem_clear
+    for pidfile in "${KDC_FIXTURE_DIR}"/*.pid; do
+        if [[ -r "${pidfile}" ]]; then
+            pid=$(cat "${pidfile}")
+            kill -CONT "${pid}" 2>/dev/null
+            kill "${pid}" 2>/dev/null
+            # Not our child, so poll rather than wait
+            for _ in $(seq 1 50); do
+                kill -0 "${pid}" 2>/dev/null || break
+                sleep 0.1
+            done
+        fi
+    done
+    if [[ "${KDC_FIXTURE_KEEP}" == "1" ]]; then
+        echo "kdc_fixture: kept ${KDC_FIXTURE_DIR}" >&2
+    else
+        rm -rf "${KDC_FIXTURE_DIR}"
+    fi
+}
+
+###########################################################
+kdc_fixture_addprinc() {
+    # kdc_fixture_addprinc PRINCIPAL PASSWORD
+    "$(kdc_fixture_find kadmin.local)" -r "${KDC_FIXTURE_REALM}" \
+        -q "add_principal -pw $2 $1@${KDC_FIXTURE_REALM}" >/dev/null 2>&1
+}
+
+###########################################################
+kdc_fixture_count_principals() {
+    # kdc_fixture_count_principals GLOB
+    "$(kdc_fixture_find kadmin.local)" -r "${KDC_FIXTURE_REALM}" \
+        -q "list_principals $1" 2>/dev/null | grep -c "@${KDC_FIXTURE_REALM}"
+}
+
+###########################################################
+kdc_fixture_count_requests() {
+    # kdc_fixture_count_requests AS_REQ|TGS_REQ [KDC] - one log line per reply
+    grep -c "$1 " "${KDC_FIXTURE_DIR}/kdc-${2:-main}.log" 2>/dev/null
+}
+
+###########################################################
+kdc_fixture_stand_in() {
+    # kdc_fixture_stand_in KEYTAB - a helper that prints KEYTAB whatever its
+    # arguments, in place of init-kcron-keytab and client-keytab-name
+    local stand_in
+
+    mkdir -p "${KDC_FIXTURE_DIR}/stand-in"
+    stand_in=$(mktemp "${KDC_FIXTURE_DIR}/stand-in/helper.XXXXXX") || return 1
+    printf '#!/bin/bash\necho %q\n' "$1" >"${stand_in}"
+    chmod 0755 "${stand_in}"
+    echo "${stand_in}"
+}
+
+###########################################################
+kdc_fixture_kcron_user() {
+    # kdc_fixture_kcron_user INDEX PASSWORD KEYTAB_INIT KEYTAB_NAME_UTIL
+    # Principal bench<INDEX> with a home whose ~/.config/kcron points
+    # kcroninit/kcrondestroy at this realm and the given keytab helpers.
+    local i=$1
+    local home="${KDC_FIXTURE_DIR}/home/${i}"
+
+    if ! kdc_fixture_addprinc "bench${i}" "$2"; then
+        echo "kdc_fixture: could not create bench${i}" >&2
+        return 1
+    fi
+    mkdir -p "${home}/.config" "${KDC_FIXTURE_DIR}/out"
+    {
+        echo "REALM=${KDC_FIXTURE_REALM}"
+        echo "WHOAMI=bench${i}"
+        echo 'NODENAME=bench.kcron.test'
+        echo "FULLPRINCIPAL=bench${i}/cron/bench.kcron.test@${KDC_FIXTURE_REALM}"
+        echo "KEYTAB_INIT='$3'"
+        echo "KEYTAB_NAME_UTIL='$4'"
+        echo "KCRON_ADMIN_CCNAME=FILE:${KDC_FIXTURE_DIR}/ccache/admin.${i}"
+    } >"${home}/.config/kcron"
+}
+
+###########################################################
+kdc_fixture_kcron() {
+    # kdc_fixture_kcron SCRIPT INDEX PASSWORD - answer the prompt and password.
+    # KDC_FIXTURE_PATH, when set, is searched ahead of PATH.
+    local out="${KDC_FIXTURE_DIR}/out/$1.$2"
+
+    if ! printf 'y\n%s\n' "$3" | HOME="${KDC_FIXTURE_DIR}/home/$2" PATH="${KDC_FIXTURE_PATH:-}${KDC_FIXTURE_PATH:+:}${PATH}" \
+        bash -u "${KDC_FIXTURE_SHELL_DIR}/$1" >"${out}" 2>&1; then
+        echo "kdc_fixture: $1 failed for bench$2, see ${out}" >&2
+        return 1
+    fi
+    return 0
+}
+
+###########################################################
+kdc_fixture_netem_delay() {
+    # kdc_fixture_netem_delay MS - delay every loopback packet, root only.
+    # Applies in both directions, so a round trip costs twice MS.
+    if [[ ${EUID} -ne 0 ]] || ! command -v tc >/dev/null 2>&1; then
+        return 1
+    fi
+    if ! tc qdisc replace dev lo root netem delay "$1ms" 2>/dev/null; then
+        return 1
+    fi
+    touch "${KDC_FIXTURE_DIR}/netem"
+    return 0
+}
+
+###########################################################
+kdc_fixture_netem_clear() {
+    if [[ -e "${KDC_FIXTURE_DIR}/netem" ]]; then
+        tc qdisc del dev lo root 2>/dev/null
+        rm -f "${KDC_FIXTURE_DIR}/netem"
+    fi
+}
+
+###########################################################
+kdc_fixture_now_us() {
+    # EPOCHREALTIME honours the locale's radix character
+    echo "${EPOCHREALTIME//[!0-9]/}"
+}
+
+###########################################################
+kdc_fixture_report() {
+    # kdc_fixture_report LOG PHASE... - LOG lines are "phase microseconds"
+    local log=$1
+    shift
+    local phase
+
+    printf '%-18s %7s %9s %9s %9s %9s %9s\n' phase calls mean_ms p50_ms p90_ms p99_ms max_ms
+    for phase in "$@"; do
+        grep "^${phase} " "${log}" | cut -d' ' -f2 | sort -n | awk -v phase="${phase}" '
+            # nearest rank
+            function pct(p,    r, i) { r = NR * p; i = int(r); if (i < r) { i++ }; return v[i < 1 ? 1 : i] / 1000 }
+            { v[NR] = $1; sum += $1 }
+            END {
+                if (NR == 0) { exit }
+                printf "%-18s %7d %9.1f %9.1f %9.1f %9.1f %9.1f\n", phase, NR, sum / NR / 1000, pct(0.50), pct(0.90), pct(0.99), v[NR] / 1000
+            }'
+    done
+}